@@ -8,30 +8,127 @@ typedef struct hashnode {
   char key[128];                // string key for items in the map
   char val[128];                // string value for items in the map
   struct hashnode *next;        // pointer to next node, NULL if last node
+  long expires;                 // map time in ms at which the item expires, 0 if never
+  struct hashnode **wheel_pprev; // timing wheel link pointing at this node, NULL if not filed
+  struct hashnode *wheel_next;  // next node in the same timing wheel slot
+  void *ptr;                    // pointer value set by hashmap_put_ptr(), NULL otherwise
 } hashnode_t;
 
+#define HASHMAP_CHAINED 0       // engine: table of linked lists indexed by hashcode()
+#define HASHMAP_CUCKOO  1       // engine: bucketized cuckoo hashing, see hashmap_cuckoo.c
+
+#define HASHMAP_CUCKOO_WAYS  4  // slots per cuckoo bucket
+#define HASHMAP_CUCKOO_STASH 8  // items that may overflow into the cuckoo stash
+
+// Bucket of the cuckoo engine: exactly one 64-byte cache line holding
+// 4 slots. Each slot keeps the full hashmap_strhash() of its key so
+// that nodes are only visited on a hash match.
+typedef struct {
+  unsigned long hashes[HASHMAP_CUCKOO_WAYS]; // hash of the key in each slot
+  hashnode_t *nodes[HASHMAP_CUCKOO_WAYS];    // node in each slot, NULL if empty
+} cuckoobucket_t;
+
+// Ordered index over the keys of a hash map, see hashmap_index.c
+typedef struct hashindex hashindex_t;
+
+// Timing wheel tracking items with a TTL, see hashmap_ttl.c
+typedef struct hashwheel hashwheel_t;
+
 // Type of hash table
 typedef struct {
   int item_count;               // how many key/val pairs in the table
-  int table_size;               // how big is the table array
+  int table_size;               // how big is the table array (cuckoo: number of buckets)
   hashnode_t **table;           // array of pointers to nodes which contain key/val pairs
+  int engine;                   // HASHMAP_CHAINED or HASHMAP_CUCKOO
+  cuckoobucket_t *buckets;      // cuckoo: array of table_size buckets, NULL otherwise
+  hashnode_t *stash[HASHMAP_CUCKOO_STASH]; // cuckoo: items that found no bucket slot
+  int stash_count;              // cuckoo: number of items in stash
+  hashindex_t *index;           // ordered key index, NULL unless hashmap_index_enable() was called
+  long now;                     // current map time in ms, set by hashmap_advance()
+  hashwheel_t *wheel;           // expiry timing wheel, NULL until the first hashmap_put_ttl()
 } hashmap_t;
 
 #define HASHMAP_DEFAULT_TABLE_SIZE 5 // default size of table for main application
 
+// Slot of a frozen map: offsets of the key and value strings in the
+// frozen map's string pool
+typedef struct {
+  unsigned int key_off;         // offset of key string in 'strings'
+  unsigned int val_off;         // offset of value string in 'strings'
+} frozenslot_t;
+
+// Type of read-only map built from a hashmap_t by hashmap_freeze().
+// Keys are placed with a minimal perfect hash (CHD style hash and
+// displace) so every key owns exactly one slot and lookups do a single
+// probe. All parts live in one contiguous image 'blob' which is also
+// the on-disk format so a saved map can be mmap()'d back in directly.
+typedef struct {
+  int item_count;               // number of keys, also number of slots
+  int bucket_count;             // number of displacement buckets
+  unsigned long seed;           // seed for hashmap_strhash() on keys
+  unsigned int *disp;           // per-bucket displacement, points into blob
+  frozenslot_t *slots;          // item_count slots, points into blob
+  char *strings;                // key/val string pool, points into blob
+  char *blob;                   // contiguous image holding all of the above
+  long blob_size;               // size of the image in bytes
+  int mapped;                   // 1 if blob is mmap()'d from a file, 0 if malloc()'d
+} frozenmap_t;
+
 // functions defined in hash_funcs.c
 long  hashcode(char key[]);
 int   next_prime(int num);
+unsigned long hashmap_mix(unsigned long x);
+unsigned long hashmap_strhash(char key[], unsigned long seed);
 
 void  hashmap_init(hashmap_t *hm, int table_size); 
+void  hashmap_init_engine(hashmap_t *hm, int table_size, int engine);
 int   hashmap_put(hashmap_t *hm, char key[], char value[]);
+hashnode_t *hashmap_new_node(hashmap_t *hm, char key[], char value[]);
 void  hashmap_expand(hashmap_t *hm);
 char *hashmap_get(hashmap_t *hm, char key[]);
+hashnode_t *hashmap_get_node(hashmap_t *hm, char key[]);
+int   hashmap_put_ptr(hashmap_t *hm, char key[], void *ptr);
+void *hashmap_get_ptr(hashmap_t *hm, char key[]);
+int   hashmap_remove(hashmap_t *hm, char key[]);
+void  hashmap_remove_node(hashmap_t *hm, hashnode_t *node);
 void  hashmap_free_table(hashmap_t *hm);
 
 void  hashmap_write_items(hashmap_t *hm, FILE *out);
 void  hashmap_show_structure(hashmap_t *hm);
 void  hashmap_save(hashmap_t *hm, char *filename);
 int   hashmap_load(hashmap_t *hm, char *filename);
+void  hashmap_foreach(hashmap_t *hm, void (*func)(hashnode_t *node, void *arg), void *arg);
+
+// functions defined in hashmap_index.c
+void  hashmap_index_enable(hashmap_t *hm);
+void  hashmap_index_show(hashmap_t *hm);
+int   hashmap_prefix(hashmap_t *hm, char prefix[], void (*func)(hashnode_t *node, void *arg), void *arg);
+int   hashmap_range(hashmap_t *hm, char lo[], char hi[], void (*func)(hashnode_t *node, void *arg), void *arg);
+void  hashindex_insert(hashindex_t *index, hashnode_t *item);
+void  hashindex_remove(hashindex_t *index, hashnode_t *item);
+void  hashindex_free(hashindex_t *index);
+
+// functions defined in hashmap_ttl.c
+int   hashmap_put_ttl(hashmap_t *hm, char key[], char value[], long ttl_ms);
+int   hashmap_advance(hashmap_t *hm, long now_ms);
+void  hashwheel_cancel(hashmap_t *hm, hashnode_t *node);
+void  hashwheel_free(hashwheel_t *wheel);
+
+// functions defined in hashmap_cuckoo.c
+void  cuckoo_init(hashmap_t *hm, int bucket_count);
+int   cuckoo_put(hashmap_t *hm, char key[], char value[]);
+hashnode_t *cuckoo_get_node(hashmap_t *hm, char key[]);
+void  cuckoo_unlink(hashmap_t *hm, hashnode_t *node);
+void  cuckoo_expand(hashmap_t *hm);
+void  cuckoo_free_table(hashmap_t *hm);
+void  cuckoo_show_structure(hashmap_t *hm);
+
+// functions defined in hashmap_frozen.c
+int   hashmap_freeze(hashmap_t *hm, frozenmap_t *fm);
+char *frozenmap_get(frozenmap_t *fm, char key[]);
+int   frozenmap_save(frozenmap_t *fm, char *filename);
+int   frozenmap_load(frozenmap_t *fm, char *filename);
+void  frozenmap_thaw(frozenmap_t *fm, hashmap_t *hm);
+void  frozenmap_free(frozenmap_t *fm);
 
 #endif
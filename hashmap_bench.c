@@ -0,0 +1,299 @@
+// hashmap_bench.c: timing benchmarks for hash map operations. Run as
+//
+//   ./hashmap_bench <bench> [nkeys]
+//
+// where <bench> names one of the benchmarks below or 'all'. Results
+// are printed one line per measurement.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+// Current time in nanoseconds from a monotonic clock
+static double now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Fills 'keys' with 'n' distinct random alphanumeric keys of 6 to 15
+// characters; distinctness comes from a base-36 counter suffix.
+static void make_keys(char (*keys)[32], int n){
+  const char *alpha = "abcdefghijklmnopqrstuvwxyz0123456789";
+  srand(2021);
+  for(int i=0; i<n; i++){
+    int len = 2 + rand() % 8;
+    for(int j=0; j<len; j++){
+      keys[i][j] = alpha[rand() % 36];
+    }
+    int id = i;
+    for(int j=0; j<4; j++){
+      keys[i][len++] = alpha[id % 36];
+      id /= 36;
+    }
+    keys[i][len] = '\0';
+  }
+}
+
+// Fills 'keys' with 'n' distinct keys in groups of 'group' which share
+// their first 8 characters, the worst case for hashcode()
+static void make_skewed_keys(char (*keys)[32], int n, int group){
+  make_keys(keys, n);
+  for(int i=0; i<n; i++){
+    char suffix[32];
+    strcpy(suffix, keys[i]);
+    sprintf(keys[i], "grp%05d%.20s", (i / group) % 100000, suffix);
+  }
+}
+
+// Builds a live hash map holding 'keys' with table_size near nkeys
+static void build_map(hashmap_t *hm, char (*keys)[32], int n, int engine){
+  hashmap_init_engine(hm, next_prime(n | 1), engine);
+  for(int i=0; i<n; i++){
+    hashmap_put(hm, keys[i], keys[i]);
+  }
+}
+
+// Bytes used by the table array and nodes of a live hash map
+static long live_bytes(hashmap_t *hm){
+  return sizeof(hashnode_t *) * (long) hm->table_size +
+    sizeof(hashnode_t) * (long) hm->item_count;
+}
+
+// Frozen vs. live hash map: get latency for hits and memory use
+static void bench_frozen(int n){
+  char (*keys)[32] = malloc(sizeof(*keys) * n);
+  make_keys(keys, n);
+  hashmap_t hm;
+  build_map(&hm, keys, n, HASHMAP_CHAINED);
+
+  frozenmap_t fm = {0};
+  double t0 = now_ns();
+  if(!hashmap_freeze(&hm, &fm)){
+    printf("freeze failed\n");
+    exit(1);
+  }
+  double build_ns = now_ns() - t0;
+
+  int lookups = 4 * n;
+  int *order = malloc(sizeof(int) * lookups);
+  for(int i=0; i<lookups; i++){
+    order[i] = rand() % n;
+  }
+  long found = 0;
+  t0 = now_ns();
+  for(int i=0; i<lookups; i++){
+    found += hashmap_get(&hm, keys[order[i]]) != NULL;
+  }
+  double live_ns = (now_ns() - t0) / lookups;
+  t0 = now_ns();
+  for(int i=0; i<lookups; i++){
+    found += frozenmap_get(&fm, keys[order[i]]) != NULL;
+  }
+  double frozen_ns = (now_ns() - t0) / lookups;
+
+  printf("frozen n=%d found=%ld\n", n, found);
+  printf("  freeze build:     %10.1f ms\n", build_ns / 1e6);
+  printf("  live get:         %10.1f ns/op  %10ld bytes\n", live_ns, live_bytes(&hm));
+  printf("  frozen get:       %10.1f ns/op  %10ld bytes\n", frozen_ns, fm.blob_size);
+
+  free(order);
+  free(keys);
+  frozenmap_free(&fm);
+  hashmap_free_table(&hm);
+}
+
+static int compare_double(const void *a, const void *b){
+  double x = *(double *) a, y = *(double *) b;
+  return (x > y) - (x < y);
+}
+
+// Times each of 'lookups' gets on 'hm' individually and prints the
+// mean and tail latencies
+static void get_latencies(char *label, hashmap_t *hm, char (*keys)[32], int n, int lookups){
+  double *lat = malloc(sizeof(double) * lookups);
+  long found = 0;
+  for(int i=0; i<lookups; i++){
+    char *key = keys[rand() % n];
+    double t0 = now_ns();
+    found += hashmap_get(hm, key) != NULL;
+    lat[i] = now_ns() - t0;
+  }
+  double sum = 0;
+  for(int i=0; i<lookups; i++){
+    sum += lat[i];
+  }
+  qsort(lat, lookups, sizeof(double), compare_double);
+  printf("  %-8s found=%ld mean %8.1f  p50 %8.1f  p99 %8.1f  p99.9 %8.1f  max %10.1f ns\n",
+         label, found, sum / lookups, lat[lookups/2], lat[(long) lookups*99/100],
+         lat[(long) lookups*999/1000], lat[lookups-1]);
+  free(lat);
+}
+
+// Chained vs. cuckoo engines: get latency distribution on a skewed
+// key set where groups of 64 keys share their hashcode()
+static void bench_cuckoo(int n){
+  char (*keys)[32] = malloc(sizeof(*keys) * n);
+  make_skewed_keys(keys, n, 64);
+  printf("cuckoo n=%d skewed groups of 64\n", n);
+  int engines[2] = {HASHMAP_CHAINED, HASHMAP_CUCKOO};
+  char *labels[2] = {"chained", "cuckoo"};
+  for(int e=0; e<2; e++){
+    hashmap_t hm;
+    double t0 = now_ns();
+    build_map(&hm, keys, n, engines[e]);
+    printf("  %-8s build %10.1f ms\n", labels[e], (now_ns() - t0) / 1e6);
+    get_latencies(labels[e], &hm, keys, n, 1000000);
+    hashmap_free_table(&hm);
+  }
+  free(keys);
+}
+
+// Plain vs. TTL puts: throughput of put, get and expiry with 'n'
+// keys whose TTLs are spread evenly over 10 seconds of map time
+static void bench_ttl(int n){
+  char (*keys)[32] = malloc(sizeof(*keys) * n);
+  make_keys(keys, n);
+  printf("ttl n=%d ttls spread over 10000 ms\n", n);
+  for(int with_ttl=0; with_ttl<2; with_ttl++){
+    char *label = with_ttl ? "ttl" : "plain";
+    hashmap_t hm;
+    hashmap_init_engine(&hm, next_prime(n | 1), HASHMAP_CHAINED);
+    double t0 = now_ns();
+    for(int i=0; i<n; i++){
+      if(with_ttl){
+        hashmap_put_ttl(&hm, keys[i], keys[i], 1 + (long) i * 10000 / n);
+      }
+      else{
+        hashmap_put(&hm, keys[i], keys[i]);
+      }
+    }
+    double put_ns = (now_ns() - t0) / n;
+    long found = 0;
+    t0 = now_ns();
+    for(int i=0; i<n; i++){
+      found += hashmap_get(&hm, keys[rand() % n]) != NULL;
+    }
+    double get_ns = (now_ns() - t0) / n;
+    printf("  %-6s put %8.1f ns/op  get %8.1f ns/op  found=%ld\n", label, put_ns, get_ns, found);
+    if(with_ttl){
+      // advance one millisecond at a time as a server tick would
+      long expired = 0;
+      t0 = now_ns();
+      for(long ms=1; ms <= 10001; ms++){
+        expired += hashmap_advance(&hm, ms);
+      }
+      double advance_ns = now_ns() - t0;
+      printf("  %-6s expire %ld in %8.1f ms  %8.1f ns/expired item  left=%d\n",
+             label, expired, advance_ns / 1e6, advance_ns / expired, hm.item_count);
+      // idle ticks on a large map with nothing due
+      hashmap_t idle;
+      hashmap_init_engine(&idle, next_prime(n | 1), HASHMAP_CHAINED);
+      for(int i=0; i<n; i++){
+        hashmap_put_ttl(&idle, keys[i], keys[i], 3600000);
+      }
+      t0 = now_ns();
+      for(long ms=1; ms <= 10000; ms++){
+        hashmap_advance(&idle, ms);
+      }
+      printf("  %-6s idle tick %8.1f ns/tick with %d pending\n",
+             label, (now_ns() - t0) / 10000, idle.item_count);
+      hashmap_free_table(&idle);
+    }
+    hashmap_free_table(&hm);
+  }
+  free(keys);
+}
+
+static void fprintf_item(hashnode_t *node, void *out){
+  fprintf(out, "%12s : %s\n", node->key, node->val);
+}
+
+// Seconds taken to write all items of 'hm' to a fresh temporary file
+// with hashmap_write_items() if 'fast' is set, else with the
+// fprintf() per item it replaced. The file is left in '*file'.
+static double time_write(hashmap_t *hm, int fast, FILE **file){
+  *file = tmpfile();
+  double t0 = now_ns();
+  if(fast){
+    hashmap_write_items(hm, *file);
+  }
+  else{
+    hashmap_foreach(hm, fprintf_item, *file);
+  }
+  fflush(*file);
+  return (now_ns() - t0) / 1e9;
+}
+
+// Compares the full contents of two files
+static int same_contents(FILE *a, FILE *b){
+  rewind(a);
+  rewind(b);
+  int ca, cb;
+  do{
+    ca = getc(a);
+    cb = getc(b);
+  } while(ca == cb && ca != EOF);
+  return ca == cb;
+}
+
+// fprintf() vs. buffered hashmap_write_items(): MB/s writing every
+// item of the map to a file, best of 5 runs each
+static void bench_write(int n){
+  char (*keys)[32] = malloc(sizeof(*keys) * n);
+  make_keys(keys, n);
+  hashmap_t hm;
+  build_map(&hm, keys, n, HASHMAP_CHAINED);
+  printf("write n=%d\n", n);
+  char *labels[2] = {"fprintf", "buffered"};
+  FILE *files[2];
+  for(int fast=0; fast<2; fast++){
+    double best = 1e30;
+    for(int run=0; run<5; run++){
+      double secs = time_write(&hm, fast, &files[fast]);
+      best = secs < best ? secs : best;
+      if(run < 4){
+        fclose(files[fast]);
+      }
+    }
+    long bytes = ftell(files[fast]);
+    printf("  %-8s %10ld bytes %8.1f ms %8.1f MB/s\n",
+           labels[fast], bytes, best * 1e3, bytes / best / 1e6);
+  }
+  printf("  output identical: %s\n", same_contents(files[0], files[1]) ? "yes" : "NO");
+  fclose(files[0]);
+  fclose(files[1]);
+  hashmap_free_table(&hm);
+  free(keys);
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    printf("usage: %s <bench> [nkeys]\n", argv[0]);
+    printf("benches: frozen cuckoo ttl write all\n");
+    return 1;
+  }
+  char *bench = argv[1];
+  int n = 1000000;
+  if(argc > 2){
+    n = atoi(argv[2]);
+  }
+  int all = strcmp(bench, "all") == 0;
+
+  if(all || strcmp(bench, "frozen") == 0){
+    bench_frozen(n);
+  }
+  if(all || strcmp(bench, "cuckoo") == 0){
+    bench_cuckoo(n);
+  }
+  if(all || strcmp(bench, "ttl") == 0){
+    bench_ttl(n);
+  }
+  if(all || strcmp(bench, "write") == 0){
+    bench_write(n);
+  }
+  return 0;
+}
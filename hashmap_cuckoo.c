@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hashmap.h"
+
+// hashmap_cuckoo.c: the HASHMAP_CUCKOO engine behind the hashmap_t
+// API. Selected with hashmap_init_engine(); hashmap_put(),
+// hashmap_get() and friends dispatch here for such maps.
+//
+// Every key has two candidate buckets derived from the two halves of
+// hashmap_strhash(key, 0). Each bucket is one cache line with 4
+// slots. A key lives in one of the 8 slots of its candidate buckets or
+// in a small stash, so hashmap_get() examines at most two bucket
+// cache lines (plus the stash, which is empty in all but rare cases)
+// no matter how the keys are distributed. Inserting into two full
+// buckets evicts ("kicks") a resident to its alternate bucket, up to
+// CUCKOO_MAX_KICKS times; the item left over after that goes to the
+// stash and when the stash is full the bucket array grows.
+
+#define CUCKOO_MAX_KICKS 256    // bound on displacement path length
+#define CUCKOO_MAX_LOAD  0.90   // fraction of slots filled before growing
+
+// Candidate buckets for a key with hash 'h'. The second bucket always
+// differs from the first when there is more than one bucket.
+static int cuckoo_bucket1(unsigned long h, int nb){
+  return (int) (((h & 0xffffffffUL) * nb) >> 32);
+}
+
+static int cuckoo_bucket2(unsigned long h, int nb){
+  int b1 = cuckoo_bucket1(h, nb);
+  int b2 = (int) (((h >> 32) * nb) >> 32);
+  if(b2 == b1 && nb > 1){
+    b2 = (b1 + 1) % nb;
+  }
+  return b2;
+}
+
+// Puts 'node' in a free slot of bucket 'b' if there is one; returns 1
+// if placed and 0 if the bucket is full.
+static int cuckoo_try_bucket(cuckoobucket_t *bucket, hashnode_t *node, unsigned long h){
+  for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+    if(bucket->nodes[k] == NULL){
+      bucket->nodes[k] = node;
+      bucket->hashes[k] = h;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Places 'node' with hash 'h' into the buckets, displacing residents
+// along a bounded path. Returns NULL if everything found a slot,
+// otherwise the node that was left homeless (not necessarily 'node').
+static hashnode_t *cuckoo_place(hashmap_t *hm, hashnode_t *node, unsigned long h){
+  int nb = hm->table_size;
+  int b = cuckoo_bucket1(h, nb);
+  if(cuckoo_try_bucket(&hm->buckets[b], node, h) ||
+     cuckoo_try_bucket(&hm->buckets[cuckoo_bucket2(h, nb)], node, h)){
+    return NULL;
+  }
+  for(int kick=0; kick < CUCKOO_MAX_KICKS; kick++){
+    // swap with a resident picked from the hash bits, then move the
+    // resident to its other bucket
+    int way = (h >> (kick % 60)) % HASHMAP_CUCKOO_WAYS;
+    cuckoobucket_t *bucket = &hm->buckets[b];
+    hashnode_t *victim = bucket->nodes[way];
+    unsigned long vh = bucket->hashes[way];
+    bucket->nodes[way] = node;
+    bucket->hashes[way] = h;
+    node = victim;
+    h = vh;
+    int alt = cuckoo_bucket1(h, nb);
+    if(alt == b){
+      alt = cuckoo_bucket2(h, nb);
+    }
+    b = alt;
+    if(cuckoo_try_bucket(&hm->buckets[b], node, h)){
+      return NULL;
+    }
+  }
+  return node;
+}
+
+// Allocates a zeroed array of 'nb' cache-line aligned buckets
+static cuckoobucket_t *cuckoo_alloc_buckets(int nb){
+  cuckoobucket_t *buckets = aligned_alloc(64, sizeof(cuckoobucket_t) * nb);
+  memset(buckets, 0, sizeof(cuckoobucket_t) * nb);
+  return buckets;
+}
+
+// Re-places all items, plus 'extra' if it is not NULL, into a fresh
+// array of at least 'nb' buckets, growing further until every item
+// fits in the buckets and stash. 'extra' must already be counted in
+// item_count.
+static void cuckoo_rehash(hashmap_t *hm, int nb, hashnode_t *extra){
+  int count = 0;
+  hashnode_t **nodes = malloc(sizeof(hashnode_t *) * (hm->item_count + 1));
+  if(extra != NULL){
+    nodes[count++] = extra;
+  }
+  for(int i=0; i < hm->table_size; i++){
+    for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+      if(hm->buckets[i].nodes[k] != NULL){
+        nodes[count++] = hm->buckets[i].nodes[k];
+      }
+    }
+  }
+  for(int i=0; i < hm->stash_count; i++){
+    nodes[count++] = hm->stash[i];
+  }
+  free(hm->buckets);
+
+  int placed_all = 0;
+  while(!placed_all){
+    hm->buckets = cuckoo_alloc_buckets(nb);
+    hm->table_size = nb;
+    hm->stash_count = 0;
+    placed_all = 1;
+    for(int i=0; i<count && placed_all; i++){
+      hashnode_t *left = cuckoo_place(hm, nodes[i], hashmap_strhash(nodes[i]->key, 0));
+      if(left != NULL){
+        if(hm->stash_count < HASHMAP_CUCKOO_STASH){
+          hm->stash[hm->stash_count++] = left;
+        }
+        else{
+          placed_all = 0;
+        }
+      }
+    }
+    if(!placed_all){
+      free(hm->buckets);
+      nb = next_prime(2*nb + 1);
+    }
+  }
+  free(nodes);
+}
+
+// Initialize 'hm' as an empty cuckoo map with 'bucket_count' buckets
+// of 4 slots each. Called from hashmap_init_engine().
+void cuckoo_init(hashmap_t *hm, int bucket_count){
+  if(bucket_count < 1){
+    bucket_count = 1;
+  }
+  hm->table_size = bucket_count;
+  hm->item_count = 0;
+  hm->stash_count = 0;
+  hm->buckets = cuckoo_alloc_buckets(bucket_count);
+}
+
+// Finds the node for 'key' with hash 'h' in its two buckets or the
+// stash; returns NULL if not present.
+static hashnode_t *cuckoo_find(hashmap_t *hm, char key[], unsigned long h){
+  cuckoobucket_t *b1 = &hm->buckets[cuckoo_bucket1(h, hm->table_size)];
+  cuckoobucket_t *b2 = &hm->buckets[cuckoo_bucket2(h, hm->table_size)];
+  for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+    if(b1->hashes[k] == h && b1->nodes[k] != NULL && strcmp(b1->nodes[k]->key, key) == 0){
+      return b1->nodes[k];
+    }
+  }
+  for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+    if(b2->hashes[k] == h && b2->nodes[k] != NULL && strcmp(b2->nodes[k]->key, key) == 0){
+      return b2->nodes[k];
+    }
+  }
+  for(int i=0; i < hm->stash_count; i++){
+    if(strcmp(hm->stash[i]->key, key) == 0){
+      return hm->stash[i];
+    }
+  }
+  return NULL;
+}
+
+// Cuckoo version of hashmap_put(): overwrites the value if 'key' is
+// present and returns 0, otherwise adds a new node and returns 1.
+// Grows the bucket array when slots are CUCKOO_MAX_LOAD full or an
+// item cannot be placed and the stash is full.
+int cuckoo_put(hashmap_t *hm, char key[], char value[]){
+  unsigned long h = hashmap_strhash(key, 0);
+  hashnode_t *node = cuckoo_find(hm, key, h);
+  if(node != NULL){
+    strcpy(node->val, value);
+    return 0;
+  }
+  if(hm->item_count + 1 > CUCKOO_MAX_LOAD * HASHMAP_CUCKOO_WAYS * hm->table_size){
+    cuckoo_rehash(hm, next_prime(2*hm->table_size + 1), NULL);
+  }
+  node = hashmap_new_node(hm, key, value);
+  hashnode_t *left = cuckoo_place(hm, node, h);
+  if(left != NULL && hm->stash_count < HASHMAP_CUCKOO_STASH){
+    hm->stash[hm->stash_count++] = left;
+  }
+  else if(left != NULL){
+    cuckoo_rehash(hm, next_prime(2*hm->table_size + 1), left);
+  }
+  return 1;
+}
+
+// Cuckoo version of hashmap_get_node(): checks the key's two buckets
+// and the stash. Returns the node for 'key' or NULL if not found.
+hashnode_t *cuckoo_get_node(hashmap_t *hm, char key[]){
+  return cuckoo_find(hm, key, hashmap_strhash(key, 0));
+}
+
+// Removes 'node' from the slot or stash entry holding it. Does not
+// free the node or change item_count; see hashmap_remove_node().
+void cuckoo_unlink(hashmap_t *hm, hashnode_t *node){
+  unsigned long h = hashmap_strhash(node->key, 0);
+  int b[2] = {cuckoo_bucket1(h, hm->table_size), cuckoo_bucket2(h, hm->table_size)};
+  for(int i=0; i<2; i++){
+    for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+      if(hm->buckets[b[i]].nodes[k] == node){
+        hm->buckets[b[i]].nodes[k] = NULL;
+        return;
+      }
+    }
+  }
+  for(int i=0; i < hm->stash_count; i++){
+    if(hm->stash[i] == node){
+      hm->stash[i] = hm->stash[--hm->stash_count];
+      return;
+    }
+  }
+}
+
+// Cuckoo version of hashmap_expand(): re-places all items into
+// next_prime(2*table_size+1) buckets.
+void cuckoo_expand(hashmap_t *hm){
+  cuckoo_rehash(hm, next_prime(2*hm->table_size + 1), NULL);
+}
+
+// Cuckoo version of hashmap_free_table(): frees all nodes and the
+// bucket array and zeroes the fields. Called after the ordered index
+// has been free'd.
+void cuckoo_free_table(hashmap_t *hm){
+  if(hm->buckets == NULL){
+    return;
+  }
+  for(int i=0; i < hm->table_size; i++){
+    for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+      free(hm->buckets[i].nodes[k]);
+    }
+  }
+  for(int i=0; i < hm->stash_count; i++){
+    free(hm->stash[i]);
+  }
+  free(hm->buckets);
+  hm->buckets = NULL;
+  hm->stash_count = 0;
+  hm->item_count = 0;
+  hm->table_size = 0;
+}
+
+// Cuckoo version of hashmap_show_structure(). Same format with the
+// slots of each bucket on its line, empty slots shown as {}, and the
+// stash on a final line. EXAMPLE:
+//
+// engine: cuckoo
+// item_count: 3
+// table_size: 2
+// load_factor: 1.5000
+//   0 : {(65) A : 1} {} {} {}
+//   1 : {(66) B : 2} {(67) C : 3} {} {}
+// stash :
+void cuckoo_show_structure(hashmap_t *hm){
+  double load_factor = ((double)hm-> item_count)/((double)hm-> table_size);
+  printf("engine: cuckoo\n");
+  printf("item_count: %d\n", hm-> item_count);
+  printf("table_size: %d\n", hm-> table_size);
+  printf("load_factor: %.4lf\n", load_factor);
+  for(int i = 0; i < hm->table_size; i++){
+    printf("%3d : ", i);
+    for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+      hashnode_t *node = hm->buckets[i].nodes[k];
+      if(node == NULL){
+        printf("{} ");
+      }
+      else{
+        printf("{(%ld) %s : %s} ", hashcode(node->key), node->key, node->val);
+      }
+    }
+    printf("\n");
+  }
+  printf("stash : ");
+  for(int i=0; i < hm->stash_count; i++){
+    printf("{(%ld) %s : %s} ", hashcode(hm->stash[i]->key), hm->stash[i]->key, hm->stash[i]->val);
+  }
+  printf("\n");
+}
@@ -0,0 +1,381 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hashmap.h"
+
+// hashmap_frozen.c: read-only maps indexed by a minimal perfect
+// hash. hashmap_freeze() snapshots a hashmap_t into a frozenmap_t
+// whose image can be written to disk with frozenmap_save() and
+// mmap()'d back with frozenmap_load().
+//
+// Construction follows CHD ("hash, displace and compress"): keys are
+// hashed into about item_count/4 buckets; buckets are placed largest
+// first by searching for a displacement value that sends each key in
+// the bucket to a distinct free slot. A lookup then needs the
+// bucket's displacement and exactly one slot probe.
+//
+// IMAGE LAYOUT (native byte order, each section 8-byte aligned)
+//
+//   frozenheader_t                 magic, counts, seed, sizes
+//   uint32_t disp[bucket_count]    displacement per bucket
+//   frozenslot_t slots[item_count] key/val offsets per slot
+//   char strings[]                 "key\0val\0" for every item
+
+#define FROZEN_MAGIC "HMFROZE1"
+#define FROZEN_KEYS_PER_BUCKET 4      // average bucket size, lambda in CHD
+#define FROZEN_MAX_DISP (1 << 22)     // displacements tried before re-seeding
+#define FROZEN_MAX_SEEDS 32           // seeds tried before giving up
+
+typedef struct {
+  char magic[8];                // FROZEN_MAGIC, no trailing \0
+  uint32_t item_count;          // number of keys/slots
+  uint32_t bucket_count;        // number of displacement buckets
+  uint32_t table_size;          // table_size of the map that was frozen
+  uint32_t pad;                 // unused, keeps seed aligned
+  uint64_t seed;                // seed passed to hashmap_strhash()
+  uint64_t blob_size;           // total size of the image
+} frozenheader_t;
+
+static long frozen_align(long off){
+  return (off + 7) & ~7L;
+}
+
+// Offsets of the sections of an image with the given counts; returns
+// the total image size given a string pool of 'strings_size' bytes.
+static long frozen_layout(long items, long buckets, long strings_size,
+                          long *disp_off, long *slot_off, long *str_off){
+  *disp_off = frozen_align(sizeof(frozenheader_t));
+  *slot_off = frozen_align(*disp_off + buckets * sizeof(uint32_t));
+  *str_off  = frozen_align(*slot_off + items * sizeof(frozenslot_t));
+  return *str_off + strings_size;
+}
+
+// Maps a hash to a bucket with a multiply-shift range reduction
+static unsigned int frozen_bucket(unsigned long h, unsigned int buckets){
+  return (unsigned int) (((h >> 32) * buckets) >> 32);
+}
+
+// Maps a hash and a bucket displacement to a slot in [0, items)
+static unsigned int frozen_slot(unsigned long h, unsigned int disp, unsigned int items){
+  unsigned long x = hashmap_mix(h + disp * 0x9e3779b97f4a7c15UL);
+  return (unsigned int) (((x & 0xffffffffUL) * items) >> 32);
+}
+
+// Points the fields of 'fm' at the sections of its image 'blob'
+static void frozen_attach(frozenmap_t *fm, char *blob){
+  frozenheader_t *hdr = (frozenheader_t *) blob;
+  long disp_off, slot_off, str_off;
+  frozen_layout(hdr->item_count, hdr->bucket_count, 0,
+                &disp_off, &slot_off, &str_off);
+  fm->item_count = hdr->item_count;
+  fm->bucket_count = hdr->bucket_count;
+  fm->seed = hdr->seed;
+  fm->blob = blob;
+  fm->blob_size = hdr->blob_size;
+  fm->disp = (unsigned int *) (blob + disp_off);
+  fm->slots = (frozenslot_t *) (blob + slot_off);
+  fm->strings = blob + str_off;
+}
+
+// Tries to find displacements for all buckets using 'seed'. On
+// success fills 'disp' and 'slot_of' (slot for each item) and
+// returns 1. Returns 0 if some bucket could not be placed.
+static int frozen_place(hashnode_t **items, int n, int nb, unsigned long seed,
+                        unsigned int *disp, unsigned int *slot_of){
+  unsigned long *hashes = malloc(sizeof(unsigned long) * n);
+  int *bstart = calloc(nb + 1, sizeof(int));
+  int *members = malloc(sizeof(int) * n);
+  int *border = malloc(sizeof(int) * nb);
+  char *taken = calloc(n, 1);
+  int ok = 1;
+
+  // bucket the items with a counting sort
+  for(int i=0; i<n; i++){
+    hashes[i] = hashmap_strhash(items[i]->key, seed);
+    bstart[frozen_bucket(hashes[i], nb) + 1]++;
+  }
+  int maxsize = 0;
+  for(int b=0; b<nb; b++){
+    if(bstart[b+1] > maxsize){
+      maxsize = bstart[b+1];
+    }
+    bstart[b+1] += bstart[b];
+  }
+  int *fill = malloc(sizeof(int) * nb);
+  memcpy(fill, bstart, sizeof(int) * nb);
+  for(int i=0; i<n; i++){
+    members[fill[frozen_bucket(hashes[i], nb)]++] = i;
+  }
+  free(fill);
+
+  // order buckets by decreasing size, again with a counting sort
+  int *sstart = calloc(maxsize + 2, sizeof(int));
+  for(int b=0; b<nb; b++){
+    sstart[maxsize - (bstart[b+1]-bstart[b]) + 1]++;
+  }
+  for(int s=0; s<=maxsize; s++){
+    sstart[s+1] += sstart[s];
+  }
+  for(int b=0; b<nb; b++){
+    border[sstart[maxsize - (bstart[b+1]-bstart[b])]++] = b;
+  }
+  free(sstart);
+
+  unsigned int pos[64];
+  for(int k=0; k<nb && ok; k++){
+    int b = border[k];
+    int size = bstart[b+1] - bstart[b];
+    disp[b] = 0;
+    if(size == 0){
+      continue;
+    }
+    if(size > 64){             // pathological seed, try another
+      ok = 0;
+      break;
+    }
+    int placed = 0;
+    for(unsigned int d=0; d<FROZEN_MAX_DISP && !placed; d++){
+      placed = 1;
+      for(int m=0; m<size; m++){
+        pos[m] = frozen_slot(hashes[members[bstart[b]+m]], d, n);
+        if(taken[pos[m]]){
+          placed = 0;
+        }
+        for(int o=0; o<m && placed; o++){
+          if(pos[o] == pos[m]){
+            placed = 0;
+          }
+        }
+        if(!placed){
+          break;
+        }
+      }
+      if(placed){
+        disp[b] = d;
+        for(int m=0; m<size; m++){
+          taken[pos[m]] = 1;
+          slot_of[members[bstart[b]+m]] = pos[m];
+        }
+      }
+    }
+    if(!placed){
+      ok = 0;
+    }
+  }
+
+  free(hashes);
+  free(bstart);
+  free(members);
+  free(border);
+  free(taken);
+  return ok;
+}
+
+// Collects nodes into a freeze_items_t during hashmap_foreach()
+typedef struct {
+  hashnode_t **items;
+  int count;
+  long strings_size;
+} freeze_items_t;
+
+static void freeze_collect(hashnode_t *node, void *arg){
+  freeze_items_t *fi = arg;
+  fi->items[fi->count++] = node;
+  fi->strings_size += strlen(node->key) + strlen(node->val) + 2;
+}
+
+// Builds a frozen copy of all key/vals in 'hm' into 'fm' which
+// should be zeroed or previously free'd with frozenmap_free(). The
+// hashmap is not changed and may be modified or free'd afterwards
+// without affecting 'fm'. Returns 1 on success and 0 if no perfect
+// hash could be found or the keys/values are too large to index with
+// 32-bit offsets.
+int hashmap_freeze(hashmap_t *hm, frozenmap_t *fm){
+  int n = hm->item_count;
+  int nb = n / FROZEN_KEYS_PER_BUCKET + 1;
+  freeze_items_t fi = {malloc(sizeof(hashnode_t *) * (n + 1)), 0, 0};
+  hashmap_foreach(hm, freeze_collect, &fi);
+  hashnode_t **items = fi.items;
+  long strings_size = fi.strings_size;
+  if(strings_size > 0xffffffffL){
+    free(items);
+    return 0;
+  }
+
+  unsigned int *disp = malloc(sizeof(unsigned int) * nb);
+  unsigned int *slot_of = malloc(sizeof(unsigned int) * (n + 1));
+  unsigned long seed = 0;
+  int ok = 0;
+  for(int attempt=0; attempt < FROZEN_MAX_SEEDS && !ok; attempt++){
+    seed = hashmap_mix(attempt + 0x5eed);
+    ok = frozen_place(items, n, nb, seed, disp, slot_of);
+  }
+  if(!ok){
+    free(items);
+    free(disp);
+    free(slot_of);
+    return 0;
+  }
+
+  long disp_off, slot_off, str_off;
+  long size = frozen_layout(n, nb, strings_size, &disp_off, &slot_off, &str_off);
+  char *blob = calloc(size, 1);
+  frozenheader_t *hdr = (frozenheader_t *) blob;
+  memcpy(hdr->magic, FROZEN_MAGIC, sizeof(hdr->magic));
+  hdr->item_count = n;
+  hdr->bucket_count = nb;
+  hdr->table_size = hm->table_size;
+  hdr->seed = seed;
+  hdr->blob_size = size;
+  frozen_attach(fm, blob);
+  fm->mapped = 0;
+
+  memcpy(fm->disp, disp, sizeof(unsigned int) * nb);
+  long off = 0;
+  for(int i=0; i<n; i++){
+    frozenslot_t *slot = &fm->slots[slot_of[i]];
+    slot->key_off = off;
+    strcpy(fm->strings + off, items[i]->key);
+    off += strlen(items[i]->key) + 1;
+    slot->val_off = off;
+    strcpy(fm->strings + off, items[i]->val);
+    off += strlen(items[i]->val) + 1;
+  }
+
+  free(items);
+  free(disp);
+  free(slot_of);
+  return 1;
+}
+
+// Looks up 'key' in the frozen map. Computes the key's bucket,
+// applies that bucket's displacement to find the only slot the key
+// could be in and compares the key stored there. Returns a pointer to
+// the value if found and NULL otherwise. The value must not be
+// modified as it may live in read-only mapped memory.
+char *frozenmap_get(frozenmap_t *fm, char key[]){
+  if(fm->item_count == 0){
+    return NULL;
+  }
+  unsigned long h = hashmap_strhash(key, fm->seed);
+  unsigned int disp = fm->disp[frozen_bucket(h, fm->bucket_count)];
+  frozenslot_t *slot = &fm->slots[frozen_slot(h, disp, fm->item_count)];
+  if(strcmp(fm->strings + slot->key_off, key) == 0){
+    return fm->strings + slot->val_off;
+  }
+  return NULL;
+}
+
+// Writes the image of the frozen map to 'filename'. Prints an error
+// message and returns 0 if the file cannot be written, returns 1 on
+// success.
+int frozenmap_save(frozenmap_t *fm, char *filename){
+  FILE *file = fopen(filename, "w");
+  if(file == NULL){
+    printf("ERROR: could not open file '%s'\n", filename);
+    return 0;
+  }
+  long written = fwrite(fm->blob, 1, fm->blob_size, file);
+  fclose(file);
+  if(written != fm->blob_size){
+    printf("ERROR: could not write file '%s'\n", filename);
+    return 0;
+  }
+  return 1;
+}
+
+// Checks the slots of a mapped image of 'size' bytes whose header has
+// already passed: every key and value offset must fall inside the
+// string pool which must end in a '\0', so frozenmap_get() and
+// frozenmap_thaw() never read past the mapping. Returns 1 if they do.
+static int frozen_slots_valid(char *blob, long size, long slot_off, long str_off){
+  frozenheader_t *hdr = (frozenheader_t *) blob;
+  frozenslot_t *slots = (frozenslot_t *) (blob + slot_off);
+  long pool = size - str_off;
+  if(hdr->item_count > 0 && (pool <= 0 || blob[size-1] != '\0')){
+    return 0;
+  }
+  for(long i=0; i < hdr->item_count; i++){
+    if(slots[i].key_off >= pool || slots[i].val_off >= pool){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Maps a file written by frozenmap_save() into memory read-only and
+// points 'fm' at it; nothing is parsed or copied. Any map previously
+// in 'fm' is free'd on success. If the file cannot be opened or is
+// not a frozen map image, including one whose slots point outside its
+// strings, prints an error message, leaves 'fm' unchanged and returns
+// 0. Returns 1 on success.
+int frozenmap_load(frozenmap_t *fm, char *filename){
+  int fd = open(filename, O_RDONLY);
+  if(fd == -1){
+    printf("ERROR: could not open file '%s'\n", filename);
+    return 0;
+  }
+  struct stat sb;
+  char *blob = MAP_FAILED;
+  if(fstat(fd, &sb) == 0 && sb.st_size >= (long) sizeof(frozenheader_t)){
+    blob = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(blob != MAP_FAILED){
+    frozenheader_t *hdr = (frozenheader_t *) blob;
+    long disp_off, slot_off, str_off;
+    long min_size = frozen_layout(hdr->item_count, hdr->bucket_count, 0,
+                                  &disp_off, &slot_off, &str_off);
+    if(memcmp(hdr->magic, FROZEN_MAGIC, sizeof(hdr->magic)) == 0 &&
+       hdr->bucket_count > 0 &&
+       hdr->blob_size == (uint64_t) sb.st_size &&
+       min_size <= sb.st_size &&
+       frozen_slots_valid(blob, sb.st_size, slot_off, str_off)){
+      frozenmap_free(fm);
+      frozen_attach(fm, blob);
+      fm->mapped = 1;
+      return 1;
+    }
+    munmap(blob, sb.st_size);
+  }
+  printf("ERROR: '%s' is not a frozen map file\n", filename);
+  return 0;
+}
+
+// Re-creates a live hash map from the frozen map. Frees any table in
+// 'hm' then initializes it with its current engine to the table_size
+// of the map that was frozen and puts all key/vals into it. An
+// ordered index on 'hm' is rebuilt over the new items.
+void frozenmap_thaw(frozenmap_t *fm, hashmap_t *hm){
+  frozenheader_t *hdr = (frozenheader_t *) fm->blob;
+  int indexed = hm->index != NULL;
+  hashmap_free_table(hm);
+  hashmap_init_engine(hm, hdr->table_size > 0 ? hdr->table_size : HASHMAP_DEFAULT_TABLE_SIZE,
+                      hm->engine);
+  if(indexed){
+    hashmap_index_enable(hm);
+  }
+  for(int i=0; i < fm->item_count; i++){
+    hashmap_put(hm, fm->strings + fm->slots[i].key_off,
+                fm->strings + fm->slots[i].val_off);
+  }
+}
+
+// De-allocates or unmaps the image of 'fm' and zeroes its fields. Safe
+// to call on a zeroed frozenmap_t. Does NOT free 'fm' itself.
+void frozenmap_free(frozenmap_t *fm){
+  if(fm->blob != NULL){
+    if(fm->mapped){
+      munmap(fm->blob, fm->blob_size);
+    }
+    else{
+      free(fm->blob);
+    }
+  }
+  memset(fm, 0, sizeof(frozenmap_t));
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "hashmap.h"
 
 // hashmap_funcs.c: utility functions for operating on hash maps. Most
@@ -24,6 +25,32 @@ long hashcode(char key[]){
   return strnum.num;
 }
 
+// Scrambles the bits of 'x' so that every input bit affects every
+// output bit (the 64-bit finalizer from MurmurHash3). Used to derive
+// well-spread table positions from string hashes.
+unsigned long hashmap_mix(unsigned long x){
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb34e1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Computes a 64-bit hash of the entire string 'key' mixed with
+// 'seed'. Unlike hashcode(), which only looks at the first 8
+// characters, every character contributes so keys sharing a long
+// prefix still spread out. Different seeds give independent hash
+// functions which the frozen and cuckoo tables rely on.
+unsigned long hashmap_strhash(char key[], unsigned long seed){
+  unsigned long h = 14695981039346656037UL ^ hashmap_mix(seed + 1);
+  for(int i=0; key[i] != '\0'; i++){
+    h ^= (unsigned char) key[i];
+    h *= 1099511628211UL;
+  }
+  return hashmap_mix(h);
+}
+
 
 
 
@@ -31,9 +58,30 @@ long hashcode(char key[]){
 // 0. Ensures that the 'table' field is initialized to an array of
 // size 'table_size' and filled with NULLs. 
 void hashmap_init(hashmap_t *hm, int table_size){
+  hashmap_init_engine(hm, table_size, HASHMAP_CHAINED);
+}
+
+// Initialize the hash map 'hm' to be empty and use the given
+// 'engine'. For HASHMAP_CHAINED this is the 'table' of linked lists
+// described for hashmap_init(). For HASHMAP_CUCKOO, 'table_size' is
+// the number of 4-way buckets set up by cuckoo_init() and 'table'
+// stays NULL. All other functions dispatch on the 'engine' field so
+// callers use the same API for both.
+void hashmap_init_engine(hashmap_t *hm, int table_size, int engine){
+  hm -> engine = engine;
+  hm -> buckets = NULL;
+  hm -> stash_count = 0;
+  hm -> index = NULL;
+  hm -> now = 0;
+  hm -> wheel = NULL;
+  if(engine == HASHMAP_CUCKOO){
+    hm -> table = NULL;
+    cuckoo_init(hm, table_size);
+    return;
+  }
   hm -> table_size = table_size;
   hm -> item_count = 0;
-  hm -> table = malloc(sizeof(hashnode_t) * table_size);
+  hm -> table = malloc(sizeof(hashnode_t *) * table_size);
   for(int i = 0; i < table_size; i++){
     hm-> table[i] = NULL;
   } 
@@ -51,17 +99,22 @@ void hashmap_init(hashmap_t *hm, int table_size){
 // strcpy() to copy strings. Lists in the hash map are arbitrarily
 // ordered (not sorted); new items are always appended to the end of
 // the list.  Returns 1 if a new node is added (new key) and 0 if an
-// existing key has its value modified.
+// existing key has its value modified. Overwriting a key that was put
+// with a TTL makes it permanent again.
 int hashmap_put(hashmap_t *hm, char key[], char value[]){
+  if(hm->wheel != NULL && hashmap_get(hm, key) != NULL){
+    hashnode_t *node = hashmap_get_node(hm, key);
+    hashwheel_cancel(hm, node);
+    strcpy(node->val, value);
+    return 0;
+  }
+  if(hm->engine == HASHMAP_CUCKOO){
+    return cuckoo_put(hm, key, value);
+  }
   int input_loc = hashcode(key) % hm->table_size;
   hashnode_t *node = hm->table[input_loc];
   if(hm->table[input_loc] == NULL){
-    hashnode_t *mpty = malloc(sizeof(hashnode_t));
-    strcpy(mpty->val, value);
-    strcpy(mpty->key, key);
-    mpty->next = NULL;
-    hm->table[input_loc] = mpty;
-    hm->item_count++;
+    hm->table[input_loc] = hashmap_new_node(hm, key, value);
     return 1;
   }
   while(node != NULL){
@@ -74,43 +127,149 @@ int hashmap_put(hashmap_t *hm, char key[], char value[]){
       }
       node = node->next;
     }
-  hashnode_t *add = malloc(sizeof(hashnode_t));
-  strcpy(add->val, value);
-  strcpy(add->key, key);
-  add->next = NULL;
-  node->next = add;
-  hm->item_count++;
+  node->next = hashmap_new_node(hm, key, value);
   return 1;
 }
 
+// Allocates a node for a key/val that is new to the map, increments
+// 'item_count' and adds the node to the ordered index if the map has
+// one. The engine's put function links the node into its table. Nodes
+// stay at the same address until removed so the index can refer to
+// them.
+hashnode_t *hashmap_new_node(hashmap_t *hm, char key[], char value[]){
+  hashnode_t *node = malloc(sizeof(hashnode_t));
+  strcpy(node->key, key);
+  strcpy(node->val, value);
+  node->next = NULL;
+  node->expires = 0;
+  node->wheel_pprev = NULL;
+  node->wheel_next = NULL;
+  node->ptr = NULL;
+  hm->item_count++;
+  if(hm->index != NULL){
+    hashindex_insert(hm->index, node);
+  }
+  return node;
+}
+
 
 // Looks up value associated with given key in the hashmap. Uses
 // hashcode() and field "table_size" to determine which index in table
 // to search.  Iterates through the list at that index using strcmp()
 // to check for matching key. If found, returns a pointer to the
 // associated value.  Otherwise returns NULL to indicate no associated
-// key is present.
+// key is present. A key whose TTL has run out by the map's current
+// time 'now' is removed here and reported as not present.
 char *hashmap_get(hashmap_t *hm, char key[]){
+  hashnode_t *node = hashmap_get_node(hm, key);
+  if(node == NULL){
+    return NULL;
+  }
+  if(node->expires != 0 && node->expires <= hm->now){
+    hashmap_remove_node(hm, node);
+    return NULL;
+  }
+  return node->val;
+}
+
+// Finds the node holding 'key' for either engine, NULL if not
+// present. Does not check for expiry.
+hashnode_t *hashmap_get_node(hashmap_t *hm, char key[]){
+  if(hm->engine == HASHMAP_CUCKOO){
+    return cuckoo_get_node(hm, key);
+  }
   int input_loc = hashcode(key) % hm->table_size;
   hashnode_t *node = hm->table[input_loc];
   while(node != NULL){
       if(strcmp(node->key,key)==0){
-        return node->val;
+        return node;
       }
       node = node->next;
     }
   return NULL;  
+}
+
+// Associates the pointer 'ptr' with 'key' so the map can index any
+// kind of object rather than only 128-character strings. The key's
+// string value is left empty; the map does not own 'ptr' and never
+// frees it, so callers free their objects themselves, e.g. with
+// hashmap_foreach() before hashmap_free_table(). Pointers are not
+// written by hashmap_save() or kept by hashmap_freeze(). Returns 1 if
+// the key is new and 0 if its value was replaced, as hashmap_put().
+int hashmap_put_ptr(hashmap_t *hm, char key[], void *ptr){
+  int added = hashmap_put(hm, key, "");
+  hashmap_get_node(hm, key)->ptr = ptr;
+  return added;
+}
 
+// Looks up the pointer put for 'key' with hashmap_put_ptr(). Returns
+// NULL if the key is not present, has expired as for hashmap_get() or
+// was put with a string value only.
+void *hashmap_get_ptr(hashmap_t *hm, char key[]){
+  hashnode_t *node = hashmap_get_node(hm, key);
+  if(node == NULL){
+    return NULL;
+  }
+  if(node->expires != 0 && node->expires <= hm->now){
+    hashmap_remove_node(hm, node);
+    return NULL;
+  }
+  return node->ptr;
+}
+
+// Removes 'key' and its value from the map. Returns 1 if the key was
+// present and 0 otherwise.
+int hashmap_remove(hashmap_t *hm, char key[]){
+  hashnode_t *node = hashmap_get_node(hm, key);
+  if(node == NULL){
+    return 0;
+  }
+  hashmap_remove_node(hm, node);
+  return 1;
+}
+
+// Unlinks 'node' from the table, the ordered index and the timing
+// wheel, decrements 'item_count' and frees the node.
+void hashmap_remove_node(hashmap_t *hm, hashnode_t *node){
+  if(hm->engine == HASHMAP_CUCKOO){
+    cuckoo_unlink(hm, node);
+  }
+  else{
+    hashnode_t **link = &hm->table[hashcode(node->key) % hm->table_size];
+    while(*link != node){
+      link = &(*link)->next;
+    }
+    *link = node->next;
+  }
+  if(hm->index != NULL){
+    hashindex_remove(hm->index, node);
+  }
+  hashwheel_cancel(hm, node);
+  hm->item_count--;
+  free(node);
 }
 
 
 
 // De-allocates the hashmap's "table" field. Iterates through the
 // "table" array and its lists de-allocating all nodes present
-// there. Subsequently de-allocates the "table" field and sets all
-// fields to 0 / NULL. Does NOT attempt to free 'hm' as it may be
-// stack allocated.
+// there. Subsequently de-allocates the "table" field, any ordered
+// index and any timing wheel and sets all fields to 0 / NULL except
+// 'engine' which is kept so the map can be re-initialized the same
+// way. Does NOT attempt to free 'hm' as it may be stack allocated.
 void hashmap_free_table(hashmap_t *hm){
+  if(hm->index != NULL){
+    hashindex_free(hm->index);
+    hm->index = NULL;
+  }
+  if(hm->wheel != NULL){
+    hashwheel_free(hm->wheel);
+    hm->wheel = NULL;
+  }
+  if(hm->engine == HASHMAP_CUCKOO){
+    cuckoo_free_table(hm);
+    return;
+  }
   if(hm->table == NULL){
     return;
   }
@@ -154,6 +313,10 @@ void hashmap_free_table(hashmap_t *hm){
 //     |      +-> key
 //     +-> hashcode("cc"), print using format "%ld" for 64-bit longs
 void hashmap_show_structure(hashmap_t *hm){
+  if(hm->engine == HASHMAP_CUCKOO){
+    cuckoo_show_structure(hm);
+    return;
+  }
   double load_factor = ((double)hm-> item_count)/((double)hm-> table_size);
   printf("item_count: %d\n", hm-> item_count);
   printf("table_size: %d\n", hm-> table_size);
@@ -186,15 +349,93 @@ void hashmap_show_structure(hashmap_t *hm){
 // is used to achieve the correct spacing. Output is done to the file
 // stream 'out' which is standard out for printing to the screen or an
 // open file stream for writing to a file as in hashmap_save().
+//
+// Rather than an fprintf() per item, lines are formatted by hand into
+// a buffer on the stack which is handed to write() on the stream's
+// file descriptor whenever it fills. Anything already buffered in
+// 'out' is flushed first so output stays in order. Streams without a
+// file descriptor (e.g. from fmemopen()) get the buffer via fwrite().
+
+#define WRITE_BUFSIZE (64 * 1024) // bytes formatted between write() calls
+
+typedef struct {
+  FILE *out;                    // stream being written
+  int fd;                       // its file descriptor or -1 to use fwrite()
+  int len;                      // bytes pending in data[]
+  char data[WRITE_BUFSIZE];
+} itemwriter_t;
+
+// Sends the pending bytes of 'w' to its file, retrying short writes
+static void itemwriter_flush(itemwriter_t *w){
+  if(w->fd < 0){
+    fwrite(w->data, 1, w->len, w->out);
+    w->len = 0;
+    return;
+  }
+  int done = 0;
+  while(done < w->len){
+    ssize_t n = write(w->fd, w->data + done, w->len - done);
+    if(n <= 0){
+      break;                    // give up on errors as fprintf() would
+    }
+    done += n;
+  }
+  w->len = 0;
+}
+
+// Appends one item as "%12s : %s\n" to the buffer of 'w'
+static void write_item(hashnode_t *node, void *arg){
+  itemwriter_t *w = arg;
+  int klen = strlen(node->key);
+  int vlen = strlen(node->val);
+  int pad = klen < 12 ? 12 - klen : 0;
+  if(w->len + pad + klen + vlen + 4 > WRITE_BUFSIZE){
+    itemwriter_flush(w);
+  }
+  char *pos = w->data + w->len;
+  memset(pos, ' ', pad);
+  pos += pad;
+  memcpy(pos, node->key, klen);
+  pos += klen;
+  memcpy(pos, " : ", 3);
+  pos += 3;
+  memcpy(pos, node->val, vlen);
+  pos += vlen;
+  *pos++ = '\n';
+  w->len = pos - w->data;
+}
+
 void hashmap_write_items(hashmap_t *hm, FILE *out){ 
+  itemwriter_t w;
+  fflush(out);
+  w.out = out;
+  w.fd = fileno(out);
+  w.len = 0;
+  hashmap_foreach(hm, write_item, &w);
+  itemwriter_flush(&w);
+}
+
+// Calls 'func(node, arg)' on every node in the hash map in the order
+// they appear in the table: for the chained engine each list front to
+// back, for the cuckoo engine each bucket's slots followed by the
+// stash. 'func' must not add or remove items.
+void hashmap_foreach(hashmap_t *hm, void (*func)(hashnode_t *node, void *arg), void *arg){
+  if(hm->engine == HASHMAP_CUCKOO){
+    for(int i=0; i < hm->table_size; i++){
+      for(int k=0; k < HASHMAP_CUCKOO_WAYS; k++){
+        if(hm->buckets[i].nodes[k] != NULL){
+          func(hm->buckets[i].nodes[k], arg);
+        }
+      }
+    }
+    for(int i=0; i < hm->stash_count; i++){
+      func(hm->stash[i], arg);
+    }
+    return;
+  }
   for(int i=0; i < hm->table_size; i++){
-    hashnode_t *node = hm->table[i];
-    if(hm->table[i] == NULL){ }
-    else{      
-      while(node != NULL){
-        fprintf(out, "%12s : %s\n", node->key, node->val);
-        node = node->next;
-      } 
+    for(hashnode_t *node = hm->table[i]; node != NULL; node = node->next){
+      func(node, arg);
     }
   }
 }
@@ -236,7 +477,9 @@ void hashmap_save(hashmap_t *hm, char *filename){
 //
 // and returns 0 without changing anything. Otherwise clears out the
 // current hash map 'hm', initializes a new one based on the size
-// present in the file, and adds all elements to the hash map. Returns
+// present in the file using the same engine as 'hm', and adds all
+// elements to the hash map. If 'hm' had an ordered index it is
+// rebuilt over the loaded items. Returns
 // 1 on successful loading. This function does no error checking of
 // the contents of the file so if they are corrupted, it may cause an
 // application to crash or loop infinitely.
@@ -248,11 +491,13 @@ int hashmap_load(hashmap_t *hm, char *filename){
     printf("load failed\n");
     return 0;
   }
-  if(hm-> table != NULL){
-    hashmap_free_table(hm);
-  }
+  int indexed = hm->index != NULL;
+  hashmap_free_table(hm);
   fscanf(file, "%d %d\n", &hm->table_size, &item_count);
-  hashmap_init(hm, hm->table_size);
+  hashmap_init_engine(hm, hm->table_size, hm->engine);
+  if(indexed){
+    hashmap_index_enable(hm);
+  }
   char key[128];
   char val[128];
   for(int i = 0; i < item_count; i++){
@@ -299,29 +544,49 @@ int next_prime(int num){
 
 
 // Allocates a new, larger area of memory for the "table" field and
-// re-adds all items currently in the hash table to it. The size of
+// moves all items currently in the hash table to it. The size of
 // the new table is next_prime(2*table_size+1) which keeps the size
 // prime.  After allocating the new table, all entries are initialized
-// to NULL then the old table is iterated through and all items are
-// added to the new table according to their hash code. The memory for
-// the old table is de-allocated and the new table assigned to the 
-// hashmap fields "table" and "table_size".  This function increases
-// "table_size" while keeping "item_count" the same thereby reducing
-// the load of the hash table. Ensures that all memory associated with
-// the old table is free()'d (linked nodes and array). Cleverly makes
-// use of existing functions like hashmap_init(), hashmap_put(),
-// and hashmap_free_table() to avoid re-writing algorithms
-// implemented in those functions.
+// to NULL then the old table is iterated through and all nodes are
+// unlinked and appended to the end of the list for their hash code in
+// the new table, giving the same order repeated hashmap_put() calls
+// would. The memory for the old table array is de-allocated and the
+// new table assigned to the hashmap fields "table" and "table_size".
+// This function increases "table_size" while keeping "item_count" the
+// same thereby reducing the load of the hash table. Nodes are moved
+// rather than copied so they keep their addresses and the ordered
+// index stays valid. The cuckoo engine grows its bucket array the same
+// way in cuckoo_expand().
 void hashmap_expand(hashmap_t *hm){
-  hashmap_t new;
-  hashmap_init(&new, next_prime(2*hm->table_size+1));
+  if(hm->engine == HASHMAP_CUCKOO){
+    cuckoo_expand(hm);
+    return;
+  }
+  int new_size = next_prime(2*hm->table_size+1);
+  hashnode_t **table = malloc(sizeof(hashnode_t *) * new_size);
+  hashnode_t **tails = malloc(sizeof(hashnode_t *) * new_size);
+  for(int i = 0; i < new_size; i++){
+    table[i] = NULL;
+    tails[i] = NULL;
+  }
   for(int i = 0; i < hm->table_size; i++){
     hashnode_t *node = hm->table[i];
     while(node != NULL){
-      hashmap_put(&new, node->key, node->val);
-      node = node->next;
+      hashnode_t *next = node->next;
+      int loc = hashcode(node->key) % new_size;
+      node->next = NULL;
+      if(tails[loc] == NULL){
+        table[loc] = node;
+      }
+      else{
+        tails[loc]->next = node;
+      }
+      tails[loc] = node;
+      node = next;
     }
   }
-  hashmap_free_table(hm);
-  *hm = new;
+  free(tails);
+  free(hm->table);
+  hm->table = table;
+  hm->table_size = new_size;
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hashmap.h"
+
+// hashmap_index.c: optional ordered index over the keys of a hash
+// map supporting prefix and range scans. The index is a B+tree whose
+// leaves hold pointers to the map's nodes in key order and are linked
+// left to right so a scan descends once and then walks the leaves,
+// costing O(log N + results). Once hashmap_index_enable() is called,
+// hashmap_put() and friends keep the index up to date.
+//
+// Leaves refer to the map's own key strings which stay put as the map
+// grows since nodes are never moved. Separator keys in internal nodes
+// are private copies so removals from leaves cannot leave them
+// dangling. Removals do not rebalance the tree but a leaf left empty
+// is unlinked and freed along with any internal node left without
+// children. Every leaf a scan walks then holds at least one key, so
+// keys that came and went, as with TTL churn, cost neither scan time
+// nor memory.
+
+#define HASHINDEX_ORDER 32      // max entries per leaf and children per internal node
+#define HASHINDEX_DEPTH 64      // deeper than any tree of 2^31 keys can grow
+
+typedef struct indexnode {
+  int leaf;                     // 1 for leaves, 0 for internal nodes
+  int count;                    // leaf: number of items; internal: number of children
+  char *keys[HASHINDEX_ORDER];  // leaf: keys of items; internal: count-1 separator copies
+  hashnode_t *items[HASHINDEX_ORDER];               // leaf only: the indexed nodes
+  struct indexnode *children[HASHINDEX_ORDER];      // internal only: subtrees
+  struct indexnode *next;       // leaf only: next leaf to the right, NULL if last
+  struct indexnode *prev;       // leaf only: next leaf to the left, NULL if first
+} indexnode_t;
+
+struct hashindex {
+  indexnode_t *root;            // root of the tree, a leaf when small
+  int count;                    // number of indexed items
+};
+
+static indexnode_t *indexnode_new(int leaf){
+  indexnode_t *node = calloc(1, sizeof(indexnode_t));
+  node->leaf = leaf;
+  return node;
+}
+
+static void indexnode_free(indexnode_t *node){
+  if(!node->leaf){
+    for(int i=0; i < node->count; i++){
+      indexnode_free(node->children[i]);
+    }
+    for(int i=0; i < node->count-1; i++){
+      free(node->keys[i]);
+    }
+  }
+  free(node);
+}
+
+// Index of the child of internal 'node' whose subtree covers 'key':
+// the number of separators less than or equal to 'key'
+static int indexnode_child(indexnode_t *node, char key[]){
+  int lo = 0, hi = node->count - 1;
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(strcmp(node->keys[mid], key) <= 0){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Position of the first key in leaf 'node' not less than 'key'
+static int indexnode_lower(indexnode_t *node, char key[]){
+  int lo = 0, hi = node->count;
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(strcmp(node->keys[mid], key) < 0){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Inserts 'item' below 'node'. If 'node' had to split, returns the
+// new right sibling and sets '*sep' to a fresh copy of the separator
+// key for it; otherwise returns NULL.
+static indexnode_t *indexnode_insert(indexnode_t *node, hashnode_t *item, char **sep){
+  if(node->leaf){
+    int pos = indexnode_lower(node, item->key);
+    if(pos < node->count && node->items[pos] == item){
+      return NULL;
+    }
+    if(node->count < HASHINDEX_ORDER){
+      memmove(&node->keys[pos+1], &node->keys[pos], sizeof(char *) * (node->count - pos));
+      memmove(&node->items[pos+1], &node->items[pos], sizeof(hashnode_t *) * (node->count - pos));
+      node->keys[pos] = item->key;
+      node->items[pos] = item;
+      node->count++;
+      return NULL;
+    }
+    // full leaf: split in half then insert into the proper side
+    indexnode_t *right = indexnode_new(1);
+    int half = HASHINDEX_ORDER / 2;
+    right->count = HASHINDEX_ORDER - half;
+    memcpy(right->keys, &node->keys[half], sizeof(char *) * right->count);
+    memcpy(right->items, &node->items[half], sizeof(hashnode_t *) * right->count);
+    node->count = half;
+    right->next = node->next;
+    right->prev = node;
+    if(node->next != NULL){
+      node->next->prev = right;
+    }
+    node->next = right;
+    indexnode_insert(pos <= half ? node : right, item, sep);
+    *sep = strdup(right->keys[0]);
+    return right;
+  }
+
+  int c = indexnode_child(node, item->key);
+  char *child_sep = NULL;
+  indexnode_t *split = indexnode_insert(node->children[c], item, &child_sep);
+  if(split == NULL){
+    return NULL;
+  }
+  // child split: add 'split' after child c with separator 'child_sep'
+  char *keys[HASHINDEX_ORDER + 1];
+  indexnode_t *children[HASHINDEX_ORDER + 1];
+  int nkeys = node->count - 1;
+  memcpy(keys, node->keys, sizeof(char *) * c);
+  keys[c] = child_sep;
+  memcpy(&keys[c+1], &node->keys[c], sizeof(char *) * (nkeys - c));
+  memcpy(children, node->children, sizeof(indexnode_t *) * (c + 1));
+  children[c+1] = split;
+  memcpy(&children[c+2], &node->children[c+1], sizeof(indexnode_t *) * (node->count - c - 1));
+  int total = node->count + 1;
+  if(total <= HASHINDEX_ORDER){
+    memcpy(node->keys, keys, sizeof(char *) * (total - 1));
+    memcpy(node->children, children, sizeof(indexnode_t *) * total);
+    node->count = total;
+    return NULL;
+  }
+  // internal split: middle separator moves up to the parent
+  indexnode_t *right = indexnode_new(0);
+  int left_count = total / 2;
+  node->count = left_count;
+  memcpy(node->children, children, sizeof(indexnode_t *) * left_count);
+  memcpy(node->keys, keys, sizeof(char *) * (left_count - 1));
+  *sep = keys[left_count - 1];
+  right->count = total - left_count;
+  memcpy(right->children, &children[left_count], sizeof(indexnode_t *) * right->count);
+  memcpy(right->keys, &keys[left_count], sizeof(char *) * (right->count - 1));
+  return right;
+}
+
+static void index_add(hashnode_t *node, void *arg){
+  hashindex_insert(arg, node);
+}
+
+// Creates an ordered index for 'hm' containing all of its current
+// items if it does not already have one. From then on put, expand,
+// load and the other map operations keep it consistent until the
+// table is free'd with hashmap_free_table().
+void hashmap_index_enable(hashmap_t *hm){
+  if(hm->index != NULL){
+    return;
+  }
+  hm->index = calloc(1, sizeof(hashindex_t));
+  hm->index->root = indexnode_new(1);
+  hashmap_foreach(hm, index_add, hm->index);
+}
+
+// Adds map node 'item' to the index under its key. Called by
+// hashmap_new_node() for every new key.
+void hashindex_insert(hashindex_t *index, hashnode_t *item){
+  char *sep = NULL;
+  indexnode_t *split = indexnode_insert(index->root, item, &sep);
+  if(split != NULL){
+    indexnode_t *root = indexnode_new(0);
+    root->count = 2;
+    root->children[0] = index->root;
+    root->children[1] = split;
+    root->keys[0] = sep;
+    index->root = root;
+  }
+  index->count++;
+}
+
+// Frees the empty leaf path[depth] after taking it out of the chain
+// of leaves and out of its parent path[depth-1], where it is child
+// number slot[depth-1]. A parent left without children goes the same
+// way. The separator dropped with a child is the one on its left, or
+// on its right for the first child, so the neighbor takes over its
+// part of the key space. An internal root left with one child is
+// replaced by that child.
+static void index_drop_leaf(hashindex_t *index, indexnode_t **path, int *slot, int depth){
+  indexnode_t *leaf = path[depth];
+  if(leaf->prev != NULL){
+    leaf->prev->next = leaf->next;
+  }
+  if(leaf->next != NULL){
+    leaf->next->prev = leaf->prev;
+  }
+  free(leaf);
+  for(int d = depth-1; d >= 0; d--){
+    indexnode_t *parent = path[d];
+    int c = slot[d];
+    if(parent->count > 1){
+      int k = c > 0 ? c-1 : 0;
+      free(parent->keys[k]);
+      memmove(&parent->keys[k], &parent->keys[k+1], sizeof(char *) * (parent->count - 2 - k));
+      memmove(&parent->children[c], &parent->children[c+1],
+              sizeof(indexnode_t *) * (parent->count - 1 - c));
+      parent->count--;
+      break;
+    }
+    free(parent);               // one child and so no separators
+  }
+  while(!index->root->leaf && index->root->count == 1){
+    indexnode_t *root = index->root;
+    index->root = root->children[0];
+    free(root);
+  }
+}
+
+// Removes map node 'item' from the index. A leaf left empty is freed
+// unless it is the root.
+void hashindex_remove(hashindex_t *index, hashnode_t *item){
+  indexnode_t *path[HASHINDEX_DEPTH];
+  int slot[HASHINDEX_DEPTH];
+  int depth = 0;
+  indexnode_t *node = index->root;
+  while(!node->leaf){
+    path[depth] = node;
+    slot[depth] = indexnode_child(node, item->key);
+    node = node->children[slot[depth++]];
+  }
+  path[depth] = node;
+  int pos = indexnode_lower(node, item->key);
+  if(pos < node->count && node->items[pos] == item){
+    memmove(&node->keys[pos], &node->keys[pos+1], sizeof(char *) * (node->count - pos - 1));
+    memmove(&node->items[pos], &node->items[pos+1], sizeof(hashnode_t *) * (node->count - pos - 1));
+    node->count--;
+    index->count--;
+    if(node->count == 0 && depth > 0){
+      index_drop_leaf(index, path, slot, depth);
+    }
+  }
+}
+
+// Prints the number of keys in the index of 'hm', its leaves and the
+// depth of the tree. Enables the index if needed.
+void hashmap_index_show(hashmap_t *hm){
+  hashmap_index_enable(hm);
+  int leaves = 0, depth = 1;
+  indexnode_t *node = hm->index->root;
+  for(; !node->leaf; depth++){
+    node = node->children[0];
+  }
+  for(; node != NULL; node = node->next){
+    leaves++;
+  }
+  printf("index keys: %d leaves: %d depth: %d\n", hm->index->count, leaves, depth);
+}
+
+// De-allocates the index; does not touch the map nodes it refers to
+void hashindex_free(hashindex_t *index){
+  indexnode_free(index->root);
+  free(index);
+}
+
+// Calls 'func(node, arg)' on items in key order starting with the
+// first key not less than 'start' while 'keep_going(key, arg2)'
+// accepts the key. Returns the number of items visited.
+static int index_scan(hashindex_t *index, char start[],
+                      int (*keep_going)(char *key, char *bound),
+                      char *bound, void (*func)(hashnode_t *node, void *arg), void *arg){
+  indexnode_t *node = index->root;
+  while(!node->leaf){
+    node = node->children[indexnode_child(node, start)];
+  }
+  int pos = indexnode_lower(node, start);
+  int visited = 0;
+  while(node != NULL){
+    for(; pos < node->count; pos++){
+      if(!keep_going(node->keys[pos], bound)){
+        return visited;
+      }
+      func(node->items[pos], arg);
+      visited++;
+    }
+    node = node->next;
+    pos = 0;
+  }
+  return visited;
+}
+
+static int has_prefix(char *key, char *prefix){
+  return strncmp(key, prefix, strlen(prefix)) == 0;
+}
+
+static int at_most(char *key, char *hi){
+  return strcmp(key, hi) <= 0;
+}
+
+// Calls 'func(node, arg)' in key order on every item whose key starts
+// with 'prefix'. Enables the index if needed. Returns the number of
+// matching items.
+int hashmap_prefix(hashmap_t *hm, char prefix[], void (*func)(hashnode_t *node, void *arg), void *arg){
+  hashmap_index_enable(hm);
+  return index_scan(hm->index, prefix, has_prefix, prefix, func, arg);
+}
+
+// Calls 'func(node, arg)' in key order on every item whose key is
+// between 'lo' and 'hi' inclusive as ordered by strcmp(). Enables the
+// index if needed. Returns the number of matching items.
+int hashmap_range(hashmap_t *hm, char lo[], char hi[], void (*func)(hashnode_t *node, void *arg), void *arg){
+  hashmap_index_enable(hm);
+  return index_scan(hm->index, lo, at_most, hi, func, arg);
+}
@@ -1,19 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "hashmap.h"
  
+// Prints a key/val in the same format as hashmap_write_items()
+static void print_item(hashnode_t *node, void *arg){
+  printf("%12s : %s\n", node->key, node->val);
+}
+
+// Milliseconds from a monotonic clock, the time base for TTLs
+static long clock_ms(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
 int main(int argc, char *argv[]){
   int echo = 0;                                // controls echoing, 0: echo off, 1: echo on
-  if(argc > 1 && strcmp("-echo",argv[1])==0) { // turn echoing on via -echo command line option
-    echo=1;
+  int engine = HASHMAP_CHAINED;                // which hash map engine to use
+  for(int i=1; i<argc; i++){
+    if(strcmp("-echo",argv[i])==0) {           // turn echoing on via -echo command line option
+      echo=1;
+    }
+    else if(strcmp("-cuckoo",argv[i])==0) {    // use cuckoo hashing via -cuckoo command line option
+      engine=HASHMAP_CUCKOO;
+    }
   }
  
   printf("Hashmap Main\n");
   printf("Commands:\n");
   printf("  hashcode <key>   : prints out the numeric hash code for the given key (does not change the hash map)\n");
   printf("  put <key> <val>  : inserts the given key/val into the hash map, overwrites existing values if present\n");
+  printf("  put <key> <val> ttl=<ms> : as put but the key/val expires <ms> milliseconds from now\n");
   printf("  get <key>        : prints the value associated with the given key or NOT FOUND\n");
   printf("  print            : shows contents of the hashmap ordered by how they appear in the table\n");
   printf("  structure        : prints detailed structure of the hash map\n");
@@ -22,12 +42,23 @@ int main(int argc, char *argv[]){
   printf("  load <file>      : clears the current hash map and loads the one in the given file\n");
   printf("  next_prime <int> : if <int> is prime, prints it, otherwise finds the next prime and prints it\n");
   printf("  expand           : expands memory size of hashmap to reduce its load factor\n");
+  printf("  freeze           : builds a read-only perfect hash index of the map which answers get until the map changes\n");
+  printf("  fsave <file>     : writes the frozen index of the map to the given file, freezing the map first if needed\n");
+  printf("  fload <file>     : replaces the hash map with the frozen index in the given file which answers get\n");
+  printf("  prefix <p>       : shows key/vals whose key starts with <p> in key order\n");
+  printf("  range <lo> <hi>  : shows key/vals whose key is between <lo> and <hi> inclusive in key order\n");
+  printf("  index            : shows the number of keys, leaves and levels of the ordered index\n");
+  printf("  sleep <ms>       : pauses for <ms> milliseconds, letting keys with a TTL expire\n");
+  printf("  tick <ms>        : moves the map clock <ms> milliseconds forward at once, as sleep but without waiting\n");
   printf("  quit             : exit the program\n");
    
   char cmd[128];
   hashmap_t hm;
+  frozenmap_t fm = {0};         // frozen index, answers get when fm.blob is non-NULL
   int success;
-  hashmap_init(&hm, HASHMAP_DEFAULT_TABLE_SIZE);
+  hashmap_init_engine(&hm, HASHMAP_DEFAULT_TABLE_SIZE, engine);
+  long start_ms = clock_ms();   // map time is milliseconds since startup
+  long ticked_ms = 0;           // plus the milliseconds added by tick commands
  
   while(1){
     printf("HM> ");                 
@@ -36,6 +67,9 @@ int main(int argc, char *argv[]){
       printf("\n");                   
       break;                          
     }
+    if(hashmap_advance(&hm, clock_ms() - start_ms + ticked_ms) > 0){
+      frozenmap_free(&fm);      // expired keys invalidate the frozen index
+    }
 
     // end
     if( strcmp("quit", cmd)==0 ){     
@@ -53,15 +87,29 @@ int main(int argc, char *argv[]){
       printf("%ld\n", hashcode(cmd));
     }
     
-    // adds given key/val to the hashmap
+    // adds given key/val to the hashmap, with an optional ttl=<ms> on
+    // the same line
     else if(strcmp("put", cmd)== 0){  
       char key[128];
       char val[128];
+      char rest[128] = "";
+      long ttl = 0;
       fscanf(stdin,"%s %s",key,val); 
-      if(echo){
+      fgets(rest, sizeof(rest), stdin);
+      int has_ttl = sscanf(rest, " ttl=%ld", &ttl) == 1;
+      if(echo && has_ttl){
+        printf("put %s %s ttl=%ld\n",key, val, ttl);
+      }
+      else if(echo){
         printf("put %s %s\n",key, val);
       }
-      success = hashmap_put(&hm, key, val);
+      frozenmap_free(&fm);
+      if(has_ttl){
+        success = hashmap_put_ttl(&hm, key, val, ttl);
+      }
+      else{
+        success = hashmap_put(&hm, key, val);
+      }
       if(success == 0){
         printf("Overwriting previous key/val\n");
       }
@@ -74,7 +122,13 @@ int main(int argc, char *argv[]){
       if(echo){
         printf("get %s\n",cmd);
       }
-      char *value = hashmap_get(&hm, cmd); 
+      char *value;
+      if(fm.blob != NULL){
+        value = frozenmap_get(&fm, cmd);
+      }
+      else{
+        value = hashmap_get(&hm, cmd);
+      }
       if(value == NULL){                        
         printf("NOT FOUND\n");
       }
@@ -88,8 +142,9 @@ int main(int argc, char *argv[]){
       if(echo){
         printf("clear\n");
       }
+      frozenmap_free(&fm);
       hashmap_free_table(&hm);
-      hashmap_init(&hm, HASHMAP_DEFAULT_TABLE_SIZE);
+      hashmap_init_engine(&hm, HASHMAP_DEFAULT_TABLE_SIZE, engine);
  
     }
 
@@ -124,7 +179,9 @@ int main(int argc, char *argv[]){
       if(echo){
         printf("load %s\n",cmd);
       }
-      hashmap_load(&hm, cmd);
+      if(hashmap_load(&hm, cmd)){
+        frozenmap_free(&fm);
+      }
       
     }
 
@@ -146,7 +203,95 @@ int main(int argc, char *argv[]){
       hashmap_expand(&hm);
     }
 
-    
+    // builds a read-only perfect hash index of the current contents
+    else if( strcmp("freeze", cmd)==0 ){ 
+      if(echo){
+        printf("freeze\n");
+      }
+      frozenmap_free(&fm);
+      if(!hashmap_freeze(&hm, &fm)){
+        printf("freeze failed\n");
+      }
+    }
+
+    // saves the frozen index to the given file
+    else if( strcmp("fsave", cmd)==0 ){ 
+      fscanf(stdin,"%s",cmd);           
+      if(echo){
+        printf("fsave %s\n",cmd);
+      }
+      if(fm.blob == NULL && !hashmap_freeze(&hm, &fm)){
+        printf("freeze failed\n");
+      }
+      else{
+        frozenmap_save(&fm, cmd);
+      }
+    }
+
+    // maps a saved frozen index and rebuilds the live table from it
+    else if( strcmp("fload", cmd)==0 ){ 
+      fscanf(stdin,"%s",cmd);           
+      if(echo){
+        printf("fload %s\n",cmd);
+      }
+      if(frozenmap_load(&fm, cmd)){
+        frozenmap_thaw(&fm, &hm);
+      }
+      else{
+        printf("load failed\n");
+      }
+    }
+
+
+    // shows key/vals with the given key prefix using the ordered index
+    else if( strcmp("prefix", cmd)==0 ){ 
+      fscanf(stdin,"%s",cmd);           
+      if(echo){
+        printf("prefix %s\n",cmd);
+      }
+      hashmap_prefix(&hm, cmd, print_item, NULL);
+    }
+
+    // shows key/vals with keys in the given range using the ordered index
+    else if( strcmp("range", cmd)==0 ){ 
+      char lo[128];
+      char hi[128];
+      fscanf(stdin,"%s %s",lo,hi);           
+      if(echo){
+        printf("range %s %s\n",lo,hi);
+      }
+      hashmap_range(&hm, lo, hi, print_item, NULL);
+    }
+
+    // shows the size of the ordered index
+    else if( strcmp("index", cmd)==0 ){ 
+      if(echo){
+        printf("index\n");
+      }
+      hashmap_index_show(&hm);
+    }
+
+    // waits so that keys with a TTL can expire
+    else if( strcmp("sleep", cmd)==0 ){ 
+      fscanf(stdin,"%s",cmd);           
+      if(echo){
+        printf("sleep %s\n",cmd);
+      }
+      long ms = atol(cmd);
+      struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+      nanosleep(&ts, NULL);
+    }
+
+    // moves map time forward without real time passing so expiry can
+    // be tested deterministically; keys expire before the next command
+    else if( strcmp("tick", cmd)==0 ){ 
+      fscanf(stdin,"%s",cmd);           
+      if(echo){
+        printf("tick %s\n",cmd);
+      }
+      long ms = atol(cmd);
+      ticked_ms += ms > 0 ? ms : 0;
+    }
     
     // unknown command
     else{                                 
@@ -157,6 +302,7 @@ int main(int argc, char *argv[]){
     }
   }
 
+  frozenmap_free(&fm);
   hashmap_free_table(&hm);
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hashmap.h"
+
+// hashmap_ttl.c: per-key expiry for hash maps. hashmap_put_ttl()
+// stores a key/val that expires a number of milliseconds after the
+// map's current time 'now'; the application moves 'now' forward with
+// hashmap_advance() which removes everything that has come due.
+//
+// Pending expiries live in a hierarchical timing wheel: 4 levels of
+// 256 slots, level L covering times 256^L ms apart. An item is filed
+// in the coarsest level whose span reaches its expiry and moves down a
+// level each time the level below wraps around ("cascades"), ending in
+// a level 0 slot that fires on exactly the right millisecond. Each
+// tick therefore touches only items that expire or cascade, never the
+// whole table, and a bitmap of occupied level 0 slots lets
+// hashmap_advance() jump over milliseconds in which nothing fires.
+//
+// hashmap_get() also removes an expired item it finds before the
+// wheel gets to it.
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS   8
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_SPAN   (1L << (WHEEL_BITS * WHEEL_LEVELS)) // furthest time the wheel can file
+
+struct hashwheel {
+  long current;                 // last map time whose expiries have been processed
+  long count;                   // number of nodes filed in the wheel
+  unsigned long occupied[WHEEL_SLOTS / 64]; // bit per non-empty level 0 slot
+  hashnode_t *slots[WHEEL_LEVELS][WHEEL_SLOTS]; // lists linked via wheel_next/wheel_pprev
+};
+
+static int wheel_slot(long expires, int level){
+  return (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+}
+
+// Links 'node' into the wheel slot for its 'expires' time. The level
+// is the first whose span from 'current' reaches the expiry; expiries
+// beyond the wheel's span are filed at its far end and re-filed when
+// they come around.
+static void wheel_file(hashwheel_t *wheel, hashnode_t *node){
+  long expires = node->expires;
+  if(expires < wheel->current){
+    expires = wheel->current;           // overdue: fire on the tick being processed
+  }
+  if(expires - wheel->current >= WHEEL_SPAN){
+    expires = wheel->current + WHEEL_SPAN - 1;
+  }
+  int level = 0;
+  while(level < WHEEL_LEVELS-1 &&
+        (expires >> (WHEEL_BITS * (level+1))) != (wheel->current >> (WHEEL_BITS * (level+1)))){
+    level++;
+  }
+  int slot = wheel_slot(expires, level);
+  hashnode_t **head = &wheel->slots[level][slot];
+  node->wheel_next = *head;
+  if(*head != NULL){
+    (*head)->wheel_pprev = &node->wheel_next;
+  }
+  node->wheel_pprev = head;
+  *head = node;
+  if(level == 0){
+    wheel->occupied[slot / 64] |= 1UL << (slot % 64);
+  }
+  wheel->count++;
+}
+
+// Detaches and returns the list of nodes in a slot
+static hashnode_t *wheel_take(hashwheel_t *wheel, int level, int slot){
+  hashnode_t *list = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  if(level == 0){
+    wheel->occupied[slot / 64] &= ~(1UL << (slot % 64));
+  }
+  for(hashnode_t *node = list; node != NULL; node = node->wheel_next){
+    node->wheel_pprev = NULL;
+    wheel->count--;
+  }
+  return list;
+}
+
+// The tick just before the next one with work to do: either an
+// occupied level 0 slot later in the current rotation or the wrap
+// around of level 0 at which coarser levels cascade. Returns 'current'
+// when the very next tick has work.
+static long wheel_next_event(hashwheel_t *wheel){
+  long current = wheel->current;
+  for(int slot = wheel_slot(current, 0) + 1; slot < WHEEL_SLOTS; ){
+    unsigned long bits = wheel->occupied[slot / 64] >> (slot % 64);
+    if(bits != 0){
+      return current - wheel_slot(current, 0) + slot + __builtin_ctzl(bits) - 1;
+    }
+    slot = (slot / 64 + 1) * 64;
+  }
+  return current | (WHEEL_SLOTS - 1);
+}
+
+// Stores key/val like hashmap_put() and arranges for it to expire
+// 'ttl_ms' milliseconds after the map's current time 'now'; a later
+// hashmap_put() of the same key without a TTL cancels the expiry.
+// Returns 1 if the key is new and 0 if an existing key was updated.
+int hashmap_put_ttl(hashmap_t *hm, char key[], char value[], long ttl_ms){
+  int added = hashmap_put(hm, key, value);
+  hashnode_t *node = hashmap_get_node(hm, key);
+  if(hm->wheel == NULL){
+    hm->wheel = calloc(1, sizeof(hashwheel_t));
+    hm->wheel->current = hm->now;
+  }
+  hashwheel_cancel(hm, node);
+  node->expires = hm->now + (ttl_ms > 0 ? ttl_ms : 1);
+  wheel_file(hm->wheel, node);
+  return added;
+}
+
+// Removes 'node' from the timing wheel if it is filed there and clears
+// its expiry. Safe to call on nodes without a TTL.
+void hashwheel_cancel(hashmap_t *hm, hashnode_t *node){
+  hashwheel_t *wheel = hm->wheel;
+  node->expires = 0;
+  if(node->wheel_pprev == NULL){
+    return;
+  }
+  *node->wheel_pprev = node->wheel_next;
+  if(node->wheel_next != NULL){
+    node->wheel_next->wheel_pprev = node->wheel_pprev;
+  }
+  else if(node->wheel_pprev >= &wheel->slots[0][0] &&
+          node->wheel_pprev < &wheel->slots[0][WHEEL_SLOTS] &&
+          *node->wheel_pprev == NULL){
+    // emptied a level 0 slot
+    int slot = node->wheel_pprev - &wheel->slots[0][0];
+    wheel->occupied[slot / 64] &= ~(1UL << (slot % 64));
+  }
+  node->wheel_pprev = NULL;
+  node->wheel_next = NULL;
+  wheel->count--;
+}
+
+// Sets the map time to 'now_ms' and removes every item whose TTL has
+// run out by then. Time never moves backwards; earlier values are
+// ignored. Returns the number of items removed.
+int hashmap_advance(hashmap_t *hm, long now_ms){
+  if(now_ms <= hm->now){
+    return 0;
+  }
+  hm->now = now_ms;
+  hashwheel_t *wheel = hm->wheel;
+  if(wheel == NULL){
+    return 0;
+  }
+  int expired = 0;
+  while(wheel->current < now_ms){
+    if(wheel->count == 0){
+      wheel->current = now_ms;
+      break;
+    }
+    long next = wheel_next_event(wheel);
+    if(next > wheel->current){         // nothing fires until then
+      wheel->current = next < now_ms ? next : now_ms;
+      continue;
+    }
+    wheel->current++;
+    long t = wheel->current;
+    // cascade coarser levels whose lower level just wrapped around
+    for(int level=1; level < WHEEL_LEVELS; level++){
+      if(wheel_slot(t, level-1) != 0){
+        break;
+      }
+      hashnode_t *node = wheel_take(wheel, level, wheel_slot(t, level));
+      while(node != NULL){
+        hashnode_t *next_node = node->wheel_next;
+        wheel_file(wheel, node);
+        node = next_node;
+      }
+    }
+    hashnode_t *node = wheel_take(wheel, 0, wheel_slot(t, 0));
+    while(node != NULL){
+      hashnode_t *next_node = node->wheel_next;
+      node->wheel_next = NULL;
+      if(node->expires <= t){
+        hashmap_remove_node(hm, node);
+        expired++;
+      }
+      else{
+        wheel_file(wheel, node);       // far expiry clamped to the span, not due yet
+      }
+      node = next_node;
+    }
+  }
+  return expired;
+}
+
+// De-allocates the wheel itself; the nodes filed in it belong to the
+// map and are free'd with it
+void hashwheel_free(hashwheel_t *wheel){
+  free(wheel);
+}
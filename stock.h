@@ -3,28 +3,213 @@
 #ifndef STOCK_H
 #define STOCK_H 1
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+typedef struct stock_range stock_range_t; // range query index, see stock_range.c
+typedef struct stock_pyramid stock_pyramid_t; // zoom levels for plotting, see stock_pyramid.c
+
 typedef struct {
   char *data_file;              // name of the data file stock data was loaded from
   int count;                    // length of prices array
+  int capacity;                 // allocated length of prices, grown by stock_push()
   double *prices;               // array of stock prices at different time points
+  int32_t *ticks;               // prices in ten-thousandths after stock_fix(), 'prices' is then NULL
+  int *times;                   // seconds since midnight of each price, NULL if the file has none
   int lo_index;                 // index of the lowest price
   int hi_index;                 // index of the highest price
   int best_buy;                 // index at which to buy to get best profit
   int best_sell;                // index at which to sell to get best profit
+  stock_range_t *range;         // index for stock_range() queries, NULL until needed
+  stock_pyramid_t *pyramid;     // min/max pyramid for plotting, NULL until needed
+  char *map;                    // mapped binary file that prices/times point into, else NULL
+  long map_size;                // length of the mapping
 } stock_t;
 
+// lo/hi and best buy/sell of a slice of prices, -1 where there is none
+typedef struct {
+  int lo;                       // index of the lowest price
+  int hi;                       // index of the highest price
+  int buy;                      // best buy index
+  int sell;                     // best sell index
+} stock_summary_t;
+
+// One column of a downsampled plot covering prices first..last
+typedef struct {
+  long first;                   // index of the first price in the column
+  long last;                    // index of the last price in the column
+  double lo;                    // lowest price in the column
+  double hi;                    // highest price in the column
+} stock_column_t;
+
+// A run of prices reduced to plot columns, see stock_columns.c
+typedef struct {
+  long start;                   // index of the first price
+  long count;                   // number of prices added
+  int width;                    // prices per column
+  int ncols;                    // number of columns in use
+  int max_cols;                 // most columns allowed
+  stock_column_t *cols;         // array of max_cols columns
+  double *overlay;              // value drawn as a line in each column, NULL for none
+} stock_columns_t;
+
+// One buy/sell trade, see stock_trades.c
+typedef struct {
+  int buy;                      // index the share is bought at
+  int sell;                     // index it is sold at
+} stock_trade_t;
+
+// Lowest, highest, first and last of a run of prices, see stock_pyramid.c
+typedef struct {
+  double lo;                    // lowest price
+  double hi;                    // highest price
+  double first;                 // first price of the run
+  double last;                  // last price of the run
+} stock_pyramid_node_t;
+
+// Stats of the window of prices ending at each index, see stock_rolling.c
+typedef struct {
+  int window;                   // prices in each window
+  int count;                    // number of prices, the length of each array
+  int *lo;                      // index of the lowest price in each window
+  int *hi;                      // index of the highest price in each window
+  double *mean;                 // mean price of each window
+  double *stddev;               // standard deviation of each window's prices
+  int *buy;                     // best buy index within each window, -1 if none
+  int *sell;                    // best sell index within each window, -1 if none
+} stock_rolling_t;
+
+// What stock_plot_columns() marks on a plot, indices -1 where there is none
+typedef struct {
+  long lo_index;                // index of the lowest price
+  long hi_index;                // index of the highest price
+  long best_buy;                // best buy index
+  long best_sell;               // best sell index
+  double lo_price;              // lowest price, bottom of the plot
+  double hi_price;              // highest price, top of the plot
+} stock_marks_t;
+
+// Results of stock_stream() on a stock file
+typedef struct {
+  char *data_file;              // name of the file
+  long count;                   // number of prices in it
+  double first[3];              // its first 3 prices, as printed by stock_print()
+  stock_marks_t marks;          // lo/hi and best buy/sell of the whole file
+  double buy_price;             // prices at marks.best_buy and marks.best_sell
+  double sell_price;
+  stock_columns_t columns;      // the requested slice reduced to plot columns
+} stock_stream_t;
+
+// Identity of a text stock file recorded in its cache file, see
+// stock_cache.c
+typedef struct {
+  uint64_t size;                // size in bytes
+  uint64_t mtime;               // modification time in nanoseconds
+  uint64_t hash;                // hash of the contents
+} stock_source_t;
+
+// Start of each line of a text buffer, filled in by stock_line_index()
+#define STOCK_LINES_BLOCK 256   // lines sharing one 64-bit base offset
+typedef struct {
+  long count;                   // number of complete lines
+  long *base;                   // offset of line b*STOCK_LINES_BLOCK for each block b
+  uint32_t *delta;              // offset of each line, and of line 'count', from its block's base
+} stock_lines_t;
+
+// instruction set levels for the kernels in stock_simd.c, stock_fixed.c and stock_lines.c
+#define STOCK_SIMD_SCALAR 0
+#define STOCK_SIMD_SSE2   1
+#define STOCK_SIMD_AVX2   2
+#define STOCK_SIMD_AVX512 3
+
 // stock_funcs.c
 void stock_print(stock_t *stock);
 stock_t *stock_new();
 void stock_free(stock_t *stock);
 void stock_set_hilo(stock_t *stock);
 int stock_set_best(stock_t *stock);
+int stock_set_hilo_best(stock_t *stock);
+void stock_push(stock_t *stock, int time, double price);
 int count_lines(char *filename);
 int stock_load(stock_t *stock, char *filename);
+int stock_load_parallel(stock_t *stock, char *filename, int nthreads);
+int stock_load_appended(stock_t *stock, int fd, long *offset);
+int stock_parse_time(char *str);
+int stock_time_index(stock_t *stock, int time);
+void stock_parse_line(char *pos, char *eol, int *time, double *price);
 void stock_plot(stock_t *stock, int max_width, int start, int stop);
+void stock_plot_cols(stock_t *stock, int max_height, int start, int stop, int max_cols);
+void stock_plot_overlay(stock_t *stock, int max_height, int start, int stop, int max_cols,
+                        double *overlay);
+void stock_plot_marked(stock_t *stock, stock_marks_t *marks, int max_height, int start, int stop,
+                       int max_cols, double *overlay);
+
+// stock_binary.c
+int stock_is_binary(char *data, long len);
+int stock_save_binary(stock_t *stock, char *filename, int delta);
+int stock_binary_attach(stock_t *stock, char *data, long len, char *filename);
+void stock_unmap(stock_t *stock);
+int stock_binary_set_source(char *filename, stock_source_t *source);
+int stock_binary_get_source(char *filename, stock_source_t *source);
+
+// stock_cache.c
+char *stock_cache_path(char *filename);
+int stock_load_cached(stock_t *stock, char *filename, int nthreads);
+
+// stock_columns.c
+void stock_columns_init(stock_columns_t *cols, long start, int max_cols, long count);
+void stock_columns_free(stock_columns_t *cols);
+void stock_columns_add(stock_columns_t *cols, double price);
+void stock_plot_columns(stock_columns_t *cols, stock_marks_t *marks, int max_height);
+
+// stock_stream.c
+int stock_stream(stock_stream_t *st, char *filename, long start, long stop, int max_cols);
+void stock_stream_print(stock_stream_t *st);
+void stock_stream_free(stock_stream_t *st);
+
+// stock_range.c
+int stock_range(stock_t *stock, int start, int stop, stock_summary_t *sum);
+stock_summary_t stock_summary_merge(double *prices, stock_summary_t left, stock_summary_t right);
+void stock_range_free(stock_range_t *range);
+int stock_set_hilo_best_parallel(stock_t *stock, int nthreads);
+
+// stock_pyramid.c
+stock_pyramid_t *stock_pyramid(stock_t *stock);
+stock_pyramid_node_t stock_pyramid_query(stock_t *stock, long start, long stop);
+void stock_pyramid_columns(stock_t *stock, stock_columns_t *cols, long stop);
+long stock_pyramid_nodes(long count);
+void stock_pyramid_fill(double *prices, long count, stock_pyramid_node_t *nodes);
+stock_pyramid_t *stock_pyramid_attach(stock_pyramid_node_t *nodes, long count, int copy);
+void stock_pyramid_free(stock_pyramid_t *pyr);
+
+// stock_trades.c
+double stock_best_trades(stock_t *stock, int max_trades, int cooldown, double fee,
+                         stock_trade_t **trades, int *ntrades);
+
+// stock_rolling.c
+int stock_rolling(stock_t *stock, int window, stock_rolling_t *roll);
+void stock_rolling_free(stock_rolling_t *roll);
+
+// stock_fixed.c
+double stock_price(stock_t *stock, int i);
+int stock_fix(stock_t *stock);
+void stock_unfix(stock_t *stock);
+int stock_fixed_level(int level);
+void stock_fixed_hilo(stock_t *stock);
+int stock_fixed_hilo_best(stock_t *stock);
+void stock_fixed_columns(stock_t *stock, stock_columns_t *cols, long stop);
+
+// stock_lines.c
+int stock_lines_level(int level);
+long stock_count_newlines(char *data, long len);
+int stock_line_index(stock_lines_t *lines, char *data, long len);
+long stock_line_start(stock_lines_t *lines, long i);
+void stock_lines_free(stock_lines_t *lines);
+
+// stock_simd.c
+int stock_simd_level(int level);
+void stock_argminmax(double *prices, int start, int stop, int *lo, int *hi);
 
 #endif
@@ -0,0 +1,299 @@
+// stock_batch.c: analyzes many stock files in one process and prints a
+// table with a line for each. Run as
+//
+//   ./stock_batch [--threads=N] [--compare] <file|dir|pattern> ...
+//
+// Arguments may be stock files, directories, all of whose files are
+// analyzed, or quoted glob patterns like 'data/stock-*.txt'. Files are
+// loaded and analyzed on a pool of N threads, default 4, and the table
+// lists them in the order given. The time taken and files per second
+// go to stderr; --compare also times running stock_main on each file
+// one after another, as a script would, and prints the speedup.
+//
+// File sizes vary a lot so splitting them evenly between threads up
+// front leaves some threads idle while others work through big files.
+// Instead each thread has a deque of files, biggest last, and takes
+// work from its own end; a thread whose deque is empty steals from
+// the other end of another thread's, taking the smaller files that
+// are left. The files are all known up front so a thread finding
+// every deque empty is done.
+
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stock.h"
+
+#define BATCH_THREADS 4         // threads used without --threads=N
+
+// Results for one file
+typedef struct {
+  char *file;                   // name of the file
+  long size;                    // size in bytes, used to order work
+  int ret;                      // stock_load() result
+  int count;                    // number of prices
+  int lo, hi, buy, sell;        // stats as from stock_set_hilo_best()
+  double profit;                // profit of the best trade, 0 if none
+} batch_file_t;
+
+// Files waiting for one thread: jobs[head..tail-1], indices into files
+typedef struct {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head;                     // where thieves take from
+  int tail;                     // where the owner takes from
+} batch_deque_t;
+
+// Shared by the threads of the pool
+typedef struct {
+  batch_file_t *files;
+  batch_deque_t *deques;
+  int nthreads;
+} batch_pool_t;
+
+// What a worker thread is given
+typedef struct {
+  batch_pool_t *pool;
+  int id;                       // index of its own deque
+  int stolen;                   // number of files it stole
+} batch_worker_t;
+
+// Current time in milliseconds from a monotonic clock
+static double now_ms(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Adds 'file' to the growing array '*files' of '*nfiles' entries
+static void add_file(batch_file_t **files, int *nfiles, char *file){
+  *files = realloc(*files, sizeof(batch_file_t) * (*nfiles + 1));
+  batch_file_t *f = &(*files)[(*nfiles)++];
+  memset(f, 0, sizeof(*f));
+  f->file = strdup(file);
+  struct stat st;
+  f->size = stat(file, &st) == 0 ? st.st_size : 0;
+}
+
+// Adds the files named by command line argument 'arg': the regular
+// files in it if it is a directory, the matches if it is a glob
+// pattern, otherwise 'arg' itself. Prints a message if a pattern
+// matches nothing.
+static void add_arg(batch_file_t **files, int *nfiles, char *arg){
+  struct stat st;
+  if(stat(arg, &st) == 0 && S_ISDIR(st.st_mode)){
+    char pattern[strlen(arg) + 3];
+    sprintf(pattern, "%s/*", arg);
+    glob_t g;
+    if(glob(pattern, 0, NULL, &g) == 0){
+      for(size_t i=0; i < g.gl_pathc; i++){
+        if(stat(g.gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode)){
+          add_file(files, nfiles, g.gl_pathv[i]);
+        }
+      }
+      globfree(&g);
+    }
+    return;
+  }
+  if(strpbrk(arg, "*?[") == NULL){
+    add_file(files, nfiles, arg);
+    return;
+  }
+  glob_t g;
+  if(glob(arg, 0, NULL, &g) != 0){
+    printf("No files match '%s'\n", arg);
+    return;
+  }
+  for(size_t i=0; i < g.gl_pathc; i++){
+    add_file(files, nfiles, g.gl_pathv[i]);
+  }
+  globfree(&g);
+}
+
+// Loads and analyzes one file, filling in its results
+static void analyze(batch_file_t *f){
+  stock_t *stock = stock_new();
+  f->ret = stock_load(stock, f->file);
+  f->count = stock->count;
+  if(f->ret == 0){
+    if(stock->lo_index < 0){    // binary stock files come with their stats
+      stock_set_hilo_best(stock);
+    }
+    f->lo = stock->lo_index;
+    f->hi = stock->hi_index;
+    f->buy = stock->best_buy;
+    f->sell = stock->best_sell;
+    f->profit = f->buy < 0 ? 0.0 : stock->prices[f->sell] - stock->prices[f->buy];
+  }
+  stock_free(stock);
+}
+
+// Takes the next job from deque 'd', from the tail for its owner and
+// the head for a thief. Returns -1 if it is empty.
+static int deque_take(batch_deque_t *d, int steal){
+  int job = -1;
+  pthread_mutex_lock(&d->lock);
+  if(d->head < d->tail){
+    job = steal ? d->jobs[d->head++] : d->jobs[--d->tail];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+// Thread body: works through its own deque then steals from the
+// others, starting with its neighbor, until there is nothing left
+static void *worker(void *arg){
+  batch_worker_t *w = arg;
+  batch_pool_t *pool = w->pool;
+  while(1){
+    int job = deque_take(&pool->deques[w->id], 0);
+    for(int v=1; job < 0 && v < pool->nthreads; v++){
+      job = deque_take(&pool->deques[(w->id + v) % pool->nthreads], 1);
+      w->stolen += job >= 0;
+    }
+    if(job < 0){
+      return NULL;
+    }
+    analyze(&pool->files[job]);
+  }
+}
+
+// Sorts indices by file size, smallest first
+static batch_file_t *sort_files;
+static int by_size(const void *a, const void *b){
+  long sa = sort_files[*(int *) a].size, sb = sort_files[*(int *) b].size;
+  return (sa > sb) - (sa < sb);
+}
+
+// Analyzes all 'nfiles' files on 'nthreads' threads. The files are
+// dealt out smallest to biggest in turn so every deque ends with its
+// biggest file, which its owner starts on. Returns the number of
+// files that were stolen.
+static int run_pool(batch_file_t *files, int nfiles, int nthreads){
+  int order[nfiles > 0 ? nfiles : 1];
+  for(int i=0; i < nfiles; i++){
+    order[i] = i;
+  }
+  sort_files = files;
+  qsort(order, nfiles, sizeof(int), by_size);
+
+  batch_deque_t deques[nthreads];
+  batch_pool_t pool = {files, deques, nthreads};
+  for(int t=0; t < nthreads; t++){
+    pthread_mutex_init(&deques[t].lock, NULL);
+    deques[t].jobs = malloc(sizeof(int) * (nfiles / nthreads + 1));
+    deques[t].head = 0;
+    deques[t].tail = 0;
+  }
+  for(int i=0; i < nfiles; i++){
+    batch_deque_t *d = &deques[i % nthreads];
+    d->jobs[d->tail++] = order[i];
+  }
+
+  batch_worker_t workers[nthreads];
+  pthread_t threads[nthreads];
+  for(int t=0; t < nthreads; t++){
+    workers[t] = (batch_worker_t) {&pool, t, 0};
+    if(t > 0){
+      pthread_create(&threads[t], NULL, worker, &workers[t]);
+    }
+  }
+  worker(&workers[0]);
+  int stolen = workers[0].stolen;
+  for(int t=1; t < nthreads; t++){
+    pthread_join(threads[t], NULL);
+    stolen += workers[t].stolen;
+  }
+  for(int t=0; t < nthreads; t++){
+    pthread_mutex_destroy(&deques[t].lock);
+    free(deques[t].jobs);
+  }
+  return stolen;
+}
+
+// Runs stock_main on each file one at a time with its output thrown
+// away, as a shell loop would, and returns the time taken in ms.
+// 'argv0' locates stock_main next to this program.
+static double run_serial(batch_file_t *files, int nfiles, char *argv0){
+  char prog[strlen(argv0) + 16];
+  strcpy(prog, argv0);
+  char *slash = strrchr(prog, '/');
+  strcpy(slash == NULL ? prog : slash + 1, "stock_main");
+  double t0 = now_ms();
+  for(int i=0; i < nfiles; i++){
+    pid_t pid = fork();
+    if(pid == 0){
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      execl(prog, prog, files[i].file, "10", NULL);
+      _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return now_ms() - t0;
+}
+
+int main(int argc, char *argv[]){
+  int nthreads = BATCH_THREADS; // --threads=N: analyze on N threads
+  int compare = 0;              // --compare: also time stock_main on each file
+  batch_file_t *files = NULL;
+  int nfiles = 0, nargs = 0;
+  for(int i=1; i<argc; i++){
+    if(strncmp(argv[i], "--threads=", 10) == 0){
+      nthreads = atoi(argv[i] + 10);
+    }
+    else if(strcmp(argv[i], "--compare") == 0){
+      compare = 1;
+    }
+    else if(strncmp(argv[i], "--", 2) == 0){
+      printf("unknown option %s\n", argv[i]);
+      return 1;
+    }
+    else{
+      add_arg(&files, &nfiles, argv[i]);
+      nargs++;
+    }
+  }
+  if(nargs == 0){
+    printf("usage: %s [--threads=N] [--compare] <file|dir|pattern> ...\n", argv[0]);
+    return 1;
+  }
+  if(nthreads < 1){
+    nthreads = 1;
+  }
+
+  double t0 = now_ms();
+  int stolen = run_pool(files, nfiles, nthreads);
+  double ms = now_ms() - t0;
+
+  printf("%-32s %8s %8s %8s %8s %8s %10s\n",
+         "file", "count", "lo", "hi", "buy", "sell", "profit");
+  for(int i=0; i < nfiles; i++){
+    batch_file_t *f = &files[i];
+    if(f->ret != 0){
+      printf("%-32s   failed to load\n", f->file);
+    }
+    else{
+      printf("%-32s %8d %8d %8d %8d %8d %10.2f\n",
+             f->file, f->count, f->lo, f->hi, f->buy, f->sell, f->profit);
+    }
+  }
+  fflush(stdout);
+  fprintf(stderr, "%d files on %d threads in %.2f ms: %.0f files/sec, %d stolen\n",
+          nfiles, nthreads, ms, nfiles / (ms / 1e3), stolen);
+  if(compare){
+    double serial = run_serial(files, nfiles, argv[0]);
+    fprintf(stderr, "stock_main on each file: %.2f ms, speedup %.1fx\n", serial, serial / ms);
+  }
+
+  for(int i=0; i < nfiles; i++){
+    free(files[i].file);
+  }
+  free(files);
+  return 0;
+}
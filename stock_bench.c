@@ -0,0 +1,1083 @@
+// stock_bench.c: timing benchmarks for the stock analysis functions.
+// Run as
+//
+//   ./stock_bench <bench> [count]
+//
+// where <bench> names one of the benchmarks below or 'all'. Without a
+// count each benchmark runs at several sizes. Results are printed one
+// line per measurement. The 'suite' benchmark instead prints one line
+// of JSON per measurement for tracking regressions; 'make bench' runs
+// it into stock-bench.jsonl.
+
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stock.h"
+#include "stock_store.h"
+
+// Current time in nanoseconds from a monotonic clock
+static double now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Fills 'prices' with a random walk of 'n' prices rounded to cents so
+// that equal prices and equal profits, which exercise tie-breaking,
+// are common
+static void make_prices(double *prices, int n){
+  srand(2021);
+  long cents = 10000;
+  for(int i=0; i<n; i++){
+    cents += rand() % 201 - 100;
+    if(cents < 1){
+      cents = 1;
+    }
+    prices[i] = cents / 100.0;
+  }
+}
+
+// The original two pass stock_set_hilo()
+static void reference_hilo(stock_t *stock){
+  stock->lo_index = 0;
+  stock->hi_index = 0;
+  for(int i = 0; i < stock->count; i++){
+    if(stock->prices[i] < stock->prices[stock->lo_index]){
+      stock->lo_index = i;
+    }
+  }
+  for(int i = 1; i < stock->count; i++){
+    if(stock->prices[stock->hi_index] < stock->prices[i]){
+      stock->hi_index = i;
+    }
+  }
+}
+
+// The original O(N^2) stock_set_best() trying every buy/sell pair
+static int reference_best(stock_t *stock){
+  double max_prof = 0.0;
+  stock->best_buy = -1;
+  stock->best_sell = -1;
+  for(int i=0; i < stock->count; i++){
+    for(int j=i; j < stock->count; j++){
+      if(stock->prices[j]-stock->prices[i] > max_prof){
+        stock->best_buy = i;
+        stock->best_sell = j;
+        max_prof = stock->prices[j] - stock->prices[i];
+      }
+    }
+  }
+  return max_prof > 0 ? 0 : -1;
+}
+
+// Largest count for which the quadratic reference is timed
+#define QUADRATIC_MAX 100000
+
+// Original hilo + O(N^2) best vs. the fused stock_set_hilo_best(),
+// checking that both give the same indices
+static void bench_best(int n){
+  double *prices = malloc(sizeof(double) * n);
+  make_prices(prices, n);
+  stock_t ref = {.count = n, .prices = prices};
+  stock_t fused = {.count = n, .prices = prices};
+
+  double t0 = now_ns();
+  reference_hilo(&ref);
+  double hilo_ns = now_ns() - t0;
+  double best_ns = -1;
+  if(n <= QUADRATIC_MAX){
+    t0 = now_ns();
+    reference_best(&ref);
+    best_ns = now_ns() - t0;
+  }
+  t0 = now_ns();
+  stock_set_hilo_best(&fused);
+  double fused_ns = now_ns() - t0;
+
+  printf("best n=%d\n", n);
+  printf("  original hilo:     %12.3f ms\n", hilo_ns / 1e6);
+  if(best_ns >= 0){
+    printf("  original best:     %12.3f ms\n", best_ns / 1e6);
+  }
+  else{
+    printf("  original best:     skipped, O(N^2) above n=%d\n", QUADRATIC_MAX);
+  }
+  printf("  fused hilo+best:   %12.3f ms  %6.2f ns/price\n", fused_ns / 1e6, fused_ns / n);
+  int same = ref.lo_index == fused.lo_index && ref.hi_index == fused.hi_index &&
+    (best_ns < 0 || (ref.best_buy == fused.best_buy && ref.best_sell == fused.best_sell));
+  printf("  results match: %s  lo %d hi %d buy %d sell %d\n", same ? "yes" : "NO",
+         fused.lo_index, fused.hi_index, fused.best_buy, fused.best_sell);
+  free(prices);
+}
+
+// Scalar vs. SSE2/AVX2/AVX-512 stock_argminmax() on 'n' prices: GB/s
+// of prices scanned for each level the CPU supports, checking each
+// against the scalar result
+static void bench_simd(int n){
+  double *prices = malloc(sizeof(double) * n);
+  make_prices(prices, n);
+  char *labels[] = {"scalar", "sse2", "avx2", "avx512"};
+  int want_lo = -1, want_hi = -1;
+  printf("simd n=%d (%.1f MB)\n", n, n * sizeof(double) / 1e6);
+  for(int level=STOCK_SIMD_SCALAR; level <= STOCK_SIMD_AVX512; level++){
+    if(stock_simd_level(level) != level){
+      printf("  %-8s not supported\n", labels[level]);
+      continue;
+    }
+    // repeat so that each timing covers at least 1GB of prices
+    int reps = 1 + 125000000 / n;
+    int lo = -1, hi = -1;
+    double best = 1e30;
+    for(int run=0; run<3; run++){
+      double t0 = now_ns();
+      for(int r=0; r<reps; r++){
+        stock_argminmax(prices, 0, n, &lo, &hi);
+      }
+      double ns = (now_ns() - t0) / reps;
+      best = ns < best ? ns : best;
+    }
+    if(level == STOCK_SIMD_SCALAR){
+      want_lo = lo;
+      want_hi = hi;
+    }
+    printf("  %-8s %8.2f GB/s  lo %d hi %d %s\n", labels[level],
+           n * sizeof(double) / best, lo, hi,
+           lo == want_lo && hi == want_hi ? "" : "MISMATCH");
+  }
+  stock_simd_level(-1);
+  free(prices);
+}
+
+// Writes a stock file of 'n' lines to 'path' by repeating the lines of
+// the TSLA sample data; returns its size in bytes
+static long make_stock_file(char *path, int n){
+  FILE *in = fopen("data/stock-TSLA-08-02-2021.txt", "r");
+  FILE *out = fopen(path, "w");
+  if(in == NULL || out == NULL){
+    printf("cannot create %s from data/stock-TSLA-08-02-2021.txt\n", path);
+    exit(1);
+  }
+  char line[128];
+  for(int i=0; i<n; i++){
+    if(fgets(line, sizeof(line), in) == NULL){
+      rewind(in);
+      fgets(line, sizeof(line), in);
+    }
+    fputs(line, out);
+  }
+  long bytes = ftell(out);
+  fclose(in);
+  fclose(out);
+  return bytes;
+}
+
+// The original stock_load(): count_lines() with fgetc() and then
+// fscanf() for each line
+static int reference_load(stock_t *stock, char *filename){
+  FILE *file = fopen(filename, "r");
+  int lines = 0;
+  for(int c = fgetc(file); c != EOF; c = fgetc(file)){
+    lines += c == '\n';
+  }
+  fclose(file);
+  stock->count = lines;
+  stock->prices = malloc(sizeof(double) * stock->count);
+  file = fopen(filename, "r");
+  for(int i=0; i < stock->count; i++){
+    fscanf(file, "%*s %lf", &stock->prices[i]);
+  }
+  fclose(file);
+  return 0;
+}
+
+// Original fgetc()/fscanf() loader vs. the mapped stock_load() and
+// stock_load_parallel() with 2, 4 and 8 threads: MB/s loading an 'n'
+// line file built from the TSLA data, best of 3 runs with the file in
+// the page cache. Then the same prices converted to the binary format,
+// plain and delta encoded, loaded by stock_load(); MB/s for those is
+// relative to the size of the text file.
+static void bench_load(int n){
+  char *path = "/tmp/stock_bench_load.txt";
+  long bytes = make_stock_file(path, n);
+  printf("load n=%d (%.1f MB)\n", n, bytes / 1e6);
+  int threads[5] = {0, 1, 2, 4, 8};            // 0 for the original loader
+  stock_t *reference = NULL;
+  for(int m=0; m<5; m++){
+    double best = 1e30;
+    stock_t *stock = NULL;
+    for(int run=0; run<3; run++){
+      if(stock != NULL){
+        stock_free(stock);
+      }
+      stock = stock_new();
+      double t0 = now_ns();
+      if(threads[m] == 0){
+        reference_load(stock, path);
+      }
+      else{
+        stock_load_parallel(stock, path, threads[m]);
+      }
+      double ns = now_ns() - t0;
+      best = ns < best ? ns : best;
+    }
+    int same = 1;
+    if(reference == NULL){
+      reference = stock;
+    }
+    else{
+      same = reference->count == stock->count &&
+        memcmp(reference->prices, stock->prices, sizeof(double) * stock->count) == 0;
+      stock_free(stock);
+    }
+    char label[32];
+    sprintf(label, threads[m] == 0 ? "fscanf" : "mapped x%d", threads[m]);
+    printf("  %-10s %10.2f ms %8.1f MB/s %s\n", label, best / 1e6, bytes / best * 1e3,
+           same ? "" : "PRICES DIFFER");
+  }
+  char *bin_path = "/tmp/stock_bench_load.stk";
+  for(int delta=0; delta<2; delta++){
+    stock_save_binary(reference, bin_path, delta);
+    double best = 1e30;
+    stock_t *stock = NULL;
+    for(int run=0; run<3; run++){
+      if(stock != NULL){
+        stock_free(stock);
+      }
+      stock = stock_new();
+      double t0 = now_ns();
+      stock_load(stock, bin_path);
+      double ns = now_ns() - t0;
+      best = ns < best ? ns : best;
+    }
+    int same = reference->count == stock->count &&
+      memcmp(reference->prices, stock->prices, sizeof(double) * stock->count) == 0;
+    stock_free(stock);
+    printf("  %-10s %10.2f ms %8.1f MB/s %s\n", delta ? "binary+d" : "binary", best / 1e6,
+           bytes / best * 1e3, same ? "" : "PRICES DIFFER");
+  }
+  remove(bin_path);
+  stock_free(reference);
+  remove(path);
+}
+
+// Peak resident memory of the process so far in MB
+static double peak_mb(){
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss / 1024.0;
+}
+
+// stock_stream() on an 'n' line file vs. stock_load() followed by
+// stock_set_hilo_best(), checking the results agree. The stream runs
+// first so the peak memory after it is its own; the peak after the
+// in-memory path includes the whole prices array.
+static void bench_stream(int n){
+  char *path = "/tmp/stock_bench_stream.txt";
+  long bytes = make_stock_file(path, n);
+  printf("stream n=%d (%.1f MB)\n", n, bytes / 1e6);
+  double base = peak_mb();
+  stock_stream_t st;
+  double t0 = now_ns();
+  stock_stream(&st, path, 0, -1, 100);
+  double ns = now_ns() - t0;
+  printf("  stock_stream:      %10.2f ms %8.1f MB/s  peak +%.1f MB\n", ns / 1e6,
+         bytes / ns * 1e3, peak_mb() - base);
+  stock_t *stock = stock_new();
+  t0 = now_ns();
+  stock_load(stock, path);
+  stock_set_hilo_best(stock);
+  ns = now_ns() - t0;
+  printf("  load + hilo_best:  %10.2f ms %8.1f MB/s  peak +%.1f MB\n", ns / 1e6,
+         bytes / ns * 1e3, peak_mb() - base);
+  int same = st.count == stock->count && st.marks.lo_index == stock->lo_index &&
+    st.marks.hi_index == stock->hi_index && st.marks.best_buy == stock->best_buy &&
+    st.marks.best_sell == stock->best_sell;
+  printf("  results match: %s\n", same ? "yes" : "NO");
+  stock_stream_free(&st);
+  stock_free(stock);
+  remove(path);
+}
+
+// stock_push() one price at a time vs. recomputing everything with
+// stock_set_hilo_best() after each price (only for small n where
+// that is feasible), checking the final stats agree
+static void bench_push(int n){
+  double *prices = malloc(sizeof(double) * n);
+  make_prices(prices, n);
+  printf("push n=%d\n", n);
+  stock_t *stock = stock_new();
+  double t0 = now_ns();
+  for(int i=0; i<n; i++){
+    stock_push(stock, i, prices[i]);
+  }
+  double push_ns = (now_ns() - t0) / n;
+  printf("  stock_push:            %10.2f ns/tick\n", push_ns);
+  stock_t batch = {.count = n, .prices = prices};
+  if(n <= QUADRATIC_MAX){
+    t0 = now_ns();
+    for(int i=1; i<=n; i++){
+      batch.count = i;
+      stock_set_hilo_best(&batch);
+    }
+    printf("  recompute every tick:  %10.2f ns/tick\n", (now_ns() - t0) / n);
+  }
+  else{
+    stock_set_hilo_best(&batch);
+    printf("  recompute every tick:  skipped, O(N^2) above n=%d\n", QUADRATIC_MAX);
+  }
+  int same = batch.lo_index == stock->lo_index && batch.hi_index == stock->hi_index &&
+    batch.best_buy == stock->best_buy && batch.best_sell == stock->best_sell;
+  printf("  results match: %s\n", same ? "yes" : "NO");
+  stock_free(stock);
+  free(prices);
+}
+
+// stock_range() on random slices vs. a fresh stock_set_hilo_best()
+// scan of each slice: queries per second and agreement of results
+static void bench_range(int n){
+  double *prices = malloc(sizeof(double) * n);
+  make_prices(prices, n);
+  stock_t stock = {.count = n, .prices = prices};
+  int queries = 1000000;
+  int *bounds = malloc(sizeof(int) * 2 * queries);
+  for(int q=0; q<queries; q++){
+    int a = rand() % (n + 1), b = rand() % (n + 1);
+    bounds[2*q] = a < b ? a : b;
+    bounds[2*q+1] = a < b ? b : a;
+  }
+  printf("range n=%d random slices\n", n);
+  double t0 = now_ns();
+  stock_summary_t sum;
+  stock_range(&stock, 0, n, &sum);
+  printf("  build:               %10.2f ms\n", (now_ns() - t0) / 1e6);
+  t0 = now_ns();
+  for(int q=0; q<queries; q++){
+    stock_range(&stock, bounds[2*q], bounds[2*q+1], &sum);
+  }
+  double range_s = (now_ns() - t0) / 1e9;
+  printf("  stock_range:         %10.0f queries/s\n", queries / range_s);
+  // rescanning is O(slice) so only time as many as fit in a second
+  int scanned = 0, mismatches = 0;
+  double scan_s = 0;
+  while(scan_s < 1.0 && scanned < queries){
+    stock_t slice = {.count = bounds[2*scanned+1] - bounds[2*scanned],
+                     .prices = prices + bounds[2*scanned]};
+    t0 = now_ns();
+    stock_set_hilo_best(&slice);
+    scan_s += (now_ns() - t0) / 1e9;
+    stock_range(&stock, bounds[2*scanned], bounds[2*scanned+1], &sum);
+    int off = bounds[2*scanned];
+    if(slice.count > 0 && (sum.lo != slice.lo_index + off || sum.hi != slice.hi_index + off ||
+                           sum.buy != (slice.best_buy < 0 ? -1 : slice.best_buy + off))){
+      mismatches++;
+    }
+    scanned++;
+  }
+  printf("  rescan each slice:   %10.0f queries/s\n", scanned / scan_s);
+  printf("  results match: %s (%d slices compared)\n", mismatches == 0 ? "yes" : "NO", scanned);
+  stock_range_free(stock.range);
+  free(bounds);
+  free(prices);
+}
+
+// Plain binary search for the first index at or after 'time'
+static int reference_time_index(int *times, int n, int time){
+  int lo = 0, hi = n;
+  while(lo < hi){
+    int mid = lo + (hi - lo) / 2;
+    if(times[mid] < time){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// stock_time_index() vs. a plain binary search for random times on
+// evenly spaced times, as in a feed sampled at a steady rate, and on
+// bunched up times where interpolation guesses badly
+static void bench_time(int n){
+  int *times = malloc(sizeof(int) * n);
+  stock_t stock = {.count = n, .times = times};
+  int queries = 1000000;
+  int *query = malloc(sizeof(int) * queries);
+  char *layouts[2] = {"uniform", "bunched"};
+  for(int l=0; l<2; l++){
+    for(int i=0; i<n; i++){
+      double x = (double) i / n;
+      times[i] = (int) (86400 * (l == 0 ? x : x * x * x * x));
+    }
+    for(int q=0; q<queries; q++){
+      query[q] = rand() % 86401;
+    }
+    printf("time n=%d %s times\n", n, layouts[l]);
+    long check = 0, ref_check = 0;
+    double t0 = now_ns();
+    for(int q=0; q<queries; q++){
+      check += stock_time_index(&stock, query[q]);
+    }
+    printf("  stock_time_index:    %10.2f ns/query\n", (now_ns() - t0) / queries);
+    t0 = now_ns();
+    for(int q=0; q<queries; q++){
+      ref_check += reference_time_index(times, n, query[q]);
+    }
+    printf("  binary search:       %10.2f ns/query\n", (now_ns() - t0) / queries);
+    printf("  results match: %s\n", check == ref_check ? "yes" : "NO");
+  }
+  free(query);
+  free(times);
+}
+
+// The original stock_plot() which printed the plot a character at a
+// time
+static void reference_plot(stock_t *stock, int max_height, int start, int stop){
+  double range = stock->prices[stock->hi_index] - stock->prices[stock->lo_index];
+  double plot_step = range/max_height;
+  double bottom = stock->prices[stock->lo_index];
+  printf("==PLOT DATA==\n");
+  printf("start/stop:  %d %d\n", start, stop);
+  printf("max_height:  %d\n", max_height);
+  printf("price range: %.2f\n", range);
+  printf("plot step:   %.2f\n", plot_step);
+  printf("           +");
+  for(int i=start; i < stop; i++){
+    if(i==stock->best_buy){
+      printf("B");
+    }
+    if(i==stock->best_sell){
+      printf("S");
+    }
+    if(i > stock->best_buy && i < stock->best_sell){
+      printf("=");
+    }
+    else if(i < stock->best_buy || i > stock->best_sell) {
+      printf("-");
+    }
+  }
+  printf("+\n");
+  for(int i = max_height; i > 0; i--){
+    printf("%10.2f ", (bottom + (i-1)*plot_step));
+    printf("|");
+    for(int j = start; j < stop; j++){
+      if(j == stock->hi_index){
+        printf("H");
+      }
+      else if((bottom + (i-1)*plot_step) <= stock->prices[j]){
+        printf(j == stock->lo_index ? "L" : "*");
+      }
+      else{
+        printf(" ");
+      }
+    }
+    printf("|\n");
+  }
+  printf("           +");
+  for(int i = start; i < stop; i++){
+    printf(i == 0 || i%5 == 0 ? "^" : "-");
+  }
+  printf("+\n");
+  printf("            ");
+  for(int i = start; i < stop; i++){
+    if(i == 0 ||  i%5 == 0){
+      printf("%-5d", i);
+    }
+  }
+}
+
+// Plotting the whole of 'n' prices the original way, with the buffered
+// stock_plot() and downsampled to 100 columns by stock_plot_cols(),
+// first building the min/max pyramid and then with it ready as when
+// zooming. The plots go to /dev/null so only producing them is timed.
+static void bench_plot(int n){
+  stock_t *stock = stock_new();
+  stock->prices = malloc(sizeof(double) * n);
+  stock->count = n;
+  stock->capacity = n;
+  make_prices(stock->prices, n);
+  stock_set_hilo_best(stock);
+  int height = 20;
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  double times[4];
+  for(int k=0; k<4; k++){
+    dup2(null, STDOUT_FILENO);
+    double t0 = now_ns();
+    if(k == 0){
+      reference_plot(stock, height, 0, n);
+    }
+    else if(k == 1){
+      stock_plot(stock, height, 0, n);
+    }
+    else{
+      stock_plot_cols(stock, height, 0, n, 100);
+    }
+    fflush(stdout);
+    times[k] = (now_ns() - t0) / 1e6;
+    dup2(saved, STDOUT_FILENO);
+  }
+  close(null);
+  close(saved);
+  printf("plot n=%d height=%d\n", n, height);
+  printf("  printf per char:     %10.2f ms\n", times[0]);
+  printf("  stock_plot:          %10.2f ms\n", times[1]);
+  printf("  cols 100 + pyramid:  %10.2f ms\n", times[2]);
+  printf("  cols 100 zoomed:     %10.2f ms\n", times[3]);
+  stock_free(stock);
+}
+
+// stock_set_hilo_best_parallel() at 1 to 32 threads against the
+// serial stock_set_hilo_best()
+static void bench_parallel(int n){
+  stock_t stock = {.count = n, .prices = malloc(sizeof(double) * n)};
+  make_prices(stock.prices, n);
+  printf("parallel n=%d\n", n);
+  double t0 = now_ns();
+  stock_set_hilo_best(&stock);
+  double serial_ms = (now_ns() - t0) / 1e6;
+  stock_t serial = stock;
+  printf("  serial:              %10.2f ms\n", serial_ms);
+  for(int threads=1; threads <= 32; threads *= 2){
+    t0 = now_ns();
+    stock_set_hilo_best_parallel(&stock, threads);
+    double ms = (now_ns() - t0) / 1e6;
+    int same = stock.lo_index == serial.lo_index && stock.hi_index == serial.hi_index &&
+      stock.best_buy == serial.best_buy && stock.best_sell == serial.best_sell;
+    printf("  %2d threads:          %10.2f ms  %5.2fx  match: %s\n",
+           threads, ms, serial_ms / ms, same ? "yes" : "NO");
+  }
+  free(stock.prices);
+}
+
+// Best profit of at most 'k' trades trying every buy for every sell:
+// best[j][s] = max(best[j][s-1], prices[s] - prices[b] + best[j-1][b-1])
+// over all b < s, which is O(N^2 * k)
+static double reference_trades(double *prices, int n, int k){
+  double *prev = calloc(n + 1, sizeof(double)), *cur = calloc(n + 1, sizeof(double));
+  for(int j=1; j <= k; j++){
+    cur[0] = 0.0;
+    for(int s=1; s <= n; s++){
+      cur[s] = cur[s-1];
+      for(int b=1; b < s; b++){
+        double profit = prices[s-1] - prices[b-1] + prev[b-1];
+        cur[s] = profit > cur[s] ? profit : cur[s];
+      }
+    }
+    double *t = prev;
+    prev = cur;
+    cur = t;
+  }
+  double best = prev[n];
+  free(prev);
+  free(cur);
+  return best;
+}
+
+// stock_best_trades() for several limits, cooldowns and fees, with and
+// without listing the trades, against the O(N^2 * k) way for small n
+static void bench_trades(int n){
+  stock_t stock = {.count = n, .prices = malloc(sizeof(double) * n)};
+  make_prices(stock.prices, n);
+  printf("trades n=%d\n", n);
+  int limits[5] = {1, 2, 10, 100, -1};
+  for(int a=0; a<5; a++){
+    for(int c=0; c<2; c++){
+      double fee = c == 0 ? 0.0 : 0.05;
+      int cooldown = c == 0 ? 0 : 3;
+      double t0 = now_ns();
+      double profit = stock_best_trades(&stock, limits[a], cooldown, fee, NULL, NULL);
+      double ms = (now_ns() - t0) / 1e6;
+      stock_trade_t *trades;
+      int ntrades;
+      t0 = now_ns();
+      stock_best_trades(&stock, limits[a], cooldown, fee, &trades, &ntrades);
+      double list_ms = (now_ns() - t0) / 1e6;
+      free(trades);
+      printf("  k=%-4d cooldown %d fee %.2f: %10.2f ms, with trades %10.2f ms (%d trades, profit %.2f)\n",
+             limits[a], cooldown, fee, ms, list_ms, ntrades, profit);
+    }
+  }
+  if(n <= 20000){
+    double t0 = now_ns();
+    double profit = reference_trades(stock.prices, n, 10);
+    printf("  O(N^2 k) k=10:       %10.2f ms (profit %.2f)\n", (now_ns() - t0) / 1e6, profit);
+  }
+  free(stock.prices);
+}
+
+// stock_rolling() against rescanning each window with
+// stock_set_hilo_best() and summing it, for several window sizes
+static void bench_rolling(int n){
+  stock_t stock = {.count = n, .prices = malloc(sizeof(double) * n)};
+  make_prices(stock.prices, n);
+  int windows[3] = {10, 100, 1000};
+  for(int w=0; w<3; w++){
+    int window = windows[w];
+    printf("rolling n=%d window=%d\n", n, window);
+    stock_rolling_t roll;
+    double t0 = now_ns();
+    stock_rolling(&stock, window, &roll);
+    double ms = (now_ns() - t0) / 1e6;
+    printf("  stock_rolling:       %10.2f ms\n", ms);
+    // rescanning is O(N * W) so only time as many windows as fit in a second
+    int scanned = 0, mismatches = 0;
+    double scan_s = 0;
+    while(scan_s < 1.0 && scanned < n){
+      int first = scanned - window + 1 > 0 ? scanned - window + 1 : 0;
+      t0 = now_ns();
+      stock_t slice = {.count = scanned - first + 1, .prices = stock.prices + first};
+      stock_set_hilo_best(&slice);
+      double sum = 0.0;
+      for(int j=0; j < slice.count; j++){
+        sum += slice.prices[j];
+      }
+      scan_s += (now_ns() - t0) / 1e9;
+      mismatches += roll.lo[scanned] != slice.lo_index + first ||
+        roll.hi[scanned] != slice.hi_index + first ||
+        fabs(roll.mean[scanned] - sum / slice.count) > 1e-6;
+      scanned++;
+    }
+    printf("  rescan each window:  %10.2f ms (projected from %d windows)\n",
+           scan_s * 1e3 * n / scanned, scanned);
+    printf("  results match: %s\n", mismatches == 0 ? "yes" : "NO");
+    stock_rolling_free(&roll);
+  }
+  free(stock.prices);
+}
+
+// stock_set_hilo_best(), stock_set_hilo() and a 100 column plot of
+// the whole stock on doubles and then on the int32 ticks of
+// stock_fix(), which must give the same indices
+static void bench_fixed(int n){
+  stock_t *stock = stock_new();
+  stock->prices = malloc(sizeof(double) * n);
+  stock->count = n;
+  stock->capacity = n;
+  make_prices(stock->prices, n);
+  printf("fixed n=%d\n", n);
+  int before[4];
+  for(int f=0; f<2; f++){
+    int reps = n < 1000000 ? 100 : 5;
+    double t0 = now_ns();
+    for(int r=0; r<reps; r++){
+      stock_set_hilo_best(stock);
+    }
+    double best_ms = (now_ns() - t0) / 1e6 / reps;
+    t0 = now_ns();
+    for(int r=0; r<reps; r++){
+      stock_set_hilo(stock);
+    }
+    double hilo_ms = (now_ns() - t0) / 1e6 / reps;
+    stock_columns_t cols;
+    stock_columns_init(&cols, 0, 100, n);
+    t0 = now_ns();
+    if(f == 0){
+      for(int i=0; i<n; i++){
+        stock_columns_add(&cols, stock->prices[i]);
+      }
+    }
+    else{
+      stock_fixed_columns(stock, &cols, n);
+    }
+    double cols_ms = (now_ns() - t0) / 1e6;
+    stock_columns_free(&cols);
+    int after[4] = {stock->lo_index, stock->hi_index, stock->best_buy, stock->best_sell};
+    if(f == 0){
+      memcpy(before, after, sizeof(before));
+      printf("  double %8ld MB: hilo_best %8.3f ms, hilo %8.3f ms, columns %8.3f ms\n",
+             sizeof(double) * n >> 20, best_ms, hilo_ms, cols_ms);
+      stock_fix(stock);
+    }
+    else{
+      printf("  int32  %8ld MB: hilo_best %8.3f ms, hilo %8.3f ms, columns %8.3f ms\n",
+             sizeof(int32_t) * n >> 20, best_ms, hilo_ms, cols_ms);
+      printf("  results match: %s\n", memcmp(before, after, sizeof(before)) == 0 ? "yes" : "NO");
+    }
+  }
+  stock_free(stock);
+}
+
+// Counting the newlines of an 'n' line stock file with memchr() per
+// line, as count_lines() used to, and with stock_count_newlines() at
+// each instruction set level, then building the stock_line_index():
+// GB/s with the file mapped and in the page cache, best of 3 runs
+static void bench_lines(int n){
+  char *path = "/tmp/stock_bench_lines.txt";
+  long bytes = make_stock_file(path, n);
+  int fd = open(path, O_RDONLY);
+  char *data = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  printf("lines n=%d (%.1f MB)\n", n, bytes / 1e6);
+  char *labels[] = {"scalar", "sse2", "avx2", "memchr", "index"};
+  int best_level = stock_lines_level(-1);
+  for(int k=0; k<5; k++){
+    if(k <= STOCK_SIMD_AVX2 && stock_lines_level(k) != k){
+      printf("  %-8s not supported\n", labels[k]);
+      continue;
+    }
+    stock_lines_level(k <= STOCK_SIMD_AVX2 ? k : best_level);
+    double best = 1e30;
+    long count = 0;
+    for(int run=0; run<3; run++){
+      double t0 = now_ns();
+      if(k <= STOCK_SIMD_AVX2){
+        count = stock_count_newlines(data, bytes);
+      }
+      else if(k == 3){
+        count = 0;
+        char *end = data + bytes;
+        for(char *pos = data; (pos = memchr(pos, '\n', end - pos)) != NULL; pos++){
+          count++;
+        }
+      }
+      else{
+        stock_lines_t lines;
+        stock_line_index(&lines, data, bytes);
+        count = lines.count;
+        stock_lines_free(&lines);
+      }
+      double ns = now_ns() - t0;
+      best = ns < best ? ns : best;
+    }
+    printf("  %-8s %8.2f GB/s %s\n", labels[k], bytes / best, count == n ? "" : "WRONG COUNT");
+  }
+  stock_lines_level(-1);
+  munmap(data, bytes);
+  remove(path);
+}
+
+// A stock store of 'n' tickers, each a file of 1000 to 2500 lines of
+// the TSLA data, against keeping an array of stocks and searching it
+// by name: the time to find a loaded stock by ticker; a first pass of
+// stats over every ticker, which loads them all, and a second one
+// answered from the kept stats; and requests going 80% to a tenth of
+// the tickers with a budget of a quarter of all the stocks, which
+// should mostly hit, against loading the file for every request
+static void bench_store(int n){
+  char *dir = "/tmp/stock_bench_store";
+  mkdir(dir, 0755);
+  char (*tickers)[8] = malloc(sizeof(*tickers) * n);
+  char (*files)[64] = malloc(sizeof(*files) * n);
+  long bytes = 0;
+  for(int i=0; i<n; i++){
+    for(int k=0, x=i; k<4; k++, x /= 26){
+      tickers[i][3-k] = 'A' + x % 26;
+    }
+    tickers[i][4] = '\0';
+    sprintf(files[i], "%s/%s.txt", dir, tickers[i]);
+    bytes += make_stock_file(files[i], 1000 + (i % 4) * 500);
+  }
+  printf("store n=%d tickers (%.1f MB of files)\n", n, bytes / 1e6);
+
+  stock_store_t store;
+  stock_store_init(&store, 0);
+  for(int i=0; i<n; i++){
+    stock_store_add(&store, tickers[i], files[i]);
+  }
+  double t0 = now_ns();
+  stock_store_stats_t stats;
+  for(int i=0; i<n; i++){
+    stock_store_stats(&store, tickers[i], &stats);
+  }
+  double cold_ns = now_ns() - t0;
+  t0 = now_ns();
+  for(int i=0; i<n; i++){
+    stock_store_stats(&store, tickers[i], &stats);
+  }
+  double warm_ns = now_ns() - t0;
+  printf("  stats  first pass %8.3f ms (%ld loads), second pass %8.3f ms\n",
+         cold_ns / 1e6, store.loads, warm_ns / 1e6);
+
+  stock_t **stocks = malloc(sizeof(stock_t *) * n);
+  for(int i=0; i<n; i++){
+    stocks[i] = stock_store_get(&store, tickers[i]);
+  }
+  int lookups = 1000000;
+  int *which = malloc(sizeof(int) * lookups);
+  srand(2021);
+  for(int j=0; j<lookups; j++){
+    which[j] = rand() % n;
+  }
+  long found = 0;
+  t0 = now_ns();
+  for(int j=0; j<lookups; j++){
+    for(int i=0; i<n; i++){
+      if(strcmp(tickers[i], tickers[which[j]]) == 0){
+        found += stocks[i]->count;
+        break;
+      }
+    }
+  }
+  double scan_ns = now_ns() - t0;
+  t0 = now_ns();
+  for(int j=0; j<lookups; j++){
+    found -= stock_store_get(&store, tickers[which[j]])->count;
+  }
+  double get_ns = now_ns() - t0;
+  printf("  lookup array scan %8.1f ns, store %8.1f ns %s\n",
+         scan_ns / lookups, get_ns / lookups, found == 0 ? "" : "WRONG STOCKS");
+  long total = store.bytes;
+  stock_store_free(&store);
+  free(stocks);
+
+  int requests = 50000;
+  for(int j=0; j<requests; j++){
+    which[j] = rand() % 10 < 8 ? rand() % (n / 10 + 1) : rand() % n;
+  }
+  stock_store_init(&store, total / 4);
+  for(int i=0; i<n; i++){
+    stock_store_add(&store, tickers[i], files[i]);
+  }
+  t0 = now_ns();
+  for(int j=0; j<requests; j++){
+    stock_store_get(&store, tickers[which[j]]);
+  }
+  double store_ns = now_ns() - t0;
+  int reloads = requests / 10;
+  t0 = now_ns();
+  for(int j=0; j<reloads; j++){
+    stock_t *stock = stock_new();
+    stock_load(stock, files[which[j]]);
+    stock_set_hilo_best(stock);
+    stock_free(stock);
+  }
+  double reload_ns = (now_ns() - t0) * requests / reloads;
+  printf("  skewed budget %.1f of %.1f MB: %.1f%% hits, %ld loads, %ld evictions\n",
+         store.budget / 1e6, total / 1e6, 100.0 * store.hits / requests,
+         store.loads, store.evictions);
+  printf("  skewed store %8.3f us/request, loading every time %8.3f us/request\n",
+         store_ns / requests / 1e3, reload_ns / requests / 1e3);
+  stock_store_free(&store);
+
+  for(int i=0; i<n; i++){
+    remove(files[i]);
+  }
+  rmdir(dir);
+  free(which);
+  free(tickers);
+  free(files);
+}
+
+// Shapes of synthetic series for the suite benchmark
+static char *shapes[] = {"walk", "trend", "sawtooth", "ascending", "descending"};
+#define NSHAPES 5
+
+// Fills 'prices' with 'n' prices in whole cents shaped like
+// shapes[shape]: a random walk; a walk drifting upwards so the best
+// trade spans most of the series; a sawtooth ramping up every 1000
+// prices; and the adversarial ascending and descending series where
+// every price is a new best trade or a new low
+static void make_series(double *prices, int n, int shape){
+  if(shape == 0){
+    make_prices(prices, n);
+    return;
+  }
+  srand(2021);
+  long cents = 10000;
+  for(int i=0; i<n; i++){
+    if(shape == 1){
+      cents += rand() % 201 - 95;
+      cents = cents < 1 ? 1 : cents;
+    }
+    else if(shape == 2){
+      cents = 10000 + (i % 1000) * 10;
+    }
+    else if(shape == 3){
+      cents = 10000 + i;
+    }
+    else{
+      cents = 10000 + (long) n - i;
+    }
+    prices[i] = cents / 100.0;
+  }
+}
+
+// Writes 'n' prices as a stock file at 'path' with times spread over a
+// day
+static void write_series(char *path, double *prices, int n){
+  FILE *out = fopen(path, "w");
+  if(out == NULL){
+    printf("cannot create %s\n", path);
+    exit(1);
+  }
+  for(int i=0; i<n; i++){
+    int t = (int) ((long) i * 86400 / n);
+    fprintf(out, "%02d:%02d:%02d %.4f\n", t / 3600, t / 60 % 60, t % 60, prices[i]);
+  }
+  fclose(out);
+}
+
+// Prints one suite measurement as a line of JSON: 'ms' taken by 'op'
+// over 'n' prices and 'bytes' of input, with the throughput and the
+// peak resident memory of the process so far
+static void json_result(char *shape, int n, char *op, double ms, long bytes){
+  printf("{\"shape\": \"%s\", \"n\": %d, \"op\": \"%s\", \"ms\": %.3f, "
+         "\"prices_per_s\": %.0f, \"mb_per_s\": %.1f, \"peak_rss_mb\": %.1f}\n",
+         shape, n, op, ms, n / (ms / 1e3), bytes / 1e6 / (ms / 1e3), peak_mb());
+}
+
+// Largest count for which the suite times a full width stock_plot()
+#define SUITE_PLOT_MAX 100000
+
+// Runs one suite size on the series in the stock file 'path' of
+// 'bytes' bytes, timing count_lines(), stock_load(), stock_set_hilo(),
+// stock_set_best() and plotting separately. Throughput for the file
+// steps is relative to the file's size and for the rest to the prices
+// array.
+static void suite_run(char *path, long bytes, int n, int shape){
+  long mem = sizeof(double) * (long) n;
+  char *name = shapes[shape];
+
+  double t0 = now_ns();
+  int lines = count_lines(path);
+  json_result(name, n, "count_lines", (now_ns() - t0) / 1e6, bytes);
+
+  stock_t *stock = stock_new();
+  t0 = now_ns();
+  stock_load(stock, path);
+  json_result(name, n, "stock_load", (now_ns() - t0) / 1e6, bytes);
+  if(lines != n || stock->count != n){
+    fprintf(stderr, "%s n=%d: counted %d lines, loaded %d\n", name, n, lines, stock->count);
+  }
+
+  t0 = now_ns();
+  stock_set_hilo(stock);
+  json_result(name, n, "stock_set_hilo", (now_ns() - t0) / 1e6, mem);
+  t0 = now_ns();
+  stock_set_best(stock);
+  json_result(name, n, "stock_set_best", (now_ns() - t0) / 1e6, mem);
+
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  double plot_ms = -1, cols_ms;
+  if(n <= SUITE_PLOT_MAX){
+    dup2(null, STDOUT_FILENO);
+    t0 = now_ns();
+    stock_plot(stock, 20, 0, n);
+    fflush(stdout);
+    plot_ms = (now_ns() - t0) / 1e6;
+    dup2(saved, STDOUT_FILENO);
+  }
+  dup2(null, STDOUT_FILENO);
+  t0 = now_ns();
+  stock_plot_cols(stock, 20, 0, n, 100);
+  fflush(stdout);
+  cols_ms = (now_ns() - t0) / 1e6;
+  dup2(saved, STDOUT_FILENO);
+  close(null);
+  close(saved);
+  if(plot_ms >= 0){
+    json_result(name, n, "stock_plot", plot_ms, mem);
+  }
+  json_result(name, n, "stock_plot_cols", cols_ms, mem);
+  stock_free(stock);
+}
+
+// Times the basic stock functions on every synthetic shape at 'n'
+// prices, or at 1e3 to 1e8 prices if 'n' is 0, printing a line of
+// JSON per measurement for regression tracking. The series is written
+// and then timed in child processes of their own so the reported peak
+// memory is that of the functions on that size alone.
+static void bench_suite(int n){
+  char path[64];
+  sprintf(path, "/tmp/stock_bench_suite_%d.txt", getpid());
+  for(int size = n > 0 ? n : 1000; size <= (n > 0 ? n : 100000000); size *= 10){
+    for(int shape=0; shape < NSHAPES; shape++){
+      fflush(stdout);
+      if(fork() == 0){
+        double *prices = malloc(sizeof(double) * size);
+        make_series(prices, size, shape);
+        write_series(path, prices, size);
+        _exit(0);
+      }
+      wait(NULL);
+      struct stat st;
+      stat(path, &st);
+      if(fork() == 0){
+        suite_run(path, st.st_size, size, shape);
+        fflush(stdout);
+        _exit(0);
+      }
+      wait(NULL);
+      remove(path);
+    }
+  }
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    printf("usage: %s <bench> [count]\n", argv[0]);
+    printf("benches: best simd load stream push range time plot parallel trades rolling fixed lines all\n");
+    printf("         suite prints JSON lines and runs 1e3 to 1e8 prices without a count\n");
+    printf("         store runs over [count] tickers, 3000 without a count\n");
+    return 1;
+  }
+  char *bench = argv[1];
+  if(strcmp(bench, "suite") == 0){
+    bench_suite(argc > 2 ? atoi(argv[2]) : 0);
+    return 0;
+  }
+  if(strcmp(bench, "store") == 0){
+    bench_store(argc > 2 ? atoi(argv[2]) : 3000);
+    return 0;
+  }
+  int sizes[3] = {1000, 100000, 10000000};
+  int nsizes = 3;
+  if(argc > 2){
+    sizes[0] = atoi(argv[2]);
+    nsizes = 1;
+  }
+  int all = strcmp(bench, "all") == 0;
+
+  for(int s=0; s<nsizes; s++){
+    if(all || strcmp(bench, "best") == 0){
+      bench_best(sizes[s]);
+    }
+    if(all || strcmp(bench, "simd") == 0){
+      bench_simd(sizes[s]);
+    }
+    if(all || strcmp(bench, "load") == 0){
+      bench_load(sizes[s]);
+    }
+    if(all || strcmp(bench, "stream") == 0){
+      bench_stream(sizes[s]);
+    }
+    if(all || strcmp(bench, "push") == 0){
+      bench_push(sizes[s]);
+    }
+    if(all || strcmp(bench, "range") == 0){
+      bench_range(sizes[s]);
+    }
+    if(all || strcmp(bench, "time") == 0){
+      bench_time(sizes[s]);
+    }
+    if(all || strcmp(bench, "plot") == 0){
+      bench_plot(sizes[s]);
+    }
+    if(all || strcmp(bench, "parallel") == 0){
+      bench_parallel(sizes[s]);
+    }
+    if(all || strcmp(bench, "trades") == 0){
+      bench_trades(sizes[s]);
+    }
+    if(all || strcmp(bench, "rolling") == 0){
+      bench_rolling(sizes[s]);
+    }
+    if(all || strcmp(bench, "fixed") == 0){
+      bench_fixed(sizes[s]);
+    }
+    if(all || strcmp(bench, "lines") == 0){
+      bench_lines(sizes[s]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,330 @@
+// stock_binary.c: a binary columnar stock file which stock_load()
+// maps into memory and uses in place with no parsing at all. Files
+// are made from text stock files by stock_save_binary(), see the
+// stock_convert program, and are recognized by their magic string so
+// any program that loads stocks accepts either kind.
+//
+// IMAGE LAYOUT (native byte order, each column STOCK_BIN_ALIGN aligned)
+//
+//   stockbin_header_t        magic, version, flags, count, offsets, summary,
+//                            source file identity for cache files
+//   int32_t times[count]     seconds since midnight, only with STOCK_BIN_TIMES
+//   double prices[count]     the prices, or with STOCK_BIN_DELTA
+//   int32_t deltas[count]    differences of successive prices in units
+//                            of 10^-price_scale, the first from 0
+//   stock_pyramid_node_t     the min/max pyramid of the prices laid out
+//     pyramid[]              by stock_pyramid_fill(), with STOCK_BIN_PYRAMID
+//
+// The columns are aligned to a cache line so the SIMD kernels load
+// them at full speed straight from the mapping. Delta encoded files
+// are about a third the size but their prices must be decoded into
+// the heap on load. The pyramid adds about a byte per price and saves
+// building it before the first downsampled plot.
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stock.h"
+
+#define STOCK_BIN_MAGIC "STOCKBIN"
+#define STOCK_BIN_VERSION 1
+#define STOCK_BIN_ALIGN 64            // alignment of each column
+#define STOCK_BIN_MAX_SCALE 8         // most decimal places tried for delta encoding
+
+#define STOCK_BIN_TIMES   0x1         // file has a times column
+#define STOCK_BIN_DELTA   0x2         // prices are delta encoded
+#define STOCK_BIN_SUMMARY 0x4         // lo/hi/buy/sell fields are valid
+#define STOCK_BIN_PYRAMID 0x8         // file has a min/max pyramid
+#define STOCK_BIN_SOURCE  0x10        // source fields identify the text file it caches
+
+typedef struct {
+  char magic[8];                // STOCK_BIN_MAGIC, no trailing \0
+  uint32_t version;             // STOCK_BIN_VERSION
+  uint32_t flags;               // STOCK_BIN_TIMES etc.
+  uint64_t count;               // number of prices
+  uint64_t times_off;           // offset of the times column, 0 if none
+  uint64_t prices_off;          // offset of the prices or deltas column
+  uint64_t file_size;           // total size of the file
+  int32_t price_scale;          // decimal places of delta encoded prices
+  int32_t lo, hi, buy, sell;    // precomputed stats of the whole stock
+  int32_t pad;                  // unused, keeps pyramid_off aligned
+  uint64_t pyramid_off;         // offset of the pyramid, 0 if none
+  stock_source_t source;        // with STOCK_BIN_SOURCE, the text file this was made from
+} stockbin_header_t;
+
+static long bin_align(long off){
+  return (off + STOCK_BIN_ALIGN - 1) & ~(long) (STOCK_BIN_ALIGN - 1);
+}
+
+// Offsets of the columns in a file with the given count and flags;
+// returns the total file size
+static long bin_layout(long count, int flags, long *times_off, long *prices_off, long *pyramid_off){
+  long off = bin_align(sizeof(stockbin_header_t));
+  *times_off = 0;
+  if(flags & STOCK_BIN_TIMES){
+    *times_off = off;
+    off = bin_align(off + count * sizeof(int32_t));
+  }
+  *prices_off = off;
+  long width = flags & STOCK_BIN_DELTA ? sizeof(int32_t) : sizeof(double);
+  off += count * width;
+  *pyramid_off = 0;
+  if(flags & STOCK_BIN_PYRAMID){
+    *pyramid_off = off = bin_align(off);
+    off += stock_pyramid_nodes(count) * sizeof(stock_pyramid_node_t);
+  }
+  return off;
+}
+
+// Returns 1 if the 'len' bytes at 'data' start like a binary stock
+// file and 0 otherwise
+int stock_is_binary(char *data, long len){
+  return len >= (long) sizeof(stockbin_header_t) &&
+    memcmp(data, STOCK_BIN_MAGIC, 8) == 0;
+}
+
+// Finds the fewest decimal places 0 to STOCK_BIN_MAX_SCALE at which
+// every price is an integer that converts back to exactly the same
+// double and whose successive differences fit in 32 bits. Returns -1
+// if there is none and the prices cannot be delta encoded.
+static int delta_scale(double *prices, int count){
+  double pow10 = 1.0;
+  for(int scale=0; scale <= STOCK_BIN_MAX_SCALE; scale++, pow10 *= 10){
+    int ok = 1;
+    long prev = 0;
+    for(int i=0; i < count && ok; i++){
+      double scaled = nearbyint(prices[i] * pow10);
+      long cur = (long) scaled;
+      ok = fabs(scaled) < 1e15 && cur / pow10 == prices[i] &&
+        cur - prev >= INT32_MIN && cur - prev <= INT32_MAX;
+      prev = cur;
+    }
+    if(ok){
+      return scale;
+    }
+  }
+  return -1;
+}
+
+// Writes 'stock' to 'filename' as a binary stock file including its
+// times if it has them. Computes the stats of the whole stock with
+// stock_set_hilo_best() and its min/max pyramid and stores them in the
+// file so loading and plotting do not have to. If 'delta' is non-zero
+// prices are delta encoded when that is exact, otherwise a message is
+// printed and they are stored as plain doubles. Returns 0 on success.
+// If the file cannot be written prints a message like
+//
+// Could not write file 'stock.bin'
+//
+// and returns -1.
+int stock_save_binary(stock_t *stock, char *filename, int delta){
+  stock_unfix(stock);
+  stockbin_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, STOCK_BIN_MAGIC, 8);
+  hdr.version = STOCK_BIN_VERSION;
+  hdr.count = stock->count;
+  hdr.flags = STOCK_BIN_SUMMARY | STOCK_BIN_PYRAMID;
+  if(stock->times != NULL){
+    hdr.flags |= STOCK_BIN_TIMES;
+  }
+  if(delta){
+    hdr.price_scale = delta_scale(stock->prices, stock->count);
+    if(hdr.price_scale < 0){
+      printf("Prices cannot be delta encoded exactly, storing them as doubles\n");
+      hdr.price_scale = 0;
+    }
+    else{
+      hdr.flags |= STOCK_BIN_DELTA;
+    }
+  }
+  stock_set_hilo_best(stock);
+  hdr.lo = stock->lo_index;
+  hdr.hi = stock->hi_index;
+  hdr.buy = stock->best_buy;
+  hdr.sell = stock->best_sell;
+  long times_off, prices_off, pyramid_off;
+  hdr.file_size = bin_layout(stock->count, hdr.flags, &times_off, &prices_off, &pyramid_off);
+  hdr.times_off = times_off;
+  hdr.prices_off = prices_off;
+  hdr.pyramid_off = pyramid_off;
+
+  char *image = calloc(hdr.file_size, 1);
+  memcpy(image, &hdr, sizeof(hdr));
+  if(stock->times != NULL){
+    memcpy(image + times_off, stock->times, sizeof(int32_t) * stock->count);
+  }
+  if(hdr.flags & STOCK_BIN_DELTA){
+    int32_t *deltas = (int32_t *) (image + prices_off);
+    double pow10 = pow(10, hdr.price_scale);
+    long prev = 0;
+    for(int i=0; i < stock->count; i++){
+      long cur = (long) nearbyint(stock->prices[i] * pow10);
+      deltas[i] = cur - prev;
+      prev = cur;
+    }
+  }
+  else{
+    memcpy(image + prices_off, stock->prices, sizeof(double) * stock->count);
+  }
+  stock_pyramid_fill(stock->prices, stock->count, (stock_pyramid_node_t *) (image + pyramid_off));
+
+  FILE *file = fopen(filename, "w");
+  long written = 0;
+  if(file != NULL){
+    written = fwrite(image, 1, hdr.file_size, file);
+    if(fclose(file) != 0){
+      written = 0;
+    }
+  }
+  free(image);
+  if(written != (long) hdr.file_size){
+    printf("Could not write file '%s'\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+// Whether the stats in 'hdr' are usable as indices of its prices:
+// each is -1 or in [0, count) and the buy comes before the sell
+static int summary_valid(stockbin_header_t *hdr){
+  int32_t index[4] = {hdr->lo, hdr->hi, hdr->buy, hdr->sell};
+  for(int k=0; k < 4; k++){
+    if(index[k] != -1 && (index[k] < 0 || (uint64_t) index[k] >= hdr->count)){
+      return 0;
+    }
+  }
+  return hdr->buy < 0 || hdr->sell < 0 || hdr->buy < hdr->sell;
+}
+
+// Sets up 'stock' from the binary stock file image 'data' of 'len'
+// bytes mapped with mmap(), which this takes over. Plain columns are
+// used in place: 'prices' and 'times' point into the image which is
+// kept in the 'map' field until stock_free() or stock_unmap(). Delta
+// encoded prices are decoded into the heap and the image is unmapped.
+// The stats stored in the file are copied to 'lo_index' etc. and its
+// pyramid, if any, becomes the stock's 'pyramid'. Returns 0 on
+// success. If the header does not describe a file of this size or its
+// stats are not indices of its prices, unmaps the image, prints
+//
+// Damaged binary stock file 'stock.bin'
+//
+// and returns -1; 'filename' is only used for the message.
+int stock_binary_attach(stock_t *stock, char *data, long len, char *filename){
+  stockbin_header_t *hdr = (stockbin_header_t *) data;
+  long times_off = 0, prices_off = 0, pyramid_off = 0;
+  long size = -1;
+  if(hdr->version == STOCK_BIN_VERSION && hdr->count <= INT32_MAX){
+    size = bin_layout(hdr->count, hdr->flags, &times_off, &prices_off, &pyramid_off);
+  }
+  if(size != len || hdr->file_size != (uint64_t) len ||
+     hdr->times_off != (uint64_t) times_off || hdr->prices_off != (uint64_t) prices_off ||
+     hdr->pyramid_off != (uint64_t) pyramid_off ||
+     ((hdr->flags & STOCK_BIN_SUMMARY) && !summary_valid(hdr))){
+    munmap(data, len);
+    printf("Damaged binary stock file '%s'\n", filename);
+    return -1;
+  }
+  stock->count = hdr->count;
+  stock->capacity = stock->count;
+  stock->times = hdr->flags & STOCK_BIN_TIMES ? (int *) (data + times_off) : NULL;
+  if(hdr->flags & STOCK_BIN_DELTA){
+    stock->prices = malloc(sizeof(double) * stock->count);
+    int32_t *deltas = (int32_t *) (data + prices_off);
+    double pow10 = pow(10, hdr->price_scale);
+    long cur = 0;
+    for(int i=0; i < stock->count; i++){
+      cur += deltas[i];
+      stock->prices[i] = cur / pow10;
+    }
+    if(stock->times != NULL){
+      int *times = malloc(sizeof(int) * stock->count);
+      memcpy(times, stock->times, sizeof(int) * stock->count);
+      stock->times = times;
+    }
+  }
+  else{
+    stock->prices = (double *) (data + prices_off);
+    stock->map = data;
+    stock->map_size = len;
+  }
+  if(hdr->flags & STOCK_BIN_PYRAMID){
+    stock->pyramid = stock_pyramid_attach((stock_pyramid_node_t *) (data + pyramid_off),
+                                          stock->count, stock->map == NULL);
+  }
+  if(hdr->flags & STOCK_BIN_SUMMARY){
+    stock->lo_index = hdr->lo;
+    stock->hi_index = hdr->hi;
+    stock->best_buy = hdr->buy;
+    stock->best_sell = hdr->sell;
+  }
+  if(stock->map == NULL){
+    munmap(data, len);          // everything was copied out
+  }
+  return 0;
+}
+
+// Records 'source' as the identity of the text file the binary stock
+// file 'filename' was made from, as stock_load_cached() does for its
+// cache files. Returns 0 on success or -1 if 'filename' is not a
+// binary stock file that can be written.
+int stock_binary_set_source(char *filename, stock_source_t *source){
+  stockbin_header_t hdr;
+  int fd = open(filename, O_RDWR);
+  int ret = -1;
+  if(fd >= 0 && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+     stock_is_binary((char *) &hdr, sizeof(hdr))){
+    hdr.flags |= STOCK_BIN_SOURCE;
+    hdr.source = *source;
+    ret = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? 0 : -1;
+  }
+  if(fd >= 0){
+    close(fd);
+  }
+  return ret;
+}
+
+// Reads into '*source' the identity of the text file the binary stock
+// file 'filename' was made from. Returns 0 on success or -1, printing
+// nothing, if 'filename' cannot be read, is not a binary stock file or
+// does not record its source.
+int stock_binary_get_source(char *filename, stock_source_t *source){
+  stockbin_header_t hdr;
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    return -1;
+  }
+  int ok = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+    stock_is_binary((char *) &hdr, sizeof(hdr)) && (hdr.flags & STOCK_BIN_SOURCE);
+  close(fd);
+  if(!ok){
+    return -1;
+  }
+  *source = hdr.source;
+  return 0;
+}
+
+// Copies the columns of a stock that point into a mapped binary file
+// into the heap and unmaps the file so that they can be changed, as
+// stock_push() does. Does nothing for other stocks.
+void stock_unmap(stock_t *stock){
+  if(stock->map == NULL){
+    return;
+  }
+  double *prices = malloc(sizeof(double) * (stock->count > 0 ? stock->count : 1));
+  memcpy(prices, stock->prices, sizeof(double) * stock->count);
+  stock->prices = prices;
+  if(stock->times != NULL){
+    int *times = malloc(sizeof(int) * (stock->count > 0 ? stock->count : 1));
+    memcpy(times, stock->times, sizeof(int) * stock->count);
+    stock->times = times;
+  }
+  stock_pyramid_free(stock->pyramid);     // its nodes are in the file
+  stock->pyramid = NULL;
+  munmap(stock->map, stock->map_size);
+  stock->map = NULL;
+  stock->map_size = 0;
+}
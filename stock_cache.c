@@ -0,0 +1,170 @@
+// stock_cache.c: a cache of parsed text stock files so that running
+// stock_main again on the same big file skips parsing and analysis.
+// The first stock_load_cached() of a text file writes its prices,
+// times, stats and pyramid as a binary stock file next to it, the
+// "sidecar"; later loads map the sidecar as stock_load() maps any
+// binary stock file, which takes no time to speak of.
+//
+// The sidecar's header records the size, modification time and a hash
+// of the contents of the text file. A sidecar is used only if the size
+// matches and either the time matches or, after the file was touched
+// or copied, the contents still hash the same, in which case the new
+// time is recorded. Anything else means the file changed and the
+// sidecar is rebuilt, so stale data is never used.
+//
+// Sidecars are named after the file with STOCK_CACHE_SUFFIX added or,
+// if the STOCK_CACHE_DIR environment variable is set, kept in that
+// directory under the file's full path with '/' replaced by '%'. They
+// are written to a temporary name and renamed into place so another
+// process never sees half of one. If no sidecar can be written the
+// file is loaded as usual.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stock.h"
+
+#define STOCK_CACHE_SUFFIX ".stkcache"
+
+// Hash of the 'len' bytes at 'data', 8 bytes at a time with a
+// multiply and shift to mix each word in
+static uint64_t hash_bytes(char *data, long len){
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+  long i = 0;
+  for(; i + 8 <= len; i += 8){
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    h = (h ^ word) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  for(; i < len; i++){
+    h = (h ^ (unsigned char) data[i]) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+// Fills in the size and time of the file 'filename' in '*source' and,
+// if 'hash' is non-zero, the hash of its contents. Returns 0 on
+// success or -1 if it cannot be read.
+static int source_of(char *filename, stock_source_t *source, int hash){
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0){
+    if(fd >= 0){
+      close(fd);
+    }
+    return -1;
+  }
+  source->size = st.st_size;
+  source->mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  source->hash = 0;
+  int ret = 0;
+  if(hash && st.st_size > 0){
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED){
+      ret = -1;
+    }
+    else{
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      source->hash = hash_bytes(data, st.st_size);
+      munmap(data, st.st_size);
+    }
+  }
+  else if(hash){
+    source->hash = hash_bytes("", 0);
+  }
+  close(fd);
+  return ret;
+}
+
+// Returns the malloc()'d name of the sidecar of 'filename', which the
+// caller frees
+char *stock_cache_path(char *filename){
+  char *dir = getenv("STOCK_CACHE_DIR");
+  if(dir == NULL || dir[0] == '\0'){
+    char *path = malloc(strlen(filename) + strlen(STOCK_CACHE_SUFFIX) + 1);
+    sprintf(path, "%s%s", filename, STOCK_CACHE_SUFFIX);
+    return path;
+  }
+  char full[PATH_MAX];
+  if(realpath(filename, full) == NULL){
+    snprintf(full, sizeof(full), "%s", filename);
+  }
+  for(char *c = full; *c != '\0'; c++){
+    *c = *c == '/' ? '%' : *c;
+  }
+  char *path = malloc(strlen(dir) + strlen(full) + strlen(STOCK_CACHE_SUFFIX) + 2);
+  sprintf(path, "%s/%s%s", dir, full, STOCK_CACHE_SUFFIX);
+  return path;
+}
+
+// Returns 1 if the sidecar 'cache' may be used for the text file whose
+// size and time are in '*source', bringing its recorded time up to
+// date if only that changed, and 0 if not
+static int cache_valid(char *filename, char *cache, stock_source_t *source){
+  stock_source_t cached;
+  if(stock_binary_get_source(cache, &cached) != 0 || cached.size != source->size){
+    return 0;
+  }
+  if(cached.mtime == source->mtime){
+    return 1;
+  }
+  stock_source_t now;
+  if(source_of(filename, &now, 1) != 0 || now.hash != cached.hash){
+    return 0;
+  }
+  stock_binary_set_source(cache, &now);
+  return 1;
+}
+
+// Writes the sidecar 'cache' for 'stock', just loaded from the text
+// file whose size and time before loading are in '*source'. Does
+// nothing if the sidecar cannot be written or the file changed while
+// it was loaded, since the hash would then not be of what was parsed.
+static void cache_write(stock_t *stock, char *filename, char *cache, stock_source_t *source){
+  stock_source_t now;
+  if(source_of(filename, &now, 1) != 0 || now.size != source->size || now.mtime != source->mtime){
+    return;
+  }
+  char tmp[strlen(cache) + 32];
+  sprintf(tmp, "%s.%d", cache, getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if(fd < 0){
+    return;                     // e.g. a read-only directory: no cache
+  }
+  close(fd);
+  if(stock_save_binary(stock, tmp, 0) == 0 && stock_binary_set_source(tmp, &now) == 0 &&
+     rename(tmp, cache) == 0){
+    return;
+  }
+  remove(tmp);
+}
+
+// Same as stock_load_parallel() with 'nthreads' threads but for text
+// stock files goes through the sidecar cache described above: uses a
+// valid sidecar in place of parsing the file, otherwise loads the file
+// and writes a sidecar for next time, which also fills in the stats.
+// Either way 'data_file' is 'filename'. Messages and return values are
+// the same as stock_load().
+int stock_load_cached(stock_t *stock, char *filename, int nthreads){
+  stock_source_t source;
+  if(source_of(filename, &source, 0) != 0){
+    return stock_load_parallel(stock, filename, nthreads); // prints the messages
+  }
+  char *cache = stock_cache_path(filename);
+  if(cache_valid(filename, cache, &source) && stock_load(stock, cache) == 0){
+    free(stock->data_file);
+    stock->data_file = strdup(filename);
+    free(cache);
+    return 0;
+  }
+  int ret = stock_load_parallel(stock, filename, nthreads);
+  if(ret == 0 && stock->map == NULL && stock->lo_index < 0){  // a text file
+    cache_write(stock, filename, cache, &source);
+  }
+  free(cache);
+  return ret;
+}
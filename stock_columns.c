@@ -0,0 +1,246 @@
+// stock_columns.c: reduces a run of prices to a limited number of plot
+// columns and draws them in the same style as stock_plot(). Prices
+// are added one at a time so a series can be reduced as it streams
+// past without being stored, see stock_stream.c.
+//
+// Each column covers 'width' consecutive prices and keeps the lowest
+// and highest of them: a min/max envelope. If the number of prices is
+// known up front the width is simply the fewest prices per column that
+// fit them into the allowed columns. Otherwise columns start out one
+// price wide; when a price would need one more column than allowed,
+// neighboring columns are merged in pairs and the width doubles,
+// ending up as the smallest power of two that fits however many
+// prices there turn out to be. Either way a run that fits is drawn one
+// price per column exactly as stock_plot() used to draw it.
+
+#include <math.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "stock.h"
+
+// Sets up 'cols' to reduce prices starting at index 'start' to at most
+// 'max_cols' columns. 'count' is the number of prices that will be
+// added or -1 if that is not known.
+void stock_columns_init(stock_columns_t *cols, long start, int max_cols, long count){
+  cols->start = start;
+  cols->count = 0;
+  cols->ncols = 0;
+  cols->max_cols = max_cols < 1 ? 1 : max_cols;
+  cols->width = 1;
+  if(count > cols->max_cols){
+    cols->width = (count + cols->max_cols - 1) / cols->max_cols;
+  }
+  cols->cols = malloc(sizeof(stock_column_t) * cols->max_cols);
+  cols->overlay = NULL;
+}
+
+// De-allocates the columns of 'cols'
+void stock_columns_free(stock_columns_t *cols){
+  free(cols->cols);
+  cols->cols = NULL;
+  free(cols->overlay);
+  cols->overlay = NULL;
+}
+
+// Halves the number of columns by merging neighbors, doubling 'width'
+static void columns_merge(stock_columns_t *cols){
+  int n = 0;
+  for(int c=0; c < cols->ncols; c += 2, n++){
+    stock_column_t merged = cols->cols[c];
+    if(c+1 < cols->ncols){
+      stock_column_t *right = &cols->cols[c+1];
+      merged.last = right->last;
+      merged.lo = right->lo < merged.lo ? right->lo : merged.lo;
+      merged.hi = right->hi > merged.hi ? right->hi : merged.hi;
+    }
+    cols->cols[n] = merged;
+  }
+  cols->ncols = n;
+  cols->width *= 2;
+}
+
+// Adds 'price' as the next price of 'cols' at index start+count
+void stock_columns_add(stock_columns_t *cols, double price){
+  long c = cols->count / cols->width;
+  if(c == cols->max_cols){
+    columns_merge(cols);
+    c = cols->count / cols->width;
+  }
+  long index = cols->start + cols->count;
+  if(c == cols->ncols){
+    stock_column_t *col = &cols->cols[cols->ncols++];
+    col->first = index;
+    col->last = index;
+    col->lo = price;
+    col->hi = price;
+  }
+  else{
+    stock_column_t *col = &cols->cols[c];
+    col->last = index;
+    col->lo = price < col->lo ? price : col->lo;
+    col->hi = price > col->hi ? price : col->hi;
+  }
+  cols->count++;
+}
+
+// 1 if column 'col' covers price 'index'
+static int covers(stock_column_t *col, long index){
+  return col->first <= index && index <= col->last;
+}
+
+// Growable buffer a plot is composed in before being written out
+typedef struct {
+  char *data;
+  long len;
+  long cap;
+} plotbuf_t;
+
+// Makes room for at least 'n' more bytes
+static void pb_reserve(plotbuf_t *pb, long n){
+  if(pb->len + n > pb->cap){
+    pb->cap = 2 * (pb->len + n);
+    pb->data = realloc(pb->data, pb->cap);
+  }
+}
+
+static void pb_putc(plotbuf_t *pb, char c){
+  pb_reserve(pb, 1);
+  pb->data[pb->len++] = c;
+}
+
+// printf() into the buffer, returning the number of characters added
+static int pb_printf(plotbuf_t *pb, char *fmt, ...){
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  pb_reserve(pb, n + 1);
+  va_start(args, fmt);
+  vsnprintf(pb->data + pb->len, n + 1, fmt, args);
+  va_end(args);
+  pb->len += n;
+  return n;
+}
+
+// Sends the buffer to standard output with a single write() after
+// anything already printed with stdio, then frees it
+static void pb_write(plotbuf_t *pb){
+  fflush(stdout);
+  for(long done = 0; done < pb->len; ){
+    long n = write(STDOUT_FILENO, pb->data + done, pb->len - done);
+    if(n <= 0){
+      break;
+    }
+    done += n;
+  }
+  free(pb->data);
+}
+
+// Draws the columns of 'cols' in the format of stock_plot() with the
+// lo/hi and best buy/sell positions and the price range in 'marks'.
+// A column is filled up to its highest price; rows above its lowest
+// price are drawn with ':' rather than '*' so the spread within a
+// column shows. H, L, B and S mark the columns that cover those
+// indices. If 'overlay' is set each column's value is drawn as '~' in
+// the row it falls in, a moving average for example. One price per
+// column gives exactly the output of stock_plot(); wider columns add a
+// 'column width' line to the header and label every tenth column with
+// its first index. The whole plot is composed in memory and written to
+// standard output at once.
+void stock_plot_columns(stock_columns_t *cols, stock_marks_t *marks, int max_height){
+  double range = marks->hi_price - marks->lo_price;
+  double plot_step = range/max_height;
+  double bottom = marks->lo_price;
+  plotbuf_t pb = {NULL, 0, 0};
+  pb_reserve(&pb, (long) (max_height + 4) * (cols->ncols + 16) + 256);
+
+  pb_printf(&pb, "==PLOT DATA==\n");
+  pb_printf(&pb, "start/stop:  %ld %ld\n", cols->start, cols->start + cols->count);
+  pb_printf(&pb, "max_height:  %d\n", max_height);
+  pb_printf(&pb, "price range: %.2f\n", range);
+  pb_printf(&pb, "plot step:   %.2f\n", plot_step);
+  if(cols->width > 1){
+    pb_printf(&pb, "column width: %d\n", cols->width);
+  }
+
+  pb_printf(&pb, "           +");
+  for(int c=0; c < cols->ncols; c++){
+    stock_column_t *col = &cols->cols[c];
+    if(covers(col, marks->best_buy)){
+      pb_putc(&pb, 'B');
+    }
+    else if(covers(col, marks->best_sell)){
+      pb_putc(&pb, 'S');
+    }
+    else if(col->first > marks->best_buy && col->last < marks->best_sell){
+      pb_putc(&pb, '=');
+    }
+    else{
+      pb_putc(&pb, '-');
+    }
+  }
+  pb_printf(&pb, "+\n");
+
+  for(int i = max_height; i > 0; i--){
+    double level = bottom + (i-1)*plot_step;
+    pb_printf(&pb, "%10.2f |", level);
+    pb_reserve(&pb, cols->ncols + 2);
+    char *row = pb.data + pb.len;
+    for(int c=0; c < cols->ncols; c++){
+      stock_column_t *col = &cols->cols[c];
+      double over = cols->overlay != NULL ? cols->overlay[c] : NAN;
+      if(covers(col, marks->hi_index)){
+        row[c] = 'H';
+      }
+      else if(level <= over && (over < level + plot_step || i == max_height) &&
+              !covers(col, marks->lo_index)){
+        row[c] = '~';
+      }
+      else if(level <= col->hi){
+        if(covers(col, marks->lo_index)){
+          row[c] = 'L';
+        }
+        else if(level <= col->lo){
+          row[c] = '*';
+        }
+        else{
+          row[c] = ':';
+        }
+      }
+      else{
+        row[c] = ' ';
+      }
+    }
+    pb.len += cols->ncols;
+    pb_printf(&pb, "|\n");
+  }
+
+  pb_printf(&pb, "           +");
+  for(int c=0; c < cols->ncols; c++){
+    long q = cols->cols[c].first / cols->width;
+    pb_putc(&pb, q == 0 || q%5 == 0 ? '^' : '-');
+  }
+  pb_printf(&pb, "+\n");
+
+  pb_printf(&pb, "            ");
+  if(cols->width == 1){
+    for(int c=0; c < cols->ncols; c++){
+      long i = cols->cols[c].first;
+      if(i == 0 ||  i%5 == 0){
+        pb_printf(&pb, "%-5ld", i);
+      }
+    }
+  }
+  else{
+    int pos = 0;                // column the next character goes in
+    for(int c=0; c < cols->ncols; c++){
+      long q = cols->cols[c].first / cols->width;
+      if(q%10 == 0 && c >= pos){
+        pos += pb_printf(&pb, "%*s", c - pos, "");
+        pos += pb_printf(&pb, "%ld", cols->cols[c].first);
+      }
+    }
+  }
+  pb_write(&pb);
+}
@@ -0,0 +1,46 @@
+// stock_convert.c: converts a text stock file to the binary format of
+// stock_binary.c which stock_load() maps without parsing. Run as
+//
+//   ./stock_convert [--delta] <stockfile> <binfile>
+//
+// --delta stores prices as differences in a fixed number of decimal
+// places which makes the file smaller but must be decoded on load.
+
+#include "stock.h"
+
+int main(int argc, char *argv[]){
+  int delta = 0;
+  char *args[argc];             // command line with --options removed
+  int nargs = 0;
+  for(int i=0; i<argc; i++){
+    if(strcmp(argv[i], "--delta") == 0){
+      delta = 1;
+    }
+    else if(strncmp(argv[i], "--", 2) == 0){
+      printf("unknown option %s\n", argv[i]);
+      return 1;
+    }
+    else{
+      args[nargs++] = argv[i];
+    }
+  }
+  if(nargs < 3){
+    printf("usage: %s [--delta] <stockfile> <binfile>\n", argv[0]);
+    return 1;
+  }
+
+  stock_t *stock = stock_new();
+  if(stock_load(stock, args[1]) == -1){
+    printf("Failed to load stock, exiting\n");
+    stock_free(stock);
+    return 1;
+  }
+  if(stock_save_binary(stock, args[2], delta) == -1){
+    stock_free(stock);
+    return 1;
+  }
+  printf("Wrote %d prices%s to '%s'\n", stock->count,
+         stock->times != NULL ? " and times" : "", args[2]);
+  stock_free(stock);
+  return 0;
+}
@@ -0,0 +1,290 @@
+// stock_fixed.c: fixed-point storage of prices. Price feeds give at
+// most four decimal places so a price is held exactly as an int32
+// count of ten-thousandths, 'ticks', half the size of a double. Scans
+// over the prices then move half as many bytes and compare integers
+// exactly.
+//
+// stock_fix() switches a loaded stock to ticks when every price
+// converts exactly, freeing the doubles; 'prices' is then NULL and
+// 'ticks' holds them. stock_set_hilo(), stock_set_best(),
+// stock_set_hilo_best(), stock_print() and stock_plot() work on either
+// kind using the kernels here. Everything else needs doubles and
+// calls stock_unfix() first, which converts back, just as stock_push()
+// copies a mapped binary stock out of its file with stock_unmap().
+
+#include <immintrin.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "stock.h"
+
+#define STOCK_FIXED_SCALE 10000       // ticks per unit of price
+
+// Price 'i' of 'stock' whichever way it is stored
+double stock_price(stock_t *stock, int i){
+  if(stock->ticks != NULL){
+    return stock->ticks[i] / (double) STOCK_FIXED_SCALE;
+  }
+  return stock->prices[i];
+}
+
+// Switches 'stock' to fixed-point storage if every price is a whole
+// number of ten-thousandths that fits in an int32 and converts back to
+// exactly the same double, so nothing printed or computed changes.
+// Returns 0 if it did and -1, leaving the doubles, if not.
+int stock_fix(stock_t *stock){
+  if(stock->ticks != NULL){
+    return 0;
+  }
+  if(stock->prices == NULL || stock->count < 0){
+    return -1;
+  }
+  int32_t *ticks = malloc(sizeof(int32_t) * (stock->count > 0 ? stock->count : 1));
+  for(int i=0; i < stock->count; i++){
+    double scaled = nearbyint(stock->prices[i] * STOCK_FIXED_SCALE);
+    if(!(fabs(scaled) <= INT32_MAX) || scaled / STOCK_FIXED_SCALE != stock->prices[i]){
+      free(ticks);
+      return -1;
+    }
+    ticks[i] = (int32_t) scaled;
+  }
+  stock_unmap(stock);                   // prices may be in a mapped file
+  stock_range_free(stock->range);
+  stock->range = NULL;
+  stock_pyramid_free(stock->pyramid);
+  stock->pyramid = NULL;
+  free(stock->prices);
+  stock->prices = NULL;
+  stock->ticks = ticks;
+  stock->capacity = stock->count;
+  return 0;
+}
+
+// Switches a stock stored in ticks back to doubles for the functions
+// that need them. Does nothing for other stocks.
+void stock_unfix(stock_t *stock){
+  if(stock->ticks == NULL){
+    return;
+  }
+  stock->prices = malloc(sizeof(double) * (stock->count > 0 ? stock->count : 1));
+  for(int i=0; i < stock->count; i++){
+    stock->prices[i] = stock->ticks[i] / (double) STOCK_FIXED_SCALE;
+  }
+  stock->capacity = stock->count;
+  free(stock->ticks);
+  stock->ticks = NULL;
+}
+
+// Folds the lowest and highest of the 'n' ticks into '*lo' and '*hi'
+// one at a time; finishes the tails of the vector kernels
+static void minmax_scalar(int32_t *ticks, int n, int32_t *lo, int32_t *hi){
+  for(int i=0; i < n; i++){
+    *lo = ticks[i] < *lo ? ticks[i] : *lo;
+    *hi = ticks[i] > *hi ? ticks[i] : *hi;
+  }
+}
+
+// SSE2 kernel: 4 lanes. SSE2 has no 32-bit min/max so selection is
+// done with and/andnot/or as in stock_simd.c.
+static void minmax_sse2(int32_t *ticks, int n, int32_t *lo, int32_t *hi){
+  int i = 0;
+  if(n >= 4){
+    __m128i vlo = _mm_loadu_si128((__m128i *) ticks);
+    __m128i vhi = vlo;
+    for(i=4; i+4 <= n; i+=4){
+      __m128i v = _mm_loadu_si128((__m128i *) (ticks + i));
+      __m128i less = _mm_cmplt_epi32(v, vlo);
+      vlo = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, vlo));
+      __m128i more = _mm_cmpgt_epi32(v, vhi);
+      vhi = _mm_or_si128(_mm_and_si128(more, v), _mm_andnot_si128(more, vhi));
+    }
+    int32_t lanes_lo[4], lanes_hi[4];
+    _mm_storeu_si128((__m128i *) lanes_lo, vlo);
+    _mm_storeu_si128((__m128i *) lanes_hi, vhi);
+    minmax_scalar(lanes_lo, 4, lo, hi);
+    minmax_scalar(lanes_hi, 4, lo, hi);
+  }
+  minmax_scalar(ticks + i, n - i, lo, hi);
+}
+
+// AVX2 kernel: 8 lanes with real 32-bit min/max, two vectors per
+// iteration into separate accumulators
+__attribute__((target("avx2")))
+static void minmax_avx2(int32_t *ticks, int n, int32_t *lo, int32_t *hi){
+  int i = 0;
+  if(n >= 16){
+    __m256i lo0 = _mm256_loadu_si256((__m256i *) ticks), hi0 = lo0;
+    __m256i lo1 = _mm256_loadu_si256((__m256i *) (ticks + 8)), hi1 = lo1;
+    for(i=16; i+16 <= n; i+=16){
+      __m256i a = _mm256_loadu_si256((__m256i *) (ticks + i));
+      __m256i b = _mm256_loadu_si256((__m256i *) (ticks + i + 8));
+      lo0 = _mm256_min_epi32(lo0, a);
+      hi0 = _mm256_max_epi32(hi0, a);
+      lo1 = _mm256_min_epi32(lo1, b);
+      hi1 = _mm256_max_epi32(hi1, b);
+    }
+    int32_t lanes_lo[8], lanes_hi[8];
+    _mm256_storeu_si256((__m256i *) lanes_lo, _mm256_min_epi32(lo0, lo1));
+    _mm256_storeu_si256((__m256i *) lanes_hi, _mm256_max_epi32(hi0, hi1));
+    _mm256_zeroupper();         // before the SSE code of the scalar tail
+    minmax_scalar(lanes_lo, 8, lo, hi);
+    minmax_scalar(lanes_hi, 8, lo, hi);
+  }
+  minmax_scalar(ticks + i, n - i, lo, hi);
+}
+
+// Index of the first of the 'n' ticks equal to 'value', which must be
+// present, one at a time
+static int find_scalar(int32_t *ticks, int n, int32_t value){
+  int i = 0;
+  while(ticks[i] != value){
+    i++;
+  }
+  return i;
+}
+
+// The same comparing 4 at a time
+static int find_sse2(int32_t *ticks, int n, int32_t value){
+  __m128i want = _mm_set1_epi32(value);
+  int i = 0;
+  for(; i+4 <= n; i+=4){
+    __m128i v = _mm_loadu_si128((__m128i *) (ticks + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, want)));
+    if(mask != 0){
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + find_scalar(ticks + i, n - i, value);
+}
+
+// and 8 at a time
+__attribute__((target("avx2")))
+static int find_avx2(int32_t *ticks, int n, int32_t value){
+  __m256i want = _mm256_set1_epi32(value);
+  int i = 0;
+  for(; i+8 <= n; i+=8){
+    __m256i v = _mm256_loadu_si256((__m256i *) (ticks + i));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, want)));
+    if(mask != 0){
+      _mm256_zeroupper();
+      return i + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  return i + find_scalar(ticks + i, n - i, value);
+}
+
+typedef void (*minmax_kernel_t)(int32_t *, int, int32_t *, int32_t *);
+typedef int (*find_kernel_t)(int32_t *, int, int32_t);
+
+static const minmax_kernel_t minmax_kernels[] = {
+  [STOCK_SIMD_SCALAR] = minmax_scalar,
+  [STOCK_SIMD_SSE2]   = minmax_sse2,
+  [STOCK_SIMD_AVX2]   = minmax_avx2,
+};
+static const find_kernel_t find_kernels[] = {
+  [STOCK_SIMD_SCALAR] = find_scalar,
+  [STOCK_SIMD_SSE2]   = find_sse2,
+  [STOCK_SIMD_AVX2]   = find_avx2,
+};
+
+static int fixed_level = -1;    // level in use, -1 until first chosen
+
+// Selects the instruction set level used by stock_fixed_hilo(), at most
+// STOCK_SIMD_AVX2. Passing -1 picks the best level the CPU supports.
+// Returns the level now in use which is unchanged if 'level' is not
+// supported.
+int stock_fixed_level(int level){
+  __builtin_cpu_init();
+  int best = __builtin_cpu_supports("avx2") ? STOCK_SIMD_AVX2 :
+    __builtin_cpu_supports("sse2") ? STOCK_SIMD_SSE2 : STOCK_SIMD_SCALAR;
+  if(level < 0){
+    level = best;
+  }
+  if(level <= best){
+    fixed_level = level;
+  }
+  return fixed_level;
+}
+
+// Picks the level on first use unless already selected, once for all
+// threads as in stock_simd.c
+static pthread_once_t fixed_once = PTHREAD_ONCE_INIT;
+
+static void fixed_first_use(){
+  if(fixed_level < 0){
+    stock_fixed_level(-1);
+  }
+}
+
+// stock_set_hilo() on ticks: the earliest lowest and highest. Integers
+// compare exactly so the lowest and highest values are found first
+// with the best kernel the CPU has, as in stock_simd.c, and then their
+// first positions.
+void stock_fixed_hilo(stock_t *stock){
+  if(stock->count <= 0){
+    return;
+  }
+  pthread_once(&fixed_once, fixed_first_use);
+  int32_t *ticks = stock->ticks;
+  int n = stock->count;
+  int32_t lo = ticks[0], hi = ticks[0];
+  minmax_kernels[fixed_level](ticks, n, &lo, &hi);
+  stock->lo_index = find_kernels[fixed_level](ticks, n, lo);
+  stock->hi_index = find_kernels[fixed_level](ticks, n, hi);
+}
+
+// stock_set_hilo_best() on ticks, the same single pass and tie-breaking
+// with exact integer profits
+int stock_fixed_hilo_best(stock_t *stock){
+  int32_t *ticks = stock->ticks;
+  int64_t max_prof = 0;
+  stock->best_buy = -1;
+  stock->best_sell = -1;
+  if(stock->count <= 0){
+    return -1;
+  }
+  int lo = 0, hi = 0;
+  int32_t lo_price = ticks[0], hi_price = ticks[0];
+  for(int j=1; j < stock->count; j++){
+    int32_t price = ticks[j];
+    if((int64_t) price - lo_price > max_prof){
+      max_prof = (int64_t) price - lo_price;
+      stock->best_buy = lo;
+      stock->best_sell = j;
+    }
+    if(price < lo_price){
+      lo = j;
+      lo_price = price;
+    }
+    if(hi_price < price){
+      hi = j;
+      hi_price = price;
+    }
+  }
+  stock->lo_index = lo;
+  stock->hi_index = hi;
+  return max_prof > 0 ? 0 : -1;
+}
+
+// Fills 'cols', set up by stock_columns_init() with the number of
+// prices known, with the columns for prices cols->start to 'stop'-1
+// of a stock stored in ticks, scanning the ticks of each column
+void stock_fixed_columns(stock_t *stock, stock_columns_t *cols, long stop){
+  cols->ncols = 0;
+  cols->count = stop - cols->start;
+  for(long first = cols->start; first < stop && cols->ncols < cols->max_cols; first += cols->width){
+    long last = first + cols->width < stop ? first + cols->width : stop;
+    int32_t lo = stock->ticks[first], hi = stock->ticks[first];
+    for(long i = first+1; i < last; i++){
+      lo = stock->ticks[i] < lo ? stock->ticks[i] : lo;
+      hi = stock->ticks[i] > hi ? stock->ticks[i] : hi;
+    }
+    stock_column_t *col = &cols->cols[cols->ncols++];
+    col->first = first;
+    col->last = last - 1;
+    col->lo = lo / (double) STOCK_FIXED_SCALE;
+    col->hi = hi / (double) STOCK_FIXED_SCALE;
+  }
+}
@@ -1,5 +1,12 @@
 // stock_funcs.c: support functions for the stock_main program.
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "stock.h"
 
 // Allocate a new stock struct and initialize its fields.
@@ -7,25 +14,43 @@
 stock_t *stock_new(){
   stock_t *stock = malloc(sizeof(stock_t));
   stock->count = -1;
+  stock->capacity = 0;
   stock->lo_index = -1;
   stock->hi_index = -1;
   stock->best_buy = -1;
   stock->best_sell = -1;
   stock->prices = NULL;
+  stock->ticks = NULL;
+  stock->times = NULL;
   stock->data_file = NULL;
+  stock->range = NULL;
+  stock->pyramid = NULL;
+  stock->map = NULL;
+  stock->map_size = 0;
   return stock;
 }
 
-// Free a stock. Check the 'data_file' and 'prices' fields:
-// if they are non-NULL, then free them. Then free the pointer to
-// 'stock' itself.
+// Free a stock. Check the 'data_file', 'prices' and 'times' fields:
+// if they are non-NULL, then free them, or unmap the binary file they
+// point into. Then free the pointer to 'stock' itself.
 void stock_free(stock_t *stock){
   if(stock -> data_file != NULL){
     free(stock -> data_file);
   }
-  if(stock -> prices != NULL){
-    free(stock -> prices);
+  stock_pyramid_free(stock->pyramid);
+  if(stock -> map != NULL){
+    munmap(stock -> map, stock -> map_size);
+  }
+  else{
+    if(stock -> prices != NULL){
+      free(stock -> prices);
+    }
+    if(stock -> times != NULL){
+      free(stock -> times);
+    }
   }
+  free(stock->ticks);
+  stock_range_free(stock->range);
   free(stock);
   return;
 }
@@ -40,7 +65,7 @@ void stock_print(stock_t *stock){
     printf("data_file: %s\n", stock->data_file);
   }
   printf("count: %d\n", stock->count);
-  if(stock->prices == NULL){
+  if(stock->prices == NULL && stock->ticks == NULL){
     printf("prices: NULL\n");
   }
   else{
@@ -48,16 +73,18 @@ void stock_print(stock_t *stock){
     printf("prices: []\n");
     } 
     else if(stock->count == 1){
-      printf("prices: [%.2f]\n", stock->prices[0]);
+      printf("prices: [%.2f]\n", stock_price(stock, 0));
     }
     else if(stock->count == 2){
-      printf("prices: [%.2f, %.2f]\n",stock->prices[0], stock->prices[1]);
+      printf("prices: [%.2f, %.2f]\n", stock_price(stock, 0), stock_price(stock, 1));
     }      
     else if(stock->count == 3){
-      printf("prices: [%.2f, %.2f, %.2f]\n",stock->prices[0], stock->prices[1], stock->prices[2]);
+      printf("prices: [%.2f, %.2f, %.2f]\n",
+             stock_price(stock, 0), stock_price(stock, 1), stock_price(stock, 2));
     }      
     else if(stock->count > 3){
-      printf("prices: [%.2f, %.2f, %.2f, ...]\n",stock->prices[0], stock->prices[1], stock->prices[2]);
+      printf("prices: [%.2f, %.2f, %.2f, ...]\n",
+             stock_price(stock, 0), stock_price(stock, 1), stock_price(stock, 2));
     } 
   } 
     printf("lo_index:  %d\n", stock->lo_index);
@@ -68,7 +95,7 @@ void stock_print(stock_t *stock){
       printf("profit:    0.00\n");
     }
     else{
-      profit = stock->prices[stock->best_sell] - stock->prices[stock->best_buy];
+      profit = stock_price(stock, stock->best_sell) - stock_price(stock, stock->best_buy);
       printf("profit:    %.2f\n", profit);
     }
   return;
@@ -77,24 +104,16 @@ void stock_print(stock_t *stock){
 
 // Sets the index of 'lo_index' and 'hi_index' fields of
 // the stock to be the positions in 'prices' of the lowest and highest
-// values present in it. Uses a simple loop over the array 'prices'
-// which is 'count' elements long to examine each for high/low. If
-// 'count' is zero, makes no changes to 'lo_index' and 'hi_index'.
+// values present in it; ties go to the earliest index. The scan over
+// the 'count' prices is done by the vectorized stock_argminmax(), or
+// stock_fixed_hilo() for prices stored in ticks. If 'count' is zero,
+// makes no changes to 'lo_index' and 'hi_index'.
 void stock_set_hilo(stock_t *stock){
-  if(stock->count > 0){
-    stock->lo_index = 0;
-    stock->hi_index = 0;
-    for(int i = 0; i < stock->count; i++){
-      if(stock-> prices[i] < stock-> prices[stock->lo_index]){
-        stock->lo_index = i;
-      }
-    }
-    for(int i = 1; i < stock->count; i++){
-      if(stock-> prices[stock->hi_index] < stock-> prices[i]){
-        stock->hi_index = i;
-      }
-    }
+  if(stock->ticks != NULL){
+    stock_fixed_hilo(stock);
+    return;
   }
+  stock_argminmax(stock->prices, 0, stock->count, &stock->lo_index, &stock->hi_index);
   return;
 }
   
@@ -106,76 +125,345 @@ void stock_set_hilo(stock_t *stock){
 // 'best_buy' and 'best_sell' indices to -1 and returns -1. Always
 // calculates the earliest buy/sell pair of indices that would get the
 // best profit: if 5,8 and 5,9 and 7,10 all give the same, maximal
-// profit, the best buy/sell indices are set to 5,7.
+// profit, the best buy/sell indices are set to 5,8.
 // 
 // ALGORITHM NOTES
-// One intuitive algorithm to compute this is to try every possible
-// buy index (outer loop) and every possible sell index after it
-// (inner loop) looking for the maximum profit produced in it. This is
-// a O(N^2) algorithm with N=count.  Using this algorithm is a good
-// start. Some MAKEUP CREDIT will be awarded for implementing a more
-// efficient, O(N) algorithm here. See the specification for more details.
+// Trying every buy index against every later sell index is O(N^2).
+// Instead this makes one O(N) pass: the best sell at index j pairs
+// with the lowest price before it, so tracking the running minimum
+// (earliest index on ties) and keeping only strictly better profits
+// finds the earliest best pair since the running minimum's index
+// never moves backwards.
 int stock_set_best(stock_t *stock){
+  int lo_index = stock->lo_index, hi_index = stock->hi_index;
+  int ret = stock_set_hilo_best(stock);
+  stock->lo_index = lo_index;
+  stock->hi_index = hi_index;
+  return ret;
+}
+
+// Computes everything stock_set_hilo() and stock_set_best() do in a
+// single pass over 'prices', setting 'lo_index', 'hi_index',
+// 'best_buy' and 'best_sell' with the same tie-breaking. Returns 0 if
+// there is a profitable buy/sell pair and -1 if not. This is what
+// stock_main uses; the separate functions remain for callers that
+// need only one of the results. Prices stored in ticks are handled by
+// stock_fixed_hilo_best().
+int stock_set_hilo_best(stock_t *stock){
+  if(stock->ticks != NULL){
+    return stock_fixed_hilo_best(stock);
+  }
+  double *prices = stock->prices;
   double max_prof = 0.0;
   stock->best_buy = -1;
   stock->best_sell = -1;
-  if(stock->count >= 0){
-    for(int i=0; i < stock->count; i++){
-      for(int j=i; j < stock->count; j++){
-        if(stock->prices[j]-stock->prices[i] > max_prof){
-          stock->best_buy = i;
-          stock->best_sell = j;
-          max_prof = stock->prices[j] - stock->prices[i];
-        }
-      }
-    }    
+  if(stock->count <= 0){
+    return -1;
   }
+  int lo = 0, hi = 0;           // running earliest min and max
+  for(int j=1; j < stock->count; j++){
+    double price = prices[j];
+    if(price - prices[lo] > max_prof){
+      max_prof = price - prices[lo];
+      stock->best_buy = lo;
+      stock->best_sell = j;
+    }
+    if(price < prices[lo]){
+      lo = j;
+    }
+    if(prices[hi] < price){
+      hi = j;
+    }
+  }
+  stock->lo_index = lo;
+  stock->hi_index = hi;
   if(max_prof > 0){
     return 0;
   }
   return -1;
 }
 
+// Appends 'price' at 'time' to the end of 'stock' and updates 'lo_index',
+// 'hi_index', 'best_buy' and 'best_sell' to include it with the same
+// results and tie-breaking as stock_set_hilo_best() on the whole
+// array. The 'prices' array is grown by doubling so a push costs
+// amortized O(1). The best buy for a new last price is the lowest
+// earlier price which is always 'lo_index', so nothing before the new
+// price needs to be looked at again. 'stock' must come from
+// stock_new() or stock_load(); if it has prices whose stats were not
+// yet computed, they are computed first. 'time' is in seconds since
+// midnight and is kept in 'times' when the stock is empty or already
+// has times; a negative 'time' or one earlier than the last drops the
+// 'times' column as stock_time_index() needs them in order. A stock
+// loaded from a binary file is first copied out of the file.
+void stock_push(stock_t *stock, int time, double price){
+  stock_unmap(stock);
+  stock_unfix(stock);
+  if(stock->count < 0){
+    stock->count = 0;
+  }
+  if(stock->count > 0 && stock->lo_index < 0){
+    stock_set_hilo_best(stock);
+  }
+  if(stock->count >= stock->capacity){
+    stock->capacity = stock->count < 8 ? 16 : 2 * stock->count;
+    stock->prices = realloc(stock->prices, sizeof(double) * stock->capacity);
+    if(stock->times != NULL){
+      stock->times = realloc(stock->times, sizeof(int) * stock->capacity);
+    }
+  }
+  if(stock->count == 0 && stock->times == NULL && time >= 0){
+    stock->times = malloc(sizeof(int) * stock->capacity);
+  }
+  if(stock->times != NULL && (time < 0 || (stock->count > 0 && time < stock->times[stock->count-1]))){
+    free(stock->times);
+    stock->times = NULL;
+  }
+  int j = stock->count++;
+  stock->prices[j] = price;
+  if(stock->times != NULL){
+    stock->times[j] = time;
+  }
+  stock_range_free(stock->range);         // blocks changed, rebuilt when next needed
+  stock->range = NULL;
+  stock_pyramid_free(stock->pyramid);
+  stock->pyramid = NULL;
+  if(j == 0){
+    stock->lo_index = 0;
+    stock->hi_index = 0;
+    return;
+  }
+  double *prices = stock->prices;
+  double max_prof = 0.0;
+  if(stock->best_buy >= 0){
+    max_prof = prices[stock->best_sell] - prices[stock->best_buy];
+  }
+  if(price - prices[stock->lo_index] > max_prof){
+    stock->best_buy = stock->lo_index;
+    stock->best_sell = j;
+  }
+  if(price < prices[stock->lo_index]){
+    stock->lo_index = j;
+  }
+  if(prices[stock->hi_index] < price){
+    stock->hi_index = j;
+  }
+}
+
+// Maps the file 'filename' into memory read-only and sets '*len' to
+// its size. An empty file gives a non-NULL pointer with length 0. If
+// the file cannot be opened or mapped, prints a message like
+//
+// Could not open file 'not-there.txt'
+//
+// and returns NULL. Release the mapping with unmap_file().
+static char *map_file(char *filename, size_t *len){
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0){
+    printf("Could not open file '%s'\n", filename);
+    if(fd >= 0){
+      close(fd);
+    }
+    return NULL;
+  }
+  *len = st.st_size;
+  if(*len == 0){
+    close(fd);
+    return "";
+  }
+  char *data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED){
+    printf("Could not open file '%s'\n", filename);
+    return NULL;
+  }
+  madvise(data, *len, MADV_SEQUENTIAL);
+  return data;
+}
+
+static void unmap_file(char *data, size_t len){
+  if(len > 0){
+    munmap(data, len);
+  }
+}
+
 // Opens file named 'filename' and counts how many times
 // the '\n' newline character appears in it which corresponds to how
-// many lines of text are in it.  Makes use of either fscanf() with
-// the %c format to read single characters or alternative I/O
-// functions like fgetc(). Closes the file before returning a count of
-// how many lines are it it.  If for any reason the file cannot be
-// opened, prints a message like
+// many lines of text are in it. The file is mapped into memory and
+// scanned a vector at a time by stock_count_newlines(). If
+// for any reason the file cannot be opened, prints a message like
 //
 // Could not open file 'not-there.txt'
 //
 // and returns -1 to indicate failure.
 int count_lines(char *filename){
-  FILE *non_empty;
-  char c;
-  int lines = 0;
-  non_empty = fopen(filename, "r"); 
-  if(non_empty == NULL){
-    printf("Could not open file '%s'\n", filename);
+  size_t len;
+  char *data = map_file(filename, &len);
+  if(data == NULL){
     return -1;
   }
-  
-  do{
-    c = fgetc(non_empty);
-    if(c == '\n'){
-      lines++;
+  int lines = stock_count_newlines(data, len);
+  unmap_file(data, len);
+  return lines;
+}
+
+// Exact powers of ten representable as doubles
+static const double pow10_exact[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Parses the decimal number starting at 's' and ending before 'end'
+// into '*out' with the same correctly rounded result as strtod().
+// Numbers with at most 15 significant digits and a small exponent,
+// which covers all ordinary prices, are computed directly: the digits
+// and the power of ten are both exact doubles so one multiply or
+// divide rounds correctly. Anything else is handed to strtod().
+// Returns a pointer just past the number.
+static char *parse_price(char *s, char *end, double *out){
+  char *start = s;
+  int negative = 0;
+  if(s < end && (*s == '-' || *s == '+')){
+    negative = *s == '-';
+    s++;
+  }
+  uint64_t digits = 0;
+  int ndigits = 0, exponent = 0;
+  char *first = s;
+  for(; s < end && *s >= '0' && *s <= '9'; s++){
+    if(digits != 0 || *s != '0'){
+      ndigits++;
+    }
+    digits = digits * 10 + (*s - '0');
+  }
+  if(s < end && *s == '.'){
+    for(s++; s < end && *s >= '0' && *s <= '9'; s++){
+      if(digits != 0 || *s != '0'){
+        ndigits++;
+      }
+      digits = digits * 10 + (*s - '0');
+      exponent--;
     }
-  }while(c != EOF);
+  }
+  int simple = ndigits <= 15 && s > first && (s - first > 1 || *first != '.') &&
+    (s == end || strchr("eExX", *s) == NULL);
+  if(simple && exponent >= -22){
+    double value = (double) digits;
+    value = exponent < 0 ? value / pow10_exact[-exponent] : value;
+    *out = negative ? -value : value;
+    return s;
+  }
+  // exponents, long mantissas, inf/nan: let the C library do it
+  char buf[128];
+  int n = 0;
+  for(s = start; s < end && n < 127 && *s != ' ' && *s != '\t' && *s != '\n' && *s != '\r'; s++){
+    buf[n++] = *s;
+  }
+  buf[n] = '\0';
+  char *stop;
+  *out = strtod(buf, &stop);
+  return start + (stop - buf);
+}
 
-  fclose(non_empty);
+static int is_blank(char c){
+  return c == ' ' || c == '\t' || c == '\r';
+}
 
-  return lines;
+// Parses a time of day HH:MM:SS or HH:MM from 's' up to 'end' into
+// seconds since midnight. Returns -1 if the text is not such a time.
+static int parse_time(char *s, char *end){
+  int fields[3] = {0, 0, 0};
+  int nfields = 0;
+  while(nfields < 3){
+    int ndigits = 0;
+    for(; s < end && *s >= '0' && *s <= '9' && ndigits < 2; s++, ndigits++){
+      fields[nfields] = fields[nfields] * 10 + (*s - '0');
+    }
+    if(ndigits == 0){
+      return -1;
+    }
+    nfields++;
+    if(s == end || *s != ':'){
+      break;
+    }
+    s++;
+  }
+  if(s != end || nfields < 2 || fields[0] > 23 || fields[1] > 59 || fields[2] > 59){
+    return -1;
+  }
+  return fields[0] * 3600 + fields[1] * 60 + fields[2];
+}
+
+// Converts the string 'str' which is a time of day like 09:30 or
+// 09:30:15 into seconds since midnight, the units of the 'times'
+// field. Returns -1 if 'str' is not a valid time.
+int stock_parse_time(char *str){
+  return parse_time(str, str + strlen(str));
+}
+
+// Parses the stock file line from 'pos' up to the newline or end of
+// data 'eol' into '*time', which is -1 unless the time is a time of day
+// (see parse_time()), and '*price' which is 0.0 if there is none
+void stock_parse_line(char *pos, char *eol, int *time, double *price){
+  while(pos < eol && is_blank(*pos)){          // leading space
+    pos++;
+  }
+  char *start = pos;
+  while(pos < eol && !is_blank(*pos)){         // time token
+    pos++;
+  }
+  *time = parse_time(start, pos);
+  while(pos < eol && is_blank(*pos)){
+    pos++;
+  }
+  *price = 0.0;
+  parse_price(pos, eol, price);
+}
+
+// Parses the first 'count' newline terminated lines starting at 'pos'
+// into 'prices' and, if it is not NULL, the time token at the start of
+// each line into 'times'; times which do not parse are stored as -1
+static void parse_lines(char *pos, char *end, int count, double *prices, int *times){
+  int time;
+  for(int i=0; i < count; i++){
+    char *eol = memchr(pos, '\n', end - pos);
+    stock_parse_line(pos, eol, times != NULL ? &times[i] : &time, &prices[i]);
+    pos = eol + 1;
+  }
+}
+
+// Keeps the 'times' column of a freshly loaded 'stock' only if every
+// line had a time and they never go backwards, which is what
+// stock_time_index() relies on; otherwise frees it and sets it NULL
+static void check_times(stock_t *stock){
+  int ok = stock->count > 0;
+  for(int i=0; i < stock->count && ok; i++){
+    ok = stock->times[i] >= 0 && (i == 0 || stock->times[i-1] <= stock->times[i]);
+  }
+  if(!ok){
+    free(stock->times);
+    stock->times = NULL;
+  }
+}
+
+// Finishes loading the binary stock file mapped at 'data' with
+// stock_binary_attach(), printing the usual message on failure
+static int load_binary(stock_t *stock, char *filename, char *data, size_t len){
+  if(stock_binary_attach(stock, data, len, filename) != 0){
+    stock->count = -1;
+    printf("Unable to open stock file '%s', bailing out\n", filename);
+    return -1;
+  }
+  stock->data_file = strdup(filename);
+  return 0;
 }
 
 // Loads a stock from file 'filename' into 'stock' filling
-// its 'prices' and 'count' fields in. Makes use of the count_lines()
-// function to determine how many lines are in the file which will
-// dictate 'count' and the length of 'prices'. Allocates space in the
-// heap for the stock's 'prices' array, opens the 'filename' and
-// iterates through reading prices into the array. The data format for
-// prices files is
+// its 'prices' and 'count' fields in. The file is mapped into memory
+// once: its newlines are counted to size the 'prices' array which is
+// allocated in the heap and then each line is parsed in place. The
+// data format for prices files is
 //
 // time_03 133.00
 // time_04 143.00
@@ -183,9 +471,15 @@ int count_lines(char *filename){
 // time_06 91.00
 // 
 // where each line has a time as as single string and a price which is
-// floating point number. The times can be ignored which can be
-// accomplished with a fscanf() call with format "%*s" to read a
-// string but ignore/discard it.
+// floating point number. Prices are converted with parse_price() which
+// gives the same values as fscanf("%lf"). Times of day like 09:30:00
+// or 09:30 are kept as seconds since midnight in the 'times' array,
+// parallel to 'prices'; if any line has some other kind of time, as
+// above, or the times are out of order 'times' is left NULL.
+//
+// Files written by stock_save_binary() are recognized and mapped in
+// place by stock_binary_attach() without any parsing; the stats stored
+// in them fill in 'lo_index', 'hi_index', 'best_buy' and 'best_sell'.
 // 
 // Assigns the 'datafile' field to be a duplicated string of
 // 'filename' for which 'strdup()' is extremely useful. This string
@@ -193,33 +487,250 @@ int count_lines(char *filename){
 // 
 // On successfully loading the stock, returns 0.
 //
-// If 'filename' cannot be opened, prints the message 
+// If 'filename' cannot be opened, prints the messages
 // 
+// Could not open file 'some-stock.txt'
 // Unable to open stock file 'some-stock.txt', bailing out
 //
 // with 'filename' substituted in for the name of the stock and
 // returns -1.
 int stock_load(stock_t *stock, char *filename){
-  stock->count = count_lines(filename);
-  if(stock->count == -1){
+  size_t len;
+  char *data = map_file(filename, &len);
+  if(data == NULL){
+    stock->count = -1;
     printf("Unable to open stock file '%s', bailing out\n", filename);
     return -1;
   }
+  if(stock_is_binary(data, len)){
+    return load_binary(stock, filename, data, len);
+  }
+  stock->count = stock_count_newlines(data, len);
+  stock->capacity = stock->count;
   stock->prices = malloc(sizeof(double) * stock->count);
-  FILE *non_empty = fopen(filename, "r");
-  if(non_empty == NULL){
+  stock->times = malloc(sizeof(int) * stock->count);
+  parse_lines(data, data + len, stock->count, stock->prices, stock->times);
+  check_times(stock);
+  unmap_file(data, len);
+  stock->data_file = strdup(filename);
+  return 0;
+}
+
+// One thread's share of the file in stock_load_parallel()
+typedef struct {
+  char *start;                  // first byte of the chunk, the start of a line
+  char *end;                    // one past the last byte, just after a newline
+  int count;                    // number of lines in the chunk
+  double *prices;               // where the chunk's prices go
+  int *times;                   // where the chunk's times go
+} load_chunk_t;
+
+static void *count_chunk(void *arg){
+  load_chunk_t *chunk = arg;
+  chunk->count = stock_count_newlines(chunk->start, chunk->end - chunk->start);
+  return NULL;
+}
+
+static void *parse_chunk(void *arg){
+  load_chunk_t *chunk = arg;
+  parse_lines(chunk->start, chunk->end, chunk->count, chunk->prices, chunk->times);
+  return NULL;
+}
+
+// Runs 'func' on each of the 'nthreads' chunks in its own thread and
+// waits for them all
+static void run_chunks(void *(*func)(void *), load_chunk_t *chunks, int nthreads){
+  pthread_t threads[nthreads];
+  for(int t=1; t < nthreads; t++){
+    pthread_create(&threads[t], NULL, func, &chunks[t]);
+  }
+  func(&chunks[0]);
+  for(int t=1; t < nthreads; t++){
+    pthread_join(threads[t], NULL);
+  }
+}
+
+// Same as stock_load() but the work is split among 'nthreads'
+// threads. The mapped file is cut into equal sized chunks whose
+// boundaries are moved forward to just after a newline. Each thread
+// counts the lines in its chunk, a prefix sum over the counts gives
+// every chunk its offset in 'prices', then each thread parses its
+// chunk into that region. Prices end up in file order exactly as with
+// stock_load() which this calls for 'nthreads' of 1 or less. Binary
+// stock files need no parsing and are mapped just as stock_load()
+// does. Messages and return values are the same as stock_load().
+int stock_load_parallel(stock_t *stock, char *filename, int nthreads){
+  if(nthreads <= 1){
+    return stock_load(stock, filename);
+  }
+  size_t len;
+  char *data = map_file(filename, &len);
+  if(data == NULL){
+    stock->count = -1;
     printf("Unable to open stock file '%s', bailing out\n", filename);
-    fclose(non_empty);
     return -1;
   }
-  for(int i=0; i < stock->count; i++){
-    fscanf(non_empty, "%*s %lf", &stock->prices[i]);
+  if(stock_is_binary(data, len)){
+    return load_binary(stock, filename, data, len);
+  }
+  char *end = data + len;
+  load_chunk_t chunks[nthreads];
+  char *pos = data;
+  for(int t=0; t < nthreads; t++){
+    chunks[t].start = pos;
+    char *cut = t == nthreads-1 ? end : data + len / nthreads * (t + 1);
+    if(cut < pos){
+      cut = pos;
+    }
+    if(cut < end){              // move to just after the next newline
+      char *nl = memchr(cut, '\n', end - cut);
+      cut = nl == NULL ? end : nl + 1;
+    }
+    chunks[t].end = cut;
+    pos = cut;
+  }
+  run_chunks(count_chunk, chunks, nthreads);
+
+  stock->count = 0;
+  for(int t=0; t < nthreads; t++){
+    stock->count += chunks[t].count;
   }
-  fclose(non_empty);
+  stock->capacity = stock->count;
+  stock->prices = malloc(sizeof(double) * stock->count);
+  stock->times = malloc(sizeof(int) * stock->count);
+  int offset = 0;
+  for(int t=0; t < nthreads; t++){
+    chunks[t].prices = stock->prices + offset;
+    chunks[t].times = stock->times + offset;
+    offset += chunks[t].count;
+  }
+  run_chunks(parse_chunk, chunks, nthreads);
+  check_times(stock);
+
+  unmap_file(data, len);
   stock->data_file = strdup(filename);
   return 0;
 }
 
+// Reads lines appended to the open stock file 'fd' since byte
+// '*offset' and adds their times and prices to 'stock' with stock_push(). Only
+// complete lines are consumed; '*offset' is advanced to just past the
+// last newline read so a partly written line is picked up by a later
+// call. Used to follow a file that another program is appending to.
+// Returns the number of prices added, 0 if there was nothing new.
+int stock_load_appended(stock_t *stock, int fd, long *offset){
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size <= *offset){
+    return 0;
+  }
+  long len = st.st_size - *offset;
+  char *data = malloc(len);
+  long got = pread(fd, data, len, *offset);
+  char *last_nl = NULL;
+  for(long i = got-1; i >= 0 && last_nl == NULL; i--){
+    if(data[i] == '\n'){
+      last_nl = &data[i];
+    }
+  }
+  if(last_nl == NULL){
+    free(data);
+    return 0;
+  }
+  int count = stock_count_newlines(data, last_nl + 1 - data);
+  double *prices = malloc(sizeof(double) * count);
+  int *times = malloc(sizeof(int) * count);
+  parse_lines(data, last_nl + 1, count, prices, times);
+  for(int i=0; i < count; i++){
+    stock_push(stock, times[i], prices[i]);
+  }
+  *offset += last_nl + 1 - data;
+  free(times);
+  free(prices);
+  free(data);
+  return count;
+}
+
+#define TIME_GALLOP_MAX 256     // farthest step from the guess before bisecting instead
+
+// Returns 1 if the 'n' sorted 'times' are roughly evenly spaced: each
+// quartile lies within 1/16 of the total span of where even spacing
+// would put it. Probes the same 3 places on every call so they stay in
+// cache.
+static int times_even(int *times, int n){
+  long span = times[n-1] - times[0];
+  for(int q=1; q<4; q++){
+    long expect = times[0] + span * q / 4;
+    long diff = times[(long) (n-1) * q / 4] - expect;
+    if(diff * 16 > span || -diff * 16 > span){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Returns the index of the first price in 'stock' at or after 'time'
+// (seconds since midnight), 'count' if there is none, so the prices
+// from time 'a' up to but not including time 'b' are the indices
+// stock_time_index(stock, a) to stock_time_index(stock, b)-1. 'times'
+// must be non-NULL.
+//
+// ALGORITHM NOTES
+// Times are sorted so a binary search would work in O(log N), but
+// prices are usually sampled at a steady rate where linear
+// interpolation between the first and last times guesses the position
+// almost exactly. From the guess the search gallops outwards in
+// doubling steps until the answer is bracketed, then bisects the
+// bracket. That costs O(log d) probes for a guess d places off, all
+// near each other in memory. Times that are bunched up rather than
+// evenly spaced, as judged by times_even(), go straight to an ordinary
+// binary search, as does a search whose gallop goes further than
+// TIME_GALLOP_MAX places without bracketing the answer.
+int stock_time_index(stock_t *stock, int time){
+  int *times = stock->times;
+  int n = stock->count;
+  if(n <= 0 || times[0] >= time){
+    return 0;
+  }
+  if(times[n-1] < time){
+    return n;
+  }
+  // now times[0] < time <= times[n-1]; keep times[lo] < time <= times[hi]
+  int lo = 0, hi = n-1;
+  int guess = -1, step = 1;
+  if(times_even(times, n)){
+    guess = (long) (time - times[0]) * (n-1) / (times[n-1] - times[0]);
+  }
+  if(guess >= 0 && times[guess] < time){
+    for(; guess + step < n-1 && step <= TIME_GALLOP_MAX; step *= 2){
+      if(times[guess + step] >= time){
+        lo = guess + step/2;
+        hi = guess + step;
+        break;
+      }
+    }
+  }
+  else if(guess >= 0){
+    for(; guess - step > 0 && step <= TIME_GALLOP_MAX; step *= 2){
+      if(times[guess - step] < time){
+        lo = guess - step;
+        hi = guess - step/2;
+        break;
+      }
+    }
+  }
+  lo++;                                 // now answer in [lo, hi]
+  while(lo < hi){
+    int mid = lo + (hi - lo) / 2;
+    if(times[mid] < time){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
 // Plots a graphical representation of stock
 // information. First calculates and prints plot which is in the
 // following format:
@@ -269,78 +780,61 @@ int stock_load(stock_t *stock, char *filename){
 //   specifier %-5d to print integers: this aligns left and prints
 //   whitespace padding on the right to width 5. In a loop, one can
 //   advance by +5 each time a label is printed.
+//
+// The plot is drawn by stock_plot_columns() with one column per price
+// and written out in one piece.
 void stock_plot(stock_t *stock, int max_height, int start, int stop){
-  double range = stock->prices[stock->hi_index] - stock->prices[stock->lo_index];
-  double plot_step = range/max_height;
-  double bottom = stock->prices[stock->lo_index];
-
-  // plot data section 
-  printf("==PLOT DATA==\n");
-  printf("start/stop:  %d %d\n", start, stop);
-  printf("max_height:  %d\n", max_height);
-  printf("price range: %.2f\n", range);
-  printf("plot step:   %.2f\n", plot_step);
-
-  // Top portion of the plot
-  printf("           +");
-  for(int i=start; i < stop; i++){
-    if(i==stock->best_buy){
-      printf("B");
-    }
-    if(i==stock->best_sell){
-      printf("S");
-    }
-    if(i > stock->best_buy && i < stock->best_sell){
-      printf("=");
-    }
-    else if(i < stock->best_buy || i > stock->best_sell) {
-      printf("-");
-    }
-  }
-  printf("+\n");
+  stock_plot_cols(stock, max_height, start, stop, stop - start);
+}
 
-  //  main part of plot
-  for(int i = max_height; i > 0; i--){
-    printf("%10.2f ", (bottom + (i-1)*plot_step));
-    printf("|");
-    for(int j = start; j < stop; j++){
-      if(j == stock->hi_index){
-        printf("H");
-      }
-      else if((bottom + (i-1)*plot_step) <= stock->prices[j]){
-        if(j == stock->lo_index){
-        printf("L");
-        }
-        else{
-          printf("*");
-        } 
-      }
-      else{
-        printf(" ");
-      }
-    }
-    printf("|\n");
-  }
+// Same as stock_plot() but draws the prices from 'start' to 'stop'-1 in
+// at most 'max_cols' columns. If there are more prices than that, each
+// column covers an equal run of them showing their lowest and highest
+// prices, as described in stock_columns.c. Columns of more than one
+// price are read from the stock's min/max pyramid which takes
+// O(max_cols * log N) time however long the slice is; the pyramid is
+// built on first use unless it came with a binary stock file.
+void stock_plot_cols(stock_t *stock, int max_height, int start, int stop, int max_cols){
+  stock_plot_overlay(stock, max_height, start, stop, max_cols, NULL);
+}
 
-  // bottom portion of the plot
-  printf("           +");
-  for(int i = start; i < stop; i++){
-    if(i == 0 ||  i%5 == 0){
-      printf("^");
-    }
-    else{
-      printf("-");
+// Same as stock_plot_cols() but also draws the series 'overlay', one
+// value per price such as the rolling mean from stock_rolling(), as a
+// line of '~' over the prices. Each column shows the value at its last
+// price. 'overlay' may be NULL.
+void stock_plot_overlay(stock_t *stock, int max_height, int start, int stop, int max_cols,
+                        double *overlay){
+  stock_marks_t marks = {
+    stock->lo_index, stock->hi_index, stock->best_buy, stock->best_sell,
+    stock_price(stock, stock->lo_index), stock_price(stock, stock->hi_index),
+  };
+  stock_plot_marked(stock, &marks, max_height, start, stop, max_cols, overlay);
+}
+
+// Same as stock_plot_overlay() but marks the lo/hi and best buy/sell of
+// 'marks' rather than those of the whole stock, such as the stats of
+// the slice alone from stock_range()
+void stock_plot_marked(stock_t *stock, stock_marks_t *marks, int max_height, int start, int stop,
+                       int max_cols, double *overlay){
+  stock_columns_t cols;
+  stock_columns_init(&cols, start, max_cols, stop - start);
+  if(cols.width > 1 && stock->ticks != NULL){
+    stock_fixed_columns(stock, &cols, stop);
+  }
+  else if(cols.width > 1){
+    stock_pyramid_columns(stock, &cols, stop);
+  }
+  else{
+    for(int i=start; i < stop; i++){
+      stock_columns_add(&cols, stock_price(stock, i));
     }
   }
-  printf("+\n");
-
-  // printing values divisible by 5
-  printf("            ");
-  for(int i = start; i < stop; i++){
-    if(i == 0 ||  i%5 == 0){
-      printf("%-5d", i);
+  if(overlay != NULL){
+    cols.overlay = malloc(sizeof(double) * (cols.ncols + 1));
+    for(int c=0; c < cols.ncols; c++){
+      cols.overlay[c] = overlay[cols.cols[c].last];
     }
   }
-  return;
+  stock_plot_columns(&cols, marks, max_height);
+  stock_columns_free(&cols);
 }
-  
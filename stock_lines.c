@@ -0,0 +1,213 @@
+// stock_lines.c: finding the lines of a text buffer with SIMD newline
+// detection. A stock file has a short line per price, so going line
+// by line with memchr() pays a call for every 20 or so bytes. Here 16
+// (SSE2) or 32 (AVX2) bytes are compared against '\n' at once and the
+// results either tallied or turned into a bit mask walked with
+// count-trailing-zeros to list where lines start. The level is picked
+// for the running CPU on first use, as in stock_simd.c.
+//
+// stock_line_index() records the start of every line compactly: a
+// 64-bit offset per block of STOCK_LINES_BLOCK lines and a 32-bit
+// offset from it for each line, 4 bytes a line rather than 8. Any line
+// is then found in O(1), so a file can be split into equal numbers of
+// lines for parsing in parallel or read from the middle.
+
+#include <immintrin.h>
+#include <pthread.h>
+
+#include "stock.h"
+
+// Counts the newlines in data[0..len-1] one byte at a time; finishes
+// the tails of the vector kernels
+static long count_scalar(char *data, long len){
+  long lines = 0;
+  for(long i=0; i < len; i++){
+    lines += data[i] == '\n';
+  }
+  return lines;
+}
+
+// The vector counters subtract each compare result, -1 for a newline,
+// from per-byte tallies and only every 255 vectors add the tallies up
+// with a sum of absolute differences, before a byte could overflow
+static long count_sse2(char *data, long len){
+  __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+  long lines = 0, i = 0;
+  while(i + 16 <= len){
+    __m128i tally = zero;
+    for(int k=0; k < 255 && i + 16 <= len; k++, i += 16){
+      __m128i v = _mm_loadu_si128((__m128i *) (data + i));
+      tally = _mm_sub_epi8(tally, _mm_cmpeq_epi8(v, nl));
+    }
+    __m128i sums = _mm_sad_epu8(tally, zero);
+    lines += _mm_cvtsi128_si64(sums) + _mm_extract_epi16(sums, 4);
+  }
+  return lines + count_scalar(data + i, len - i);
+}
+
+// AVX2 kernel: two vectors per iteration into separate tallies
+__attribute__((target("avx2")))
+static long count_avx2(char *data, long len){
+  __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+  long lines = 0, i = 0;
+  while(i + 64 <= len){
+    __m256i ta = zero, tb = zero;
+    for(int k=0; k < 255 && i + 64 <= len; k++, i += 64){
+      __m256i a = _mm256_loadu_si256((__m256i *) (data + i));
+      __m256i b = _mm256_loadu_si256((__m256i *) (data + i + 32));
+      ta = _mm256_sub_epi8(ta, _mm256_cmpeq_epi8(a, nl));
+      tb = _mm256_sub_epi8(tb, _mm256_cmpeq_epi8(b, nl));
+    }
+    __m256i sums = _mm256_add_epi64(_mm256_sad_epu8(ta, zero), _mm256_sad_epu8(tb, zero));
+    lines += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+      _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+  }
+  _mm256_zeroupper();
+  return lines + count_sse2(data + i, len - i);
+}
+
+// Adds the start of the line after each newline in data[0..len-1] to
+// 'starts' as offsets from 'data' plus 'off', one byte at a time.
+// Returns the number added.
+static long starts_scalar(char *data, long len, long off, long *starts){
+  long n = 0;
+  for(long i=0; i < len; i++){
+    if(data[i] == '\n'){
+      starts[n++] = off + i + 1;
+    }
+  }
+  return n;
+}
+
+static long starts_sse2(char *data, long len, long off, long *starts){
+  __m128i nl = _mm_set1_epi8('\n');
+  long n = 0, i = 0;
+  for(; i + 16 <= len; i += 16){
+    __m128i v = _mm_loadu_si128((__m128i *) (data + i));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    while(mask != 0){
+      starts[n++] = off + i + __builtin_ctz(mask) + 1;
+      mask &= mask - 1;
+    }
+  }
+  return n + starts_scalar(data + i, len - i, off + i, starts + n);
+}
+
+__attribute__((target("avx2")))
+static long starts_avx2(char *data, long len, long off, long *starts){
+  __m256i nl = _mm256_set1_epi8('\n');
+  long n = 0, i = 0;
+  for(; i + 32 <= len; i += 32){
+    __m256i v = _mm256_loadu_si256((__m256i *) (data + i));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    while(mask != 0){
+      starts[n++] = off + i + __builtin_ctz(mask) + 1;
+      mask &= mask - 1;
+    }
+  }
+  _mm256_zeroupper();
+  return n + starts_sse2(data + i, len - i, off + i, starts + n);
+}
+
+typedef long (*count_kernel_t)(char *, long);
+typedef long (*starts_kernel_t)(char *, long, long, long *);
+
+static const count_kernel_t count_kernels[] = {
+  [STOCK_SIMD_SCALAR] = count_scalar,
+  [STOCK_SIMD_SSE2]   = count_sse2,
+  [STOCK_SIMD_AVX2]   = count_avx2,
+};
+static const starts_kernel_t starts_kernels[] = {
+  [STOCK_SIMD_SCALAR] = starts_scalar,
+  [STOCK_SIMD_SSE2]   = starts_sse2,
+  [STOCK_SIMD_AVX2]   = starts_avx2,
+};
+
+static int lines_level = -1;    // level in use, -1 until first chosen
+
+// Selects the instruction set level used by the functions here, at
+// most STOCK_SIMD_AVX2. Passing -1 picks the best level the CPU
+// supports. Returns the level now in use which is unchanged if
+// 'level' is not supported.
+int stock_lines_level(int level){
+  __builtin_cpu_init();
+  int best = __builtin_cpu_supports("avx2") ? STOCK_SIMD_AVX2 :
+    __builtin_cpu_supports("sse2") ? STOCK_SIMD_SSE2 : STOCK_SIMD_SCALAR;
+  if(level < 0){
+    level = best;
+  }
+  if(level <= best){
+    lines_level = level;
+  }
+  return lines_level;
+}
+
+// Level picked on first use unless already selected, once for all
+// threads as in stock_simd.c
+static pthread_once_t lines_once = PTHREAD_ONCE_INIT;
+
+static void lines_first_use(){
+  if(lines_level < 0){
+    stock_lines_level(-1);
+  }
+}
+
+// Number of '\n' characters in the 'len' bytes at 'data'
+long stock_count_newlines(char *data, long len){
+  pthread_once(&lines_once, lines_first_use);
+  return count_kernels[lines_level](data, len);
+}
+
+// Bytes scanned at a time by stock_line_index(), small enough that the
+// full offsets of one piece's lines stay in cache before being packed
+#define STOCK_LINES_PIECE (1 << 16)
+
+// Fills 'lines' with the start of every complete line, one ending in
+// '\n', of the 'len' bytes at 'data'. A trailing partial line is left
+// out as the stock loaders do. Returns 0 on success or -1 if a single
+// block of lines spans 4GB or more, which a 32-bit offset cannot
+// hold. Release 'lines' with stock_lines_free().
+int stock_line_index(stock_lines_t *lines, char *data, long len){
+  pthread_once(&lines_once, lines_first_use);
+  long count = stock_count_newlines(data, len);
+  lines->count = count;
+  lines->base = malloc(sizeof(long) * (count / STOCK_LINES_BLOCK + 1));
+  lines->delta = malloc(sizeof(uint32_t) * (count + 1));
+  lines->base[0] = 0;
+  lines->delta[0] = 0;
+  long *starts = malloc(sizeof(long) * (STOCK_LINES_PIECE + 1));
+  long n = 1;                   // starts recorded, line 0 at offset 0
+  for(long off = 0; off < len && n <= count; off += STOCK_LINES_PIECE){
+    long piece = len - off < STOCK_LINES_PIECE ? len - off : STOCK_LINES_PIECE;
+    long found = starts_kernels[lines_level](data + off, piece, off, starts);
+    for(long k=0; k < found; k++, n++){
+      if(n % STOCK_LINES_BLOCK == 0){
+        lines->base[n / STOCK_LINES_BLOCK] = starts[k];
+      }
+      long delta = starts[k] - lines->base[n / STOCK_LINES_BLOCK];
+      if(delta > UINT32_MAX){
+        free(starts);
+        stock_lines_free(lines);
+        return -1;
+      }
+      lines->delta[n] = delta;
+    }
+  }
+  free(starts);
+  return 0;
+}
+
+// Offset in the indexed buffer of the start of line 'i'. Line 'i' runs
+// up to and including the newline just before the start of line i+1;
+// the start of line 'count' is just past the last complete line.
+long stock_line_start(stock_lines_t *lines, long i){
+  return lines->base[i / STOCK_LINES_BLOCK] + lines->delta[i];
+}
+
+// De-allocates the arrays of 'lines'
+void stock_lines_free(stock_lines_t *lines){
+  free(lines->base);
+  free(lines->delta);
+  lines->base = NULL;
+  lines->delta = NULL;
+}
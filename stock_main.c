@@ -1,40 +1,303 @@
 // stock_main.c: Load a stock file and print it. 
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "stock.h"
 
+#define FOLLOW_POLL_MS 10       // how often --follow checks the file for new lines
+#define STREAM_COLS 100         // default plot width for --stream when --cols is not given
+
+// Prints a one line summary of 'stock' after new prices arrive
+static void print_update(stock_t *stock){
+  double profit = 0.0;
+  if(stock->best_buy >= 0){
+    profit = stock->prices[stock->best_sell] - stock->prices[stock->best_buy];
+  }
+  printf("count: %d last: %.2f lo: %d hi: %d best: %d %d profit: %.2f\n",
+         stock->count, stock->prices[stock->count-1], stock->lo_index,
+         stock->hi_index, stock->best_buy, stock->best_sell, profit);
+}
+
+// Implements --follow: loads what is in 'filename', prints it, then
+// polls the file and prints an updated summary whenever complete
+// lines are appended to it, much like 'tail -f'. Runs until killed.
+static int follow(char *filename){
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    printf("Could not open file '%s'\n", filename);
+    printf("Failed to load stock, exiting\n");
+    return 1;
+  }
+  stock_t *stock = stock_new();
+  stock->data_file = strdup(filename);
+  long offset = 0;
+  stock_load_appended(stock, fd, &offset);
+  stock_print(stock);
+  fflush(stdout);
+  struct timespec poll = {0, FOLLOW_POLL_MS * 1000000L};
+  while(1){
+    if(stock_load_appended(stock, fd, &offset) > 0){
+      print_update(stock);
+      fflush(stdout);
+    }
+    nanosleep(&poll, NULL);
+  }
+  stock_free(stock);
+  close(fd);
+  return 0;
+}
+
+// Converts the start/stop argument 'arg' to an index into 'stock'
+// stored in '*index'.
+// Plain numbers are indices; times of day like 09:30 or 09:30:15 are
+// looked up in the stock's times, giving the first price at or after
+// that time, or after it when 'after' is set so that a stop time is
+// included. Returns 0 on success; prints a message and returns -1 on
+// a bad time.
+static int slice_bound(stock_t *stock, char *arg, int after, int *index){
+  if(strchr(arg, ':') == NULL){
+    *index = atoi(arg);
+    return 0;
+  }
+  int time = stock_parse_time(arg);
+  if(time < 0){
+    printf("Bad time '%s'\n", arg);
+    return -1;
+  }
+  if(stock->times == NULL){
+    printf("No times in stock file, cannot slice at '%s'\n", arg);
+    return -1;
+  }
+  *index = stock_time_index(stock, time + after);
+  return 0;
+}
+
+// Implements --trades, --cooldown and --fee: prints the best set of
+// trades under those limits with stock_best_trades(), 'max_trades'
+// below 0 meaning no limit
+static void print_trades(stock_t *stock, int max_trades, int cooldown, double fee){
+  stock_trade_t *trades;
+  int ntrades;
+  double profit = stock_best_trades(stock, max_trades, cooldown, fee, &trades, &ntrades);
+  printf("==TRADES==\n");
+  if(max_trades < 0){
+    printf("max trades: unlimited\n");
+  }
+  else{
+    printf("max trades: %d\n", max_trades);
+  }
+  printf("cooldown:   %d\n", cooldown);
+  printf("fee:        %.2f\n", fee);
+  printf("trades:     %d\n", ntrades);
+  for(int t=0; t < ntrades; t++){
+    int b = trades[t].buy, s = trades[t].sell;
+    printf("  buy %5d at %8.2f  sell %5d at %8.2f  profit %8.2f\n",
+           b, stock->prices[b], s, stock->prices[s], stock->prices[s] - stock->prices[b] - fee);
+  }
+  printf("total profit: %.2f\n", profit);
+  free(trades);
+}
+
+// Implements --window: prints the rolling stats of 'roll' for the
+// prices 'start' to 'stop'-1, one line per price
+static void print_rolling(stock_t *stock, stock_rolling_t *roll, int start, int stop){
+  printf("==ROLLING==\n");
+  printf("window: %d\n", roll->window);
+  printf("%6s %8s %8s %8s %8s %8s %6s %6s %8s\n",
+         "index", "price", "lo", "hi", "mean", "stddev", "buy", "sell", "profit");
+  for(int i=start; i < stop; i++){
+    int b = roll->buy[i], s = roll->sell[i];
+    printf("%6d %8.2f %8.2f %8.2f %8.2f %8.2f %6d %6d %8.2f\n",
+           i, stock->prices[i], stock->prices[roll->lo[i]], stock->prices[roll->hi[i]],
+           roll->mean[i], roll->stddev[i], b, s,
+           b < 0 ? 0.0 : stock->prices[s] - stock->prices[b]);
+  }
+}
+
+// Implements --stream: analyzes and plots the file in one pass with
+// constant memory however large it is, the slice being downsampled to
+// at most 'cols' columns. 'start' and 'stop' must be indices.
+static int stream(char *filename, int max_height, char *start_arg, char *stop_arg, int cols){
+  long start = 0, stop = -1;
+  char *bounds[2] = {start_arg, stop_arg};
+  for(int b=0; b<2; b++){
+    if(bounds[b] != NULL && strchr(bounds[b], ':') != NULL){
+      printf("Time bounds need the loaded stock, not available with --stream\n");
+      return 1;
+    }
+  }
+  if(start_arg != NULL){
+    start = atol(start_arg);
+  }
+  if(stop_arg != NULL){
+    stop = atol(stop_arg);
+  }
+  stock_stream_t st;
+  if(stock_stream(&st, filename, start, stop, cols) == -1){
+    printf("Failed to load stock, exiting\n");
+    return 1;
+  }
+  if(st.marks.best_buy < 0){
+    printf("No viable buy/sell point\n");
+  }
+  stock_stream_print(&st);
+  stock_plot_columns(&st.columns, &st.marks, max_height);
+  stock_stream_free(&st);
+  return 0;
+}
+
 int main(int argc, char *argv[]){
-  if(argc < 3){
-    printf("usage: %s <stockfile> <max_width> [start] [stop]\n",argv[0]);
+  char *args[argc];             // command line with --options removed
+  int nargs = 0;
+  int threads = 1;              // --threads=N: load and analyze the file using N threads
+  int follow_file = 0;          // --follow: keep reading lines appended to the file
+  int local = 0;                // --local: plot a slice using the slice's own lo/hi/best
+  int streaming = 0;            // --stream: one pass over the file in constant memory
+  int cols = 0;                 // --cols=N: plot at most N columns, downsampling if needed
+  int trades = 0;               // --trades/--cooldown/--fee given: print the best trades
+  int max_trades = -1;          // --trades=N: at most N trades, 'all' for no limit
+  int cooldown = 0;             // --cooldown=N: prices to wait after a sell before buying
+  double fee = 0.0;             // --fee=X: paid for each trade
+  int window = 0;               // --window=W: rolling stats over W prices, mean drawn on the plot
+  int fixed = 0;                // --fixed: hold prices as int32 ticks when they are exact
+  int cache = 0;                // --cache: load through a binary sidecar of the parsed file
+  for(int i=0; i<argc; i++){
+    if(strncmp(argv[i], "--threads=", 10) == 0){
+      threads = atoi(argv[i] + 10);
+    }
+    else if(strcmp(argv[i], "--follow") == 0){
+      follow_file = 1;
+    }
+    else if(strcmp(argv[i], "--local") == 0){
+      local = 1;
+    }
+    else if(strcmp(argv[i], "--stream") == 0){
+      streaming = 1;
+    }
+    else if(strncmp(argv[i], "--cols=", 7) == 0){
+      cols = atoi(argv[i] + 7);
+    }
+    else if(strncmp(argv[i], "--trades=", 9) == 0){
+      trades = 1;
+      max_trades = strcmp(argv[i] + 9, "all") == 0 ? -1 : atoi(argv[i] + 9);
+    }
+    else if(strncmp(argv[i], "--cooldown=", 11) == 0){
+      trades = 1;
+      cooldown = atoi(argv[i] + 11);
+    }
+    else if(strncmp(argv[i], "--fee=", 6) == 0){
+      trades = 1;
+      fee = atof(argv[i] + 6);
+    }
+    else if(strncmp(argv[i], "--window=", 9) == 0){
+      window = atoi(argv[i] + 9);
+    }
+    else if(strcmp(argv[i], "--fixed") == 0){
+      fixed = 1;
+    }
+    else if(strcmp(argv[i], "--cache") == 0){
+      cache = 1;
+    }
+    else if(strncmp(argv[i], "--", 2) == 0){
+      printf("unknown option %s\n", argv[i]);
+      return 1;
+    }
+    else{
+      args[nargs++] = argv[i];
+    }
+  }
+  if(follow_file && nargs >= 2){
+    return follow(args[1]);
+  }
+  if(nargs < 3){
+    printf("usage: %s [--threads=N] [--local] [--cols=N] [--fixed] [--cache] <stockfile> <max_width> [start] [stop]\n",argv[0]);
+    printf("       start/stop are indices or times like 09:30, a stop time is included\n");
+    printf("       --trades=N|all --cooldown=N --fee=X print the best set of trades\n");
+    printf("       --window=W prints rolling stats of the slice and plots the rolling mean\n");
+    printf("       %s --stream [--cols=N] <stockfile> <max_width> [start] [stop]\n",argv[0]);
+    printf("       %s --follow <stockfile>\n",argv[0]);
     return 1;
   }
   
-  char *filename = argv[1];      // read filename from command line
-  int max_width = atoi(argv[2]); // read width from command line
+  char *filename = args[1];      // read filename from command line
+  int max_width = atoi(args[2]); // read width from command line
+  if(streaming){
+    return stream(filename, max_width, nargs > 3 ? args[3] : NULL, nargs > 4 ? args[4] : NULL,
+                  cols > 0 ? cols : STREAM_COLS);
+  }
+
+  if(fixed && (local || window > 0 || trades)){
+    // these work on doubles and would convert the ticks straight back
+    printf("--fixed is ignored with --local, --window and --trades\n");
+    fixed = 0;
+  }
 
   stock_t *stock = stock_new();
-  int ret = stock_load(stock, filename);
+  int ret = cache ? stock_load_cached(stock, filename, threads) :
+    stock_load_parallel(stock, filename, threads);
   if(ret == -1){
     printf("Failed to load stock, exiting\n");
     return 1;
   }
+  if(fixed && stock_fix(stock) == -1){
+    printf("Prices are not whole ten-thousandths, keeping doubles\n");
+  }
 
   int start = 0;                // default to printing whole 
   int stop = stock->count;      // range of stocks
-  if(argc > 3){                 
-    start = atoi(argv[3]);      // optional 3rd + 4th command line
-  }                             // args allow printing a slice of the
-  if(argc > 4){                 // the full stock range
-    stop = atoi(argv[4]);
+  ret = 0;
+  if(nargs > 3){                // optional 3rd + 4th command line
+    ret = slice_bound(stock, args[3], 0, &start); // args allow printing a slice of the
+  }                             // the full stock range
+  if(nargs > 4 && ret == 0){
+    ret = slice_bound(stock, args[4], 1, &stop);
   }
-
-  stock_set_hilo(stock);
-  ret = stock_set_best(stock);
   if(ret == -1){
+    stock_free(stock);
+    return 1;
+  }
+
+  if(stock->lo_index < 0){      // binary stock files come with their stats
+    stock_set_hilo_best_parallel(stock, threads);
+  }
+  if(stock->best_buy < 0){
     printf("No viable buy/sell point\n");
   }
 
   stock_print(stock);
-  stock_plot(stock, max_width, start, stop);
+  if(trades){
+    print_trades(stock, max_trades, cooldown, fee);
+  }
+  stock_rolling_t roll = {0};
+  double *overlay = NULL;
+  if(window > 0){
+    stock_rolling(stock, window, &roll);
+    print_rolling(stock, &roll, start, stop);
+    overlay = roll.mean;
+  }
+  if(local){
+    // plot with the extremes and best trade of the slice alone
+    stock_summary_t sum;
+    if(stock_range(stock, start, stop, &sum) == -1){
+      printf("No viable buy/sell point in the slice\n");
+    }
+    if(sum.lo < 0){
+      printf("Empty slice, nothing to plot\n");
+    }
+    else{
+      stock_marks_t marks = {
+        sum.lo, sum.hi, sum.buy, sum.sell,
+        stock_price(stock, sum.lo), stock_price(stock, sum.hi),
+      };
+      stock_plot_marked(stock, &marks, max_width, start, stop, cols > 0 ? cols : stop - start, overlay);
+    }
+  }
+  else{
+    stock_plot_overlay(stock, max_width, start, stop, cols > 0 ? cols : stop - start, overlay);
+  }
+  stock_rolling_free(&roll);
 
   stock_free(stock);
 
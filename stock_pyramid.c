@@ -0,0 +1,219 @@
+// stock_pyramid.c: a multi-resolution summary of a stock's prices for
+// drawing any slice at any zoom without going over its prices again.
+// Like the mipmaps of a texture, level 0 holds the lowest, highest,
+// first and last price of each block of STOCK_PYRAMID_BLOCK prices and
+// each further level halves the one below it by combining neighbors,
+// up to a single node for the whole stock.
+//
+// The lo/hi envelope of any slice [start, stop) comes from at most two
+// nodes per level plus the partial blocks at either end, so the
+// columns of a plot take O(columns * log N) time whatever the length
+// of the slice each one covers. The nodes take 2*32 bytes per block,
+// about 1 byte per price. The pyramid is built on first use by
+// stock_pyramid() and kept in the stock's 'pyramid' field or, for
+// binary stock files, written by stock_save_binary() and used straight
+// from the mapped file so it is never built at all.
+
+#include <math.h>
+
+#include "stock.h"
+
+#define STOCK_PYRAMID_BLOCK 64          // prices summarized by each level 0 node
+#define STOCK_PYRAMID_MAX_LEVELS 32     // more than enough for INT_MAX prices
+
+struct stock_pyramid {
+  int count;                            // number of prices covered
+  int levels;                           // number of levels, the last has one node
+  long level_off[STOCK_PYRAMID_MAX_LEVELS]; // index in nodes of each level's first node
+  long level_len[STOCK_PYRAMID_MAX_LEVELS]; // number of nodes in each level
+  stock_pyramid_node_t *nodes;          // all levels one after another, finest first
+  int owned;                            // 1 if nodes was allocated here, 0 if it is in a mapped file
+};
+
+// Summary of no prices, the identity for node_merge()
+static stock_pyramid_node_t empty_node(){
+  stock_pyramid_node_t none = {INFINITY, -INFINITY, 0.0, 0.0};
+  return none;
+}
+
+// Summary of the prices of 'left' followed by those of 'right'
+static stock_pyramid_node_t node_merge(stock_pyramid_node_t left, stock_pyramid_node_t right){
+  if(left.lo > left.hi){
+    return right;
+  }
+  if(right.lo > right.hi){
+    return left;
+  }
+  stock_pyramid_node_t node;
+  node.lo = right.lo < left.lo ? right.lo : left.lo;
+  node.hi = right.hi > left.hi ? right.hi : left.hi;
+  node.first = left.first;
+  node.last = right.last;
+  return node;
+}
+
+// Summary of prices[start..stop-1] by a scan with the SIMD kernel of
+// stock_argminmax()
+static stock_pyramid_node_t scan_node(double *prices, long start, long stop){
+  stock_pyramid_node_t node = empty_node();
+  if(stop <= start){
+    return node;
+  }
+  int lo, hi;
+  stock_argminmax(prices, start, stop, &lo, &hi);
+  node.lo = prices[lo];
+  node.hi = prices[hi];
+  node.first = prices[start];
+  node.last = prices[stop-1];
+  return node;
+}
+
+// Fills in the level offsets and lengths of 'pyr' for 'count' prices
+// and returns the total number of nodes
+static long pyramid_layout(struct stock_pyramid *pyr, long count){
+  pyr->count = count;
+  pyr->levels = 0;
+  long len = (count + STOCK_PYRAMID_BLOCK - 1) / STOCK_PYRAMID_BLOCK;
+  long off = 0;
+  while(len > 0){
+    pyr->level_off[pyr->levels] = off;
+    pyr->level_len[pyr->levels] = len;
+    pyr->levels++;
+    off += len;
+    len = len == 1 ? 0 : (len + 1) / 2;
+  }
+  return off;
+}
+
+// Number of nodes in the pyramid of 'count' prices, which
+// stock_pyramid_fill() needs room for
+long stock_pyramid_nodes(long count){
+  struct stock_pyramid pyr;
+  return pyramid_layout(&pyr, count);
+}
+
+// Computes the pyramid of the 'count' prices at 'prices' into 'nodes'
+// which must have room for stock_pyramid_nodes(count) nodes. This is
+// also the layout stock_save_binary() writes to binary stock files.
+void stock_pyramid_fill(double *prices, long count, stock_pyramid_node_t *nodes){
+  struct stock_pyramid pyr;
+  pyramid_layout(&pyr, count);
+  if(pyr.levels == 0){
+    return;
+  }
+  for(long b=0; b < pyr.level_len[0]; b++){
+    long start = b * STOCK_PYRAMID_BLOCK;
+    long stop = start + STOCK_PYRAMID_BLOCK < count ? start + STOCK_PYRAMID_BLOCK : count;
+    nodes[b] = scan_node(prices, start, stop);
+  }
+  for(int k=1; k < pyr.levels; k++){
+    stock_pyramid_node_t *below = nodes + pyr.level_off[k-1];
+    stock_pyramid_node_t *level = nodes + pyr.level_off[k];
+    for(long j=0; j < pyr.level_len[k]; j++){
+      level[j] = below[2*j];
+      if(2*j+1 < pyr.level_len[k-1]){
+        level[j] = node_merge(level[j], below[2*j+1]);
+      }
+    }
+  }
+}
+
+// Wraps the pyramid of 'count' prices at 'nodes', laid out as by
+// stock_pyramid_fill(), for use as a stock's 'pyramid' field. If 'copy'
+// is non-zero the nodes are copied into the heap, otherwise they are
+// used in place and must outlive the result, as for the nodes in a
+// mapped binary stock file.
+stock_pyramid_t *stock_pyramid_attach(stock_pyramid_node_t *nodes, long count, int copy){
+  stock_pyramid_t *pyr = malloc(sizeof(stock_pyramid_t));
+  long n = pyramid_layout(pyr, count);
+  pyr->owned = copy;
+  pyr->nodes = nodes;
+  if(copy){
+    pyr->nodes = malloc(sizeof(stock_pyramid_node_t) * (n > 0 ? n : 1));
+    memcpy(pyr->nodes, nodes, sizeof(stock_pyramid_node_t) * n);
+  }
+  return pyr;
+}
+
+// De-allocates a pyramid, leaving nodes in a mapped file alone
+void stock_pyramid_free(stock_pyramid_t *pyr){
+  if(pyr != NULL){
+    if(pyr->owned){
+      free(pyr->nodes);
+    }
+    free(pyr);
+  }
+}
+
+// Returns the pyramid of the prices of 'stock', building it if there
+// is none yet or prices were added since it was built
+stock_pyramid_t *stock_pyramid(stock_t *stock){
+  stock_unfix(stock);
+  if(stock->pyramid != NULL && stock->pyramid->count != stock->count){
+    stock_pyramid_free(stock->pyramid);
+    stock->pyramid = NULL;
+  }
+  if(stock->pyramid == NULL){
+    stock_pyramid_t *pyr = malloc(sizeof(stock_pyramid_t));
+    long n = pyramid_layout(pyr, stock->count);
+    pyr->owned = 1;
+    pyr->nodes = malloc(sizeof(stock_pyramid_node_t) * (n > 0 ? n : 1));
+    stock_pyramid_fill(stock->prices, stock->count, pyr->nodes);
+    stock->pyramid = pyr;
+  }
+  return stock->pyramid;
+}
+
+// Returns the lowest, highest, first and last of the prices 'start' to
+// 'stop'-1 of 'stock' using its pyramid, built if needed. Whole blocks
+// are combined from the coarsest levels that fit, working inwards from
+// both ends, and only the partial blocks at either end are scanned.
+// For an empty slice 'lo' is greater than 'hi'.
+stock_pyramid_node_t stock_pyramid_query(stock_t *stock, long start, long stop){
+  stock_unfix(stock);
+  if(start < 0){
+    start = 0;
+  }
+  if(stop > stock->count){
+    stop = stock->count;
+  }
+  long bstart = (start + STOCK_PYRAMID_BLOCK - 1) / STOCK_PYRAMID_BLOCK;
+  long bstop = stop / STOCK_PYRAMID_BLOCK;
+  if(bstart >= bstop){
+    return scan_node(stock->prices, start, stop);
+  }
+  stock_pyramid_t *pyr = stock_pyramid(stock);
+  stock_pyramid_node_t left = scan_node(stock->prices, start, bstart * STOCK_PYRAMID_BLOCK);
+  stock_pyramid_node_t right = scan_node(stock->prices, bstop * STOCK_PYRAMID_BLOCK, stop);
+  long l = bstart, r = bstop;
+  for(int k=0; l < r; k++){
+    stock_pyramid_node_t *level = pyr->nodes + pyr->level_off[k];
+    if(l & 1){
+      left = node_merge(left, level[l++]);
+    }
+    if(r & 1){
+      right = node_merge(level[--r], right);
+    }
+    l /= 2;
+    r /= 2;
+  }
+  return node_merge(left, right);
+}
+
+// Fills 'cols', set up by stock_columns_init() with the number of
+// prices known, with the columns for prices cols->start to 'stop'-1 of
+// 'stock' as stock_columns_add() would but by querying the pyramid
+// once per column rather than adding each price.
+void stock_pyramid_columns(stock_t *stock, stock_columns_t *cols, long stop){
+  cols->ncols = 0;
+  cols->count = stop - cols->start;
+  for(long first = cols->start; first < stop && cols->ncols < cols->max_cols; first += cols->width){
+    long last = first + cols->width < stop ? first + cols->width : stop;
+    stock_pyramid_node_t node = stock_pyramid_query(stock, first, last);
+    stock_column_t *col = &cols->cols[cols->ncols++];
+    col->first = first;
+    col->last = last - 1;
+    col->lo = node.lo;
+    col->hi = node.hi;
+  }
+}
@@ -0,0 +1,241 @@
+// stock_range.c: answers lo/hi/best buy-sell questions about any slice
+// [start, stop) of a stock's prices without rescanning it. The stats
+// of two adjacent slices combine into the stats of their union (see
+// stock_summary_merge()) so a segment tree whose nodes hold the stats
+// of power-of-two runs of blocks answers a query by merging
+// O(log N) nodes plus scanning the partial blocks at either end.
+//
+// Leaves summarize blocks of STOCK_RANGE_BLOCK prices rather than
+// single prices which keeps the tree to about 2 bytes per price while
+// adding at most two short block scans to each query. The tree is
+// built on first use by stock_range() and kept in the stock's 'range'
+// field; stock_push() discards it since appending changes the blocks.
+//
+// The same merge lets stock_set_hilo_best_parallel() split one long
+// array among threads: each summarizes a chunk and the summaries are
+// combined left to right.
+
+#include <pthread.h>
+
+#include "stock.h"
+
+#define STOCK_RANGE_BLOCK 16    // prices summarized by each leaf
+#define STOCK_PARALLEL_MIN 65536 // fewest prices per thread worth starting it for
+
+struct stock_range {
+  int count;                    // number of prices covered
+  int leaves;                   // number of leaves, a power of two
+  stock_summary_t *nodes;       // 2*leaves nodes, root at 1, node i has children 2i and 2i+1
+};
+
+// Summary of an empty slice, the identity for stock_summary_merge()
+static stock_summary_t empty_summary(){
+  stock_summary_t none = {-1, -1, -1, -1};
+  return none;
+}
+
+// Stats of prices[start..stop-1] by one pass with the same
+// tie-breaking as stock_set_hilo_best()
+static stock_summary_t scan_summary(double *prices, int start, int stop){
+  stock_summary_t sum = empty_summary();
+  if(stop <= start){
+    return sum;
+  }
+  double max_prof = 0.0;
+  int lo = start, hi = start;
+  for(int j=start+1; j < stop; j++){
+    if(prices[j] - prices[lo] > max_prof){
+      max_prof = prices[j] - prices[lo];
+      sum.buy = lo;
+      sum.sell = j;
+    }
+    if(prices[j] < prices[lo]){
+      lo = j;
+    }
+    if(prices[hi] < prices[j]){
+      hi = j;
+    }
+  }
+  sum.lo = lo;
+  sum.hi = hi;
+  return sum;
+}
+
+// Replaces the pair '*buy','*sell' (profit '*best') with 'b','s' if
+// that pair is more profitable or equally profitable and earlier:
+// lower buy index, then lower sell index
+static void better_pair(double *prices, int b, int s, double *best, int *buy, int *sell){
+  if(b < 0){
+    return;
+  }
+  double profit = prices[s] - prices[b];
+  if(profit > *best ||
+     (profit == *best && *buy >= 0 && (b < *buy || (b == *buy && s < *sell)))){
+    *best = profit;
+    *buy = b;
+    *sell = s;
+  }
+}
+
+// Combines the stats of slice 'left' with those of 'right' which must
+// immediately follow it. The lowest and highest prices are the more
+// extreme of the two sides, the left one on ties. The best trade is
+// either within one side or buys at the left's low and sells at the
+// right's high; on equal profit the pair with the earliest buy and
+// then earliest sell wins as in stock_set_best().
+stock_summary_t stock_summary_merge(double *prices, stock_summary_t left, stock_summary_t right){
+  if(left.lo < 0){
+    return right;
+  }
+  if(right.lo < 0){
+    return left;
+  }
+  stock_summary_t sum;
+  sum.lo = prices[right.lo] < prices[left.lo] ? right.lo : left.lo;
+  sum.hi = prices[left.hi] < prices[right.hi] ? right.hi : left.hi;
+  sum.buy = -1;
+  sum.sell = -1;
+  double best = 0.0;
+  better_pair(prices, left.buy, left.sell, &best, &sum.buy, &sum.sell);
+  if(prices[right.hi] - prices[left.lo] > 0){
+    better_pair(prices, left.lo, right.hi, &best, &sum.buy, &sum.sell);
+  }
+  better_pair(prices, right.buy, right.sell, &best, &sum.buy, &sum.sell);
+  return sum;
+}
+
+// Builds the segment tree over the prices of 'stock'
+static stock_range_t *range_build(stock_t *stock){
+  stock_range_t *range = malloc(sizeof(stock_range_t));
+  range->count = stock->count;
+  int blocks = (stock->count + STOCK_RANGE_BLOCK - 1) / STOCK_RANGE_BLOCK;
+  range->leaves = 1;
+  while(range->leaves < blocks){
+    range->leaves *= 2;
+  }
+  range->nodes = malloc(sizeof(stock_summary_t) * 2 * range->leaves);
+  for(int b=0; b < range->leaves; b++){
+    int start = b * STOCK_RANGE_BLOCK;
+    int stop = start + STOCK_RANGE_BLOCK < stock->count ? start + STOCK_RANGE_BLOCK : stock->count;
+    range->nodes[range->leaves + b] = scan_summary(stock->prices, start, stop);
+  }
+  for(int i = range->leaves-1; i >= 1; i--){
+    range->nodes[i] = stock_summary_merge(stock->prices, range->nodes[2*i], range->nodes[2*i+1]);
+  }
+  return range;
+}
+
+// De-allocates a range index
+void stock_range_free(stock_range_t *range){
+  if(range != NULL){
+    free(range->nodes);
+    free(range);
+  }
+}
+
+// Merged stats of whole blocks [bstart, bstop) from the tree, combining
+// nodes from both ends inwards so left-to-right order is kept
+static stock_summary_t range_blocks(stock_range_t *range, double *prices, int bstart, int bstop){
+  stock_summary_t left = empty_summary(), right = empty_summary();
+  int l = bstart + range->leaves, r = bstop + range->leaves;
+  while(l < r){
+    if(l & 1){
+      left = stock_summary_merge(prices, left, range->nodes[l++]);
+    }
+    if(r & 1){
+      right = stock_summary_merge(prices, range->nodes[--r], right);
+    }
+    l /= 2;
+    r /= 2;
+  }
+  return stock_summary_merge(prices, left, right);
+}
+
+// Computes the lowest/highest price and best buy/sell pair of the
+// slice prices[start] to prices[stop-1] of 'stock' into '*sum' with the
+// same results as running stock_set_hilo_best() on the slice alone
+// (indices are positions in the whole array). Takes O(log N) time
+// after a one time O(N) build of the index. Fields of '*sum' are -1
+// where there is no answer: all of them for an empty slice and
+// buy/sell when no trade in the slice is profitable. Returns 0 if
+// there is a profitable trade and -1 otherwise.
+int stock_range(stock_t *stock, int start, int stop, stock_summary_t *sum){
+  stock_unfix(stock);
+  if(start < 0){
+    start = 0;
+  }
+  if(stop > stock->count){
+    stop = stock->count;
+  }
+  if(stock->range != NULL && stock->range->count != stock->count){
+    stock_range_free(stock->range);        // prices were added since it was built
+    stock->range = NULL;
+  }
+  if(stock->range == NULL && stock->count > 0){
+    stock->range = range_build(stock);
+  }
+  int bstart = (start + STOCK_RANGE_BLOCK - 1) / STOCK_RANGE_BLOCK;
+  int bstop = stop / STOCK_RANGE_BLOCK;
+  if(bstart >= bstop){
+    *sum = scan_summary(stock->prices, start, stop);
+  }
+  else{
+    double *prices = stock->prices;
+    *sum = scan_summary(prices, start, bstart * STOCK_RANGE_BLOCK);
+    *sum = stock_summary_merge(prices, *sum, range_blocks(stock->range, prices, bstart, bstop));
+    *sum = stock_summary_merge(prices, *sum, scan_summary(prices, bstop * STOCK_RANGE_BLOCK, stop));
+  }
+  return sum->buy < 0 ? -1 : 0;
+}
+
+// One thread's share of stock_set_hilo_best_parallel()
+typedef struct {
+  double *prices;
+  int start, stop;              // the chunk prices[start..stop-1]
+  stock_summary_t sum;          // its stats
+} best_chunk_t;
+
+static void *best_chunk(void *arg){
+  best_chunk_t *chunk = arg;
+  chunk->sum = scan_summary(chunk->prices, chunk->start, chunk->stop);
+  return NULL;
+}
+
+// Same as stock_set_hilo_best() but the prices are split into
+// 'nthreads' equal chunks, each summarized by its own thread, and the
+// summaries combined in order with stock_summary_merge(). The result,
+// ties included, is exactly that of stock_set_hilo_best() which this
+// calls for 'nthreads' of 1 or less and when there are too few prices
+// to be worth splitting.
+int stock_set_hilo_best_parallel(stock_t *stock, int nthreads){
+  if(stock->ticks != NULL){
+    nthreads = 1;               // the fixed-point kernel is serial
+  }
+  if(nthreads > stock->count / STOCK_PARALLEL_MIN){
+    nthreads = stock->count / STOCK_PARALLEL_MIN;
+  }
+  if(nthreads <= 1){
+    return stock_set_hilo_best(stock);
+  }
+  best_chunk_t chunks[nthreads];
+  pthread_t threads[nthreads];
+  for(int t=0; t < nthreads; t++){
+    chunks[t].prices = stock->prices;
+    chunks[t].start = (long) stock->count * t / nthreads;
+    chunks[t].stop = (long) stock->count * (t+1) / nthreads;
+    if(t > 0){
+      pthread_create(&threads[t], NULL, best_chunk, &chunks[t]);
+    }
+  }
+  best_chunk(&chunks[0]);
+  stock_summary_t sum = chunks[0].sum;
+  for(int t=1; t < nthreads; t++){
+    pthread_join(threads[t], NULL);
+    sum = stock_summary_merge(stock->prices, sum, chunks[t].sum);
+  }
+  stock->lo_index = sum.lo;
+  stock->hi_index = sum.hi;
+  stock->best_buy = sum.buy;
+  stock->best_sell = sum.sell;
+  return sum.buy < 0 ? -1 : 0;
+}
@@ -0,0 +1,169 @@
+// stock_rolling.c: statistics of a window of the last W prices at
+// every point of a stock in one pass: the rolling low and high, mean
+// and standard deviation and the best buy/sell trade within the
+// window. Rescanning every window would be O(N * W); each of these is
+// updated in O(1) amortized time as the window slides.
+//
+// - Low and high use monotonic deques of indices. A new price first
+//   removes every later-arriving worse candidate from the back, so the
+//   deque's prices only rise (for the low) and its front is the
+//   window's lowest price, the earliest on ties.
+//
+// - Mean and variance keep a running mean and sum of squared
+//   differences, updated as one price enters and another leaves. The
+//   updates slowly pick up rounding error so the sums are recomputed
+//   exactly every W prices, which costs O(1) per price.
+//
+// - The best trade uses the summaries of stock_range.c which merge
+//   associatively, in a queue made of two stacks. New prices are
+//   folded into the back stack's summary. The front stack keeps the
+//   summary of each of its prices to the end of the stack so the
+//   oldest can be dropped; when it runs out the back stack is turned
+//   into a new front stack in one O(W) sweep, once per W prices.
+
+#include <math.h>
+
+#include "stock.h"
+
+// Summary of the single price at index 'i'
+static stock_summary_t single(int i){
+  stock_summary_t sum = {i, i, -1, -1};
+  return sum;
+}
+
+// Position after / before 'k' in a ring of 'window' slots. Wrapping by
+// a compare rather than '%' keeps a division off every deque step.
+static int ring_next(int k, int window){
+  return k+1 == window ? 0 : k+1;
+}
+
+static int ring_prev(int k, int window){
+  return k == 0 ? window-1 : k-1;
+}
+
+// Fills 'roll' with the stats of the 'window' prices ending at each
+// index of 'stock', or all the prices so far for the first window-1
+// indices. Returns 0 on success or -1 if 'window' is less than 1.
+// Release 'roll' with stock_rolling_free().
+int stock_rolling(stock_t *stock, int window, stock_rolling_t *roll){
+  memset(roll, 0, sizeof(*roll));
+  if(window < 1){
+    return -1;
+  }
+  stock_unfix(stock);
+  int n = stock->count > 0 ? stock->count : 0;
+  double *prices = stock->prices;
+  roll->window = window;
+  roll->count = n;
+  roll->lo = malloc(sizeof(int) * (n + 1));
+  roll->hi = malloc(sizeof(int) * (n + 1));
+  roll->mean = malloc(sizeof(double) * (n + 1));
+  roll->stddev = malloc(sizeof(double) * (n + 1));
+  roll->buy = malloc(sizeof(int) * (n + 1));
+  roll->sell = malloc(sizeof(int) * (n + 1));
+
+  int *lo_q = malloc(sizeof(int) * window), *hi_q = malloc(sizeof(int) * window);
+  int lo_head = 0, lo_tail = 0, lo_size = 0; // deques run from head up to tail-1 around the ring
+  int hi_head = 0, hi_tail = 0, hi_size = 0;
+  double mean = 0.0, m2 = 0.0;
+  long exact_at = window;               // next index at which the sums are recomputed
+  stock_summary_t *front = malloc(sizeof(stock_summary_t) * window); // front[j % window]: summary of j..back_start-1
+  int front_start = 0, back_start = 0;
+  int front_pos = 0;                    // front_start % window
+  stock_summary_t back = {-1, -1, -1, -1};
+
+  for(int i=0; i < n; i++){
+    double p = prices[i];
+    int first = i - window + 1;         // first index in the window
+    int leaving = first - 1;            // index that just left it, if >= 0
+
+    while(lo_size > 0 && prices[lo_q[ring_prev(lo_tail, window)]] > p){
+      lo_tail = ring_prev(lo_tail, window);
+      lo_size--;
+    }
+    if(lo_size > 0 && lo_q[lo_head] <= leaving){
+      lo_head = ring_next(lo_head, window);
+      lo_size--;
+    }
+    lo_q[lo_tail] = i;
+    lo_tail = ring_next(lo_tail, window);
+    lo_size++;
+    while(hi_size > 0 && prices[hi_q[ring_prev(hi_tail, window)]] < p){
+      hi_tail = ring_prev(hi_tail, window);
+      hi_size--;
+    }
+    if(hi_size > 0 && hi_q[hi_head] <= leaving){
+      hi_head = ring_next(hi_head, window);
+      hi_size--;
+    }
+    hi_q[hi_tail] = i;
+    hi_tail = ring_next(hi_tail, window);
+    hi_size++;
+    roll->lo[i] = lo_q[lo_head];
+    roll->hi[i] = hi_q[hi_head];
+
+    if(leaving < 0){                    // window still filling
+      double delta = p - mean;
+      mean += delta / (i + 1);
+      m2 += delta * (p - mean);
+    }
+    else if(i == exact_at){             // recompute exactly now and then
+      exact_at += window;
+      mean = 0.0;
+      for(int j=first; j <= i; j++){
+        mean += prices[j];
+      }
+      mean /= window;
+      m2 = 0.0;
+      for(int j=first; j <= i; j++){
+        m2 += (prices[j] - mean) * (prices[j] - mean);
+      }
+    }
+    else{
+      double old = prices[leaving], old_mean = mean;
+      mean += (p - old) / window;
+      m2 += (p - old) * (p - mean + old - old_mean);
+    }
+    int size = leaving < 0 ? i + 1 : window;
+    roll->mean[i] = mean;
+    roll->stddev[i] = m2 > 0 ? sqrt(m2 / size) : 0.0;
+
+    if(leaving >= 0){
+      if(front_start == back_start){    // front empty: turn the back into the front
+        int pos = (i-1) % window;       // once per W prices
+        stock_summary_t suffix = single(i-1);
+        front[pos] = suffix;
+        for(int j = i-2; j >= back_start; j--){
+          pos = ring_prev(pos, window);
+          suffix = stock_summary_merge(prices, single(j), suffix);
+          front[pos] = suffix;
+        }
+        back_start = i;
+        back = (stock_summary_t) {-1, -1, -1, -1};
+      }
+      front_start++;                    // drop 'leaving'
+      front_pos = ring_next(front_pos, window);
+    }
+    back = stock_summary_merge(prices, back, single(i));
+    stock_summary_t sum = back;
+    if(front_start < back_start){
+      sum = stock_summary_merge(prices, front[front_pos], back);
+    }
+    roll->buy[i] = sum.buy;
+    roll->sell[i] = sum.sell;
+  }
+  free(lo_q);
+  free(hi_q);
+  free(front);
+  return 0;
+}
+
+// De-allocates the arrays of 'roll'
+void stock_rolling_free(stock_rolling_t *roll){
+  free(roll->lo);
+  free(roll->hi);
+  free(roll->mean);
+  free(roll->stddev);
+  free(roll->buy);
+  free(roll->sell);
+}
@@ -0,0 +1,243 @@
+// stock_simd.c: vectorized argmin/argmax over price arrays. The
+// kernel is written for several instruction set levels and the best
+// one the running CPU supports is picked on first use, so the same
+// binary runs everywhere. All levels give identical results to the
+// simple scalar loop: ties for the lowest or highest price go to the
+// earliest index.
+//
+// Each vector lane keeps its own running min and max along with the
+// index where it was found, updated with strict comparisons so a lane
+// keeps its earliest index. Indices are carried as doubles (exact up
+// to 2^53) so the same blend operations move prices and indices. At
+// the end the lanes are combined, breaking ties by index.
+//
+// The AVX kernels finish short tails with plain SSE code. Running that
+// while the upper halves of the ymm registers are dirty stalls, and
+// GCC leaves out the usual vzeroupper before a tail call, so each AVX
+// kernel calls _mm256_zeroupper() itself before handing over. The
+// kernels of stock_lines.c and stock_fixed.c do the same.
+
+#include <immintrin.h>
+#include <pthread.h>
+
+#include "stock.h"
+
+// Combines a candidate lane result into the running result: 'val' at
+// index 'idx' replaces the current one if it is more extreme or equal
+// and earlier. 'sign' is 1 for min and -1 for max.
+static void merge_lane(double val, long idx, double *best, long *best_idx, int sign){
+  if(*best_idx < 0 || sign * val < sign * *best || (val == *best && idx < *best_idx)){
+    *best = val;
+    *best_idx = idx;
+  }
+}
+
+// Scalar kernel over prices[start..stop-1]; also finishes the tails
+// of the vector kernels
+static void argminmax_scalar(double *prices, long start, long stop,
+                             double *lo, long *lo_idx, double *hi, long *hi_idx){
+  for(long i=start; i < stop; i++){
+    merge_lane(prices[i], i, lo, lo_idx, 1);
+    merge_lane(prices[i], i, hi, hi_idx, -1);
+  }
+}
+
+// SSE2 kernel: 2 lanes; SSE2 lacks a blend instruction so selection
+// is done with and/andnot/or
+static void argminmax_sse2(double *prices, long start, long stop,
+                           double *lo, long *lo_idx, double *hi, long *hi_idx){
+  long i = start;
+  if(stop - start >= 2){
+    __m128d vlo = _mm_loadu_pd(&prices[i]), vhi = vlo;
+    __m128d ilo = _mm_set_pd(i+1, i), ihi = ilo;
+    __m128d idx = ilo, step = _mm_set1_pd(2);
+    for(i += 2; i + 2 <= stop; i += 2){
+      __m128d x = _mm_loadu_pd(&prices[i]);
+      idx = _mm_add_pd(idx, step);
+      __m128d lt = _mm_cmplt_pd(x, vlo);
+      __m128d gt = _mm_cmplt_pd(vhi, x);
+      vlo = _mm_or_pd(_mm_and_pd(lt, x), _mm_andnot_pd(lt, vlo));
+      ilo = _mm_or_pd(_mm_and_pd(lt, idx), _mm_andnot_pd(lt, ilo));
+      vhi = _mm_or_pd(_mm_and_pd(gt, x), _mm_andnot_pd(gt, vhi));
+      ihi = _mm_or_pd(_mm_and_pd(gt, idx), _mm_andnot_pd(gt, ihi));
+    }
+    double v[2], ix[2];
+    _mm_storeu_pd(v, vlo);
+    _mm_storeu_pd(ix, ilo);
+    for(int k=0; k<2; k++){
+      merge_lane(v[k], (long) ix[k], lo, lo_idx, 1);
+    }
+    _mm_storeu_pd(v, vhi);
+    _mm_storeu_pd(ix, ihi);
+    for(int k=0; k<2; k++){
+      merge_lane(v[k], (long) ix[k], hi, hi_idx, -1);
+    }
+  }
+  argminmax_scalar(prices, i, stop, lo, lo_idx, hi, hi_idx);
+}
+
+// AVX2 kernel: 4 lanes, two vectors per iteration into separate
+// accumulators to overlap the compare/blend latency
+__attribute__((target("avx2")))
+static void argminmax_avx2(double *prices, long start, long stop,
+                           double *lo, long *lo_idx, double *hi, long *hi_idx){
+  long i = start;
+  if(stop - start >= 8){
+    __m256d vlo0 = _mm256_loadu_pd(&prices[i]), vhi0 = vlo0;
+    __m256d vlo1 = _mm256_loadu_pd(&prices[i+4]), vhi1 = vlo1;
+    __m256d ilo0 = _mm256_set_pd(i+3, i+2, i+1, i), ihi0 = ilo0;
+    __m256d ilo1 = _mm256_set_pd(i+7, i+6, i+5, i+4), ihi1 = ilo1;
+    __m256d idx0 = ilo0, idx1 = ilo1, step = _mm256_set1_pd(8);
+    for(i += 8; i + 8 <= stop; i += 8){
+      __m256d x0 = _mm256_loadu_pd(&prices[i]);
+      __m256d x1 = _mm256_loadu_pd(&prices[i+4]);
+      idx0 = _mm256_add_pd(idx0, step);
+      idx1 = _mm256_add_pd(idx1, step);
+      __m256d lt0 = _mm256_cmp_pd(x0, vlo0, _CMP_LT_OQ);
+      __m256d lt1 = _mm256_cmp_pd(x1, vlo1, _CMP_LT_OQ);
+      __m256d gt0 = _mm256_cmp_pd(vhi0, x0, _CMP_LT_OQ);
+      __m256d gt1 = _mm256_cmp_pd(vhi1, x1, _CMP_LT_OQ);
+      vlo0 = _mm256_blendv_pd(vlo0, x0, lt0);
+      vlo1 = _mm256_blendv_pd(vlo1, x1, lt1);
+      ilo0 = _mm256_blendv_pd(ilo0, idx0, lt0);
+      ilo1 = _mm256_blendv_pd(ilo1, idx1, lt1);
+      vhi0 = _mm256_blendv_pd(vhi0, x0, gt0);
+      vhi1 = _mm256_blendv_pd(vhi1, x1, gt1);
+      ihi0 = _mm256_blendv_pd(ihi0, idx0, gt0);
+      ihi1 = _mm256_blendv_pd(ihi1, idx1, gt1);
+    }
+    double v[8], ix[8];
+    _mm256_storeu_pd(v, vlo0);
+    _mm256_storeu_pd(v+4, vlo1);
+    _mm256_storeu_pd(ix, ilo0);
+    _mm256_storeu_pd(ix+4, ilo1);
+    for(int k=0; k<8; k++){
+      merge_lane(v[k], (long) ix[k], lo, lo_idx, 1);
+    }
+    _mm256_storeu_pd(v, vhi0);
+    _mm256_storeu_pd(v+4, vhi1);
+    _mm256_storeu_pd(ix, ihi0);
+    _mm256_storeu_pd(ix+4, ihi1);
+    for(int k=0; k<8; k++){
+      merge_lane(v[k], (long) ix[k], hi, hi_idx, -1);
+    }
+  }
+  _mm256_zeroupper();
+  argminmax_scalar(prices, i, stop, lo, lo_idx, hi, hi_idx);
+}
+
+// AVX-512 kernel: 8 lanes, two vectors per iteration, selection with
+// mask registers
+__attribute__((target("avx512f")))
+static void argminmax_avx512(double *prices, long start, long stop,
+                             double *lo, long *lo_idx, double *hi, long *hi_idx){
+  long i = start;
+  if(stop - start >= 16){
+    __m512d vlo0 = _mm512_loadu_pd(&prices[i]), vhi0 = vlo0;
+    __m512d vlo1 = _mm512_loadu_pd(&prices[i+8]), vhi1 = vlo1;
+    __m512d ilo0 = _mm512_set_pd(i+7, i+6, i+5, i+4, i+3, i+2, i+1, i), ihi0 = ilo0;
+    __m512d ilo1 = _mm512_add_pd(ilo0, _mm512_set1_pd(8)), ihi1 = ilo1;
+    __m512d idx0 = ilo0, idx1 = ilo1, step = _mm512_set1_pd(16);
+    for(i += 16; i + 16 <= stop; i += 16){
+      __m512d x0 = _mm512_loadu_pd(&prices[i]);
+      __m512d x1 = _mm512_loadu_pd(&prices[i+8]);
+      idx0 = _mm512_add_pd(idx0, step);
+      idx1 = _mm512_add_pd(idx1, step);
+      __mmask8 lt0 = _mm512_cmp_pd_mask(x0, vlo0, _CMP_LT_OQ);
+      __mmask8 lt1 = _mm512_cmp_pd_mask(x1, vlo1, _CMP_LT_OQ);
+      __mmask8 gt0 = _mm512_cmp_pd_mask(vhi0, x0, _CMP_LT_OQ);
+      __mmask8 gt1 = _mm512_cmp_pd_mask(vhi1, x1, _CMP_LT_OQ);
+      vlo0 = _mm512_mask_mov_pd(vlo0, lt0, x0);
+      vlo1 = _mm512_mask_mov_pd(vlo1, lt1, x1);
+      ilo0 = _mm512_mask_mov_pd(ilo0, lt0, idx0);
+      ilo1 = _mm512_mask_mov_pd(ilo1, lt1, idx1);
+      vhi0 = _mm512_mask_mov_pd(vhi0, gt0, x0);
+      vhi1 = _mm512_mask_mov_pd(vhi1, gt1, x1);
+      ihi0 = _mm512_mask_mov_pd(ihi0, gt0, idx0);
+      ihi1 = _mm512_mask_mov_pd(ihi1, gt1, idx1);
+    }
+    double v[16], ix[16];
+    _mm512_storeu_pd(v, vlo0);
+    _mm512_storeu_pd(v+8, vlo1);
+    _mm512_storeu_pd(ix, ilo0);
+    _mm512_storeu_pd(ix+8, ilo1);
+    for(int k=0; k<16; k++){
+      merge_lane(v[k], (long) ix[k], lo, lo_idx, 1);
+    }
+    _mm512_storeu_pd(v, vhi0);
+    _mm512_storeu_pd(v+8, vhi1);
+    _mm512_storeu_pd(ix, ihi0);
+    _mm512_storeu_pd(ix+8, ihi1);
+    for(int k=0; k<16; k++){
+      merge_lane(v[k], (long) ix[k], hi, hi_idx, -1);
+    }
+  }
+  _mm256_zeroupper();
+  argminmax_scalar(prices, i, stop, lo, lo_idx, hi, hi_idx);
+}
+
+typedef void (*argminmax_func_t)(double *prices, long start, long stop,
+                                 double *lo, long *lo_idx, double *hi, long *hi_idx);
+
+static argminmax_func_t kernels[] = {
+  [STOCK_SIMD_SCALAR] = argminmax_scalar,
+  [STOCK_SIMD_SSE2]   = argminmax_sse2,
+  [STOCK_SIMD_AVX2]   = argminmax_avx2,
+  [STOCK_SIMD_AVX512] = argminmax_avx512,
+};
+
+static int simd_level = -1;     // level in use, -1 until first chosen
+
+// Returns 1 if the running CPU can execute kernels of 'level'
+static int simd_supported(int level){
+  __builtin_cpu_init();
+  switch(level){
+    case STOCK_SIMD_SCALAR: return 1;
+    case STOCK_SIMD_SSE2:   return __builtin_cpu_supports("sse2");
+    case STOCK_SIMD_AVX2:   return __builtin_cpu_supports("avx2");
+    case STOCK_SIMD_AVX512: return __builtin_cpu_supports("avx512f");
+  }
+  return 0;
+}
+
+// Selects the instruction set level used by stock_argminmax(). Passing
+// -1 picks the best level the CPU supports. Returns the level now in
+// use which is unchanged if 'level' is not supported.
+int stock_simd_level(int level){
+  if(level < 0){
+    for(level = STOCK_SIMD_AVX512; !simd_supported(level); level--);
+  }
+  if(level <= STOCK_SIMD_AVX512 && simd_supported(level)){
+    simd_level = level;
+  }
+  return simd_level;
+}
+
+// The first stock_argminmax() picks the best level unless one was
+// selected already. Going through pthread_once() keeps threads that
+// analyze stocks at the same time, as stock_batch does, from racing to
+// set 'simd_level'.
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+static void simd_first_use(){
+  if(simd_level < 0){
+    stock_simd_level(-1);
+  }
+}
+
+// Finds the positions of the lowest and highest prices among
+// prices[start] to prices[stop-1] and stores them in '*lo' and '*hi';
+// ties go to the earliest index. The min and max prices are then
+// prices[*lo] and prices[*hi]. Leaves '*lo' and '*hi' unchanged if the
+// range is empty.
+void stock_argminmax(double *prices, int start, int stop, int *lo, int *hi){
+  if(stop <= start){
+    return;
+  }
+  pthread_once(&simd_once, simd_first_use);
+  double lo_val = 0, hi_val = 0;
+  long lo_idx = -1, hi_idx = -1;
+  kernels[simd_level](prices, start, stop, &lo_val, &lo_idx, &hi_val, &hi_idx);
+  *lo = lo_idx;
+  *hi = hi_idx;
+}
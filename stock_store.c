@@ -0,0 +1,206 @@
+// stock_store.c: many stocks kept in memory and found by ticker symbol
+// rather than by scanning an array of stock_t's for a name. Tickers
+// are keys of a cuckoo hash map whose pointer values are the entries
+// below, so a lookup costs about two cache lines whatever the number
+// of tickers.
+//
+// A ticker is added with the name of its stock file and the file is
+// only loaded, with its stats computed, the first time the stock is
+// asked for. Loaded stocks sit on a list from most to least recently
+// used. When the memory they take goes over the store's budget the
+// least recently used are freed until it fits again and are loaded
+// again if asked for later. An entry keeps the stats of its stock
+// once loaded so lo/hi and best buy/sell by ticker never need a reload.
+
+#include "stock_store.h"
+
+#define STOCK_STORE_BUCKETS 64  // cuckoo buckets to start with, the map grows as needed
+
+struct stock_store_entry {
+  char *filename;               // stock file loaded on demand
+  stock_t *stock;               // the loaded stock, NULL if not loaded now
+  long bytes;                   // memory taken by 'stock' while loaded
+  int has_stats;                // 1 once 'stats' have been filled in by a load
+  stock_store_stats_t stats;    // stats of the stock
+  stock_store_entry_t *newer;   // neighbors on the store's list of loaded stocks
+  stock_store_entry_t *older;
+};
+
+// Initializes an empty 'store' which keeps at most 'budget' bytes of
+// stocks loaded, 0 for no limit. Release it with stock_store_free().
+void stock_store_init(stock_store_t *store, long budget){
+  memset(store, 0, sizeof(*store));
+  hashmap_init_engine(&store->map, STOCK_STORE_BUCKETS, HASHMAP_CUCKOO);
+  store->budget = budget > 0 ? budget : 0;
+}
+
+// Memory taken by a loaded stock: its mapped file or its prices and
+// times. Range indices and pyramids built later are not counted.
+static long stock_bytes(stock_t *stock){
+  if(stock->map != NULL){
+    return sizeof(stock_t) + stock->map_size;
+  }
+  long per_price = sizeof(double) + (stock->times != NULL ? sizeof(int) : 0);
+  return sizeof(stock_t) + per_price * stock->capacity;
+}
+
+// Takes 'entry' off the list of loaded stocks
+static void lru_unlink(stock_store_t *store, stock_store_entry_t *entry){
+  if(entry->newer != NULL){
+    entry->newer->older = entry->older;
+  }
+  else{
+    store->newest = entry->older;
+  }
+  if(entry->older != NULL){
+    entry->older->newer = entry->newer;
+  }
+  else{
+    store->oldest = entry->newer;
+  }
+  entry->newer = entry->older = NULL;
+}
+
+// Puts 'entry' at the most recently used end of the list
+static void lru_push(stock_store_t *store, stock_store_entry_t *entry){
+  entry->older = store->newest;
+  entry->newer = NULL;
+  if(store->newest != NULL){
+    store->newest->newer = entry;
+  }
+  else{
+    store->oldest = entry;
+  }
+  store->newest = entry;
+}
+
+// Frees the stock of a loaded 'entry' and takes it off the list
+static void unload(stock_store_t *store, stock_store_entry_t *entry){
+  lru_unlink(store, entry);
+  stock_free(entry->stock);
+  entry->stock = NULL;
+  store->bytes -= entry->bytes;
+  entry->bytes = 0;
+}
+
+// Loads the stock of 'entry', computes its stats and makes room for
+// it by unloading the least recently used stocks. A single stock
+// bigger than the budget is still loaded. Returns 0 on success or -1
+// if the file cannot be loaded, leaving 'entry' unloaded.
+static int load(stock_store_t *store, stock_store_entry_t *entry){
+  stock_t *stock = stock_new();
+  if(stock_load(stock, entry->filename) != 0){
+    stock_free(stock);
+    return -1;
+  }
+  if(stock->lo_index < 0){      // binary stock files come with their stats
+    stock_set_hilo_best(stock);
+  }
+  stock_store_stats_t *stats = &entry->stats;
+  stats->count = stock->count;
+  stats->lo_index = stock->count > 0 ? stock->lo_index : -1;
+  stats->hi_index = stock->count > 0 ? stock->hi_index : -1;
+  stats->best_buy = stock->best_buy;
+  stats->best_sell = stock->best_sell;
+  stats->lo_price = stats->lo_index >= 0 ? stock_price(stock, stats->lo_index) : 0.0;
+  stats->hi_price = stats->hi_index >= 0 ? stock_price(stock, stats->hi_index) : 0.0;
+  stats->buy_price = stats->best_buy >= 0 ? stock_price(stock, stats->best_buy) : 0.0;
+  stats->sell_price = stats->best_sell >= 0 ? stock_price(stock, stats->best_sell) : 0.0;
+  entry->has_stats = 1;
+
+  entry->stock = stock;
+  entry->bytes = stock_bytes(stock);
+  store->bytes += entry->bytes;
+  store->loads++;
+  lru_push(store, entry);
+  while(store->budget > 0 && store->bytes > store->budget && store->oldest != entry){
+    unload(store, store->oldest);
+    store->evictions++;
+  }
+  return 0;
+}
+
+// Adds 'ticker' to 'store' with the stock file 'filename', which is
+// not loaded until the stock is asked for. Adding a ticker again
+// replaces its file, dropping the stock and stats of the old one.
+// Returns 0 on success or -1 if the ticker is too long for a hash map
+// key.
+int stock_store_add(stock_store_t *store, char *ticker, char *filename){
+  if(strlen(ticker) >= sizeof(((hashnode_t *) NULL)->key)){
+    printf("Ticker '%s' is too long\n", ticker);
+    return -1;
+  }
+  stock_store_entry_t *entry = hashmap_get_ptr(&store->map, ticker);
+  if(entry == NULL){
+    entry = calloc(1, sizeof(stock_store_entry_t));
+    hashmap_put_ptr(&store->map, ticker, entry);
+  }
+  else{
+    if(entry->stock != NULL){
+      unload(store, entry);
+    }
+    free(entry->filename);
+    entry->has_stats = 0;
+  }
+  entry->filename = strdup(filename);
+  return 0;
+}
+
+// Returns the stock of 'ticker', loading it if it is not loaded now
+// and marking it most recently used. Returns NULL if the ticker is not
+// in the store or its file cannot be loaded. The stock belongs to the
+// store and may be freed by any later call that loads another stock,
+// so it should not be kept across such calls.
+stock_t *stock_store_get(stock_store_t *store, char *ticker){
+  stock_store_entry_t *entry = hashmap_get_ptr(&store->map, ticker);
+  if(entry == NULL){
+    return NULL;
+  }
+  if(entry->stock != NULL){
+    store->hits++;
+    if(store->newest != entry){
+      lru_unlink(store, entry);
+      lru_push(store, entry);
+    }
+    return entry->stock;
+  }
+  return load(store, entry) == 0 ? entry->stock : NULL;
+}
+
+// Fills 'stats' with the lo/hi and best buy/sell of the stock of
+// 'ticker'. These are kept from the first load so only a ticker never
+// loaded before is loaded now; the stock is not marked as used.
+// Returns 0 on success or -1 if the ticker is not in the store or its
+// file cannot be loaded.
+int stock_store_stats(stock_store_t *store, char *ticker, stock_store_stats_t *stats){
+  stock_store_entry_t *entry = hashmap_get_ptr(&store->map, ticker);
+  if(entry == NULL){
+    return -1;
+  }
+  if(entry->has_stats){
+    store->hits++;
+  }
+  else if(load(store, entry) != 0){
+    return -1;
+  }
+  *stats = entry->stats;
+  return 0;
+}
+
+// Frees the entry held by a node of the store's map and its stock
+static void free_entry(hashnode_t *node, void *arg){
+  stock_store_entry_t *entry = node->ptr;
+  if(entry->stock != NULL){
+    stock_free(entry->stock);
+  }
+  free(entry->filename);
+  free(entry);
+}
+
+// De-allocates all the stocks and entries of 'store', leaving it empty
+// with no budget
+void stock_store_free(stock_store_t *store){
+  hashmap_foreach(&store->map, free_entry, NULL);
+  hashmap_free_table(&store->map);
+  memset(store, 0, sizeof(*store));
+}
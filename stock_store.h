@@ -0,0 +1,46 @@
+// stock_store.h: header for the ticker-indexed stock store which keeps
+// many stocks in memory, built on the hash map of hashmap.h
+
+#ifndef STOCK_STORE_H
+#define STOCK_STORE_H 1
+
+#include "stock.h"
+#include "hashmap.h"
+
+typedef struct stock_store_entry stock_store_entry_t; // one ticker, see stock_store.c
+
+// lo/hi and best buy/sell of one stock with their prices, -1 indices
+// and 0.0 prices where there are none
+typedef struct {
+  int count;                    // number of prices
+  int lo_index;                 // index of the lowest price
+  int hi_index;                 // index of the highest price
+  int best_buy;                 // index at which to buy to get best profit
+  int best_sell;                // index at which to sell to get best profit
+  double lo_price;              // prices at those indices
+  double hi_price;
+  double buy_price;
+  double sell_price;
+} stock_store_stats_t;
+
+// Stocks by ticker symbol, each loaded from its file on first use and
+// dropped again, least recently used first, to stay within a budget
+typedef struct {
+  hashmap_t map;                // ticker -> stock_store_entry_t * put with hashmap_put_ptr()
+  long budget;                  // most bytes of loaded stocks to keep, 0 for no limit
+  long bytes;                   // bytes of the stocks loaded now
+  stock_store_entry_t *newest;  // loaded stocks from most to least recently used
+  stock_store_entry_t *oldest;
+  long loads;                   // number of stock files loaded
+  long hits;                    // requests answered without loading
+  long evictions;               // number of stocks dropped to stay within budget
+} stock_store_t;
+
+// stock_store.c
+void stock_store_init(stock_store_t *store, long budget);
+int stock_store_add(stock_store_t *store, char *ticker, char *filename);
+stock_t *stock_store_get(stock_store_t *store, char *ticker);
+int stock_store_stats(stock_store_t *store, char *ticker, stock_store_stats_t *stats);
+void stock_store_free(stock_store_t *store);
+
+#endif
@@ -0,0 +1,179 @@
+// stock_stream.c: analyzes a stock file of any size in one pass with
+// constant memory. stock_load() needs room for every price at once;
+// stock_stream() instead reads the file through a fixed size buffer,
+// keeps the running lo/hi and best buy/sell exactly as
+// stock_set_hilo_best() computes them and reduces the slice to be
+// plotted to a bounded number of columns with stock_columns_add(). At
+// most the buffer, the columns and a partial line are held in memory
+// whatever the size of the file.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stock.h"
+
+#define STOCK_STREAM_BUFSIZE (1 << 20)  // bytes read from the file at a time
+
+// Running stats of the prices seen so far, the streaming form of
+// stock_set_hilo_best(): the earliest lowest and highest prices and the
+// earliest most profitable buy/sell pair
+static void stream_price(stock_stream_t *st, long j, double price){
+  stock_marks_t *m = &st->marks;
+  if(j == 0){
+    m->lo_index = m->hi_index = 0;
+    m->lo_price = m->hi_price = price;
+    return;
+  }
+  double max_prof = m->best_buy < 0 ? 0.0 : st->sell_price - st->buy_price;
+  if(price - m->lo_price > max_prof){
+    m->best_buy = m->lo_index;
+    m->best_sell = j;
+    st->buy_price = m->lo_price;
+    st->sell_price = price;
+  }
+  if(price < m->lo_price){
+    m->lo_index = j;
+    m->lo_price = price;
+  }
+  if(m->hi_price < price){
+    m->hi_index = j;
+    m->hi_price = price;
+  }
+}
+
+// Adds the next price of the file to the results in 'st' and to the
+// plot columns if its index falls in [start, stop)
+static void stream_add(stock_stream_t *st, double price, long start, long stop){
+  long j = st->count++;
+  if(j < 3){
+    st->first[j] = price;
+  }
+  stream_price(st, j, price);
+  if(j >= start && (stop < 0 || j < stop)){
+    stock_columns_add(&st->columns, price);
+  }
+}
+
+// Goes through the prices of a binary stock file which stock_load()
+// maps rather than reads into memory so it is no burden to load
+static int stream_binary(stock_stream_t *st, char *filename, long start, long stop){
+  stock_t *stock = stock_new();
+  int ret = stock_load(stock, filename);
+  for(int i=0; i < stock->count; i++){
+    stream_add(st, stock->prices[i], start, stop);
+  }
+  stock_free(stock);
+  return ret;
+}
+
+// Reads the stock file 'filename' once, 1MB at a time, filling in the
+// count, first prices and lo/hi and best buy/sell of 'st' with the same
+// results as stock_load() followed by stock_set_hilo_best(). Prices
+// 'start' to 'stop'-1 are reduced to at most 'max_cols' plot columns in
+// the 'columns' field for stock_plot_columns(); a 'stop' below 0 or
+// past the end means the end of the file. As with stock_load() only
+// newline terminated lines count. Returns 0 on success. If the file
+// cannot be opened prints the same messages as stock_load() and returns
+// -1. Binary stock files are mapped by stock_load() and gone through
+// in the same way. Release 'st' with stock_stream_free().
+int stock_stream(stock_stream_t *st, char *filename, long start, long stop, int max_cols){
+  memset(st, 0, sizeof(*st));
+  stock_marks_t none = {-1, -1, -1, -1, 0.0, 0.0};
+  st->marks = none;
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    printf("Could not open file '%s'\n", filename);
+    printf("Unable to open stock file '%s', bailing out\n", filename);
+    st->count = -1;
+    return -1;
+  }
+  st->data_file = strdup(filename);
+  if(start < 0){
+    start = 0;
+  }
+  // With a stop the number of prices plotted is known, so the columns
+  // are as wide as stock_plot_cols() makes them; only an open-ended
+  // slice needs widths that double as prices keep coming
+  stock_columns_init(&st->columns, start, max_cols, stop >= 0 ? stop - start : -1);
+
+  char *buf = malloc(STOCK_STREAM_BUFSIZE);
+  long held = 0;                // bytes of a partial line at the start of buf
+  int skipping = 0;             // 1 while skipping the rest of a line longer than buf
+  double long_price = 0.0;      // price parsed from the start of that line
+  int time;
+  while(1){
+    long got = read(fd, buf + held, STOCK_STREAM_BUFSIZE - held);
+    if(got <= 0){
+      break;                    // a last line without a newline is ignored
+    }
+    if(st->count == 0 && held == 0 && !skipping && stock_is_binary(buf, got)){
+      free(buf);
+      close(fd);
+      return stream_binary(st, filename, start, stop);
+    }
+    char *pos = buf, *end = buf + held + got;
+    char *eol;
+    if(skipping){
+      eol = memchr(pos, '\n', end - pos);
+      if(eol == NULL){
+        continue;               // still inside the long line
+      }
+      stream_add(st, long_price, start, stop);
+      skipping = 0;
+      pos = eol + 1;
+    }
+    while((eol = memchr(pos, '\n', end - pos)) != NULL){
+      double price;
+      stock_parse_line(pos, eol, &time, &price);
+      stream_add(st, price, start, stop);
+      pos = eol + 1;
+    }
+    held = end - pos;
+    if(held == STOCK_STREAM_BUFSIZE){
+      // A line longer than buf: its time and price are at its start, so
+      // parse what is here and add the price once its newline turns up
+      stock_parse_line(buf, end, &time, &long_price);
+      skipping = 1;
+      held = 0;
+    }
+    memmove(buf, pos, held);
+  }
+  free(buf);
+  close(fd);
+  return 0;
+}
+
+// Prints the results of stock_stream() in the same format as
+// stock_print() prints the loaded stock
+void stock_stream_print(stock_stream_t *st){
+  stock_marks_t *m = &st->marks;
+  printf("==STOCK DATA==\n");
+  printf("data_file: %s\n", st->data_file);
+  printf("count: %ld\n", st->count);
+  if(st->count == 0){
+    printf("prices: []\n");
+  }
+  else if(st->count == 1){
+    printf("prices: [%.2f]\n", st->first[0]);
+  }
+  else if(st->count == 2){
+    printf("prices: [%.2f, %.2f]\n", st->first[0], st->first[1]);
+  }
+  else if(st->count == 3){
+    printf("prices: [%.2f, %.2f, %.2f]\n", st->first[0], st->first[1], st->first[2]);
+  }
+  else{
+    printf("prices: [%.2f, %.2f, %.2f, ...]\n", st->first[0], st->first[1], st->first[2]);
+  }
+  printf("lo_index:  %ld\n", m->lo_index);
+  printf("hi_index:  %ld\n", m->hi_index);
+  printf("best_buy:  %ld\n", m->best_buy);
+  printf("best_sell: %ld\n", m->best_sell);
+  printf("profit:    %.2f\n", m->best_buy < 0 ? 0.0 : st->sell_price - st->buy_price);
+}
+
+// De-allocates the parts of 'st'
+void stock_stream_free(stock_stream_t *st){
+  free(st->data_file);
+  stock_columns_free(&st->columns);
+}
@@ -0,0 +1,145 @@
+// stock_trades.c: best total profit from several buy/sell trades
+// rather than the single one of stock_set_best(). A trade buys one
+// share and sells it later, only one share is held at a time and
+// optionally
+//
+// - at most 'max_trades' trades are made,
+// - 'cooldown' prices must pass after a sell before the next buy,
+// - 'fee' is paid for every trade.
+//
+// ALGORITHM NOTES
+// Trying every combination of trades is O(N^2 * k). Instead one pass
+// over the prices keeps, for each number of trades j, the best cash
+// while holding the share of trade j ('hold[j]') and after selling
+// it ('free[j]'). At price p
+//
+//   free[j] = max(free[j], hold[j] + p - fee)      sell
+//   hold[j] = max(hold[j], free[j-1] - p)          buy
+//
+// where free[j-1] is its value 'cooldown'+1 prices earlier, kept in a
+// ring of the last cooldown+1 rows. That is O(N * k) time and
+// O(k * (cooldown+1)) memory for the profit. Without a limit on
+// trades, or with one of N/2 or more which can never be reached, a
+// single level whose buys come from its own 'free' does in O(N).
+//
+// To list the trades each step also records 2 bits per level, whether
+// it bought and whether it sold, and the trades are read back from the
+// end. Only improvements that are strictly better count so among
+// equally good plans the earliest trades win; with one trade this is
+// the same pair as stock_set_best().
+
+#include <math.h>
+
+#include "stock.h"
+
+// Bit 'b' of the 'nbits' bit decision row of price 'i'
+#define BIT_INDEX(i, nbits, b) ((long) (i) * (nbits) + (b))
+#define GET_BIT(bits, k) (((bits)[(k) >> 3] >> ((k) & 7)) & 1)
+#define SET_BIT(bits, k) ((bits)[(k) >> 3] |= 1 << ((k) & 7))
+
+// Reads the trades back from the decision bits of a run over 'count'
+// prices with 'levels' levels; 'shared' is 1 when buys come from the
+// level's own free state. Fills 'trades', last trade first, and
+// returns how many there are.
+static int read_trades(unsigned char *bits, int count, int levels, int cooldown,
+                       int shared, stock_trade_t *trades){
+  int n = 0;
+  int j = levels;               // level of the current state
+  int holding = 0;              // whether the current state holds a share
+  int sell = -1;
+  for(int i = count-1; i >= 0 && j > 0; ){
+    if(!holding){
+      if(GET_BIT(bits, BIT_INDEX(i, 2*levels, 2*(j-1)+1))){
+        sell = i;
+        holding = 1;
+      }
+      i--;
+    }
+    else{
+      if(GET_BIT(bits, BIT_INDEX(i, 2*levels, 2*(j-1)))){
+        trades[n].buy = i;
+        trades[n].sell = sell;
+        n++;
+        holding = 0;
+        j -= shared ? 0 : 1;
+        i -= cooldown + 1;
+      }
+      else{
+        i--;
+      }
+    }
+  }
+  return n;
+}
+
+// Finds the most profitable set of trades on the prices of 'stock'
+// with at most 'max_trades' of them, a negative value meaning no
+// limit, at least 'cooldown' prices between a sell and the next buy
+// and 'fee' paid per trade. Returns the total profit after fees, 0.0
+// if no trade makes money. If 'trades' is not NULL, '*trades' is set
+// to a malloc()'d array of the '*ntrades' trades in order, which the
+// caller frees; this needs N * levels / 4 bytes while running, only
+// the profit is computed in O(levels * (cooldown+1)) memory.
+double stock_best_trades(stock_t *stock, int max_trades, int cooldown, double fee,
+                         stock_trade_t **trades, int *ntrades){
+  stock_unfix(stock);
+  int count = stock->count > 0 ? stock->count : 0;
+  double *prices = stock->prices;
+  if(cooldown < 0){
+    cooldown = 0;
+  }
+  int shared = max_trades < 0 || max_trades >= count / 2;
+  int levels = shared ? 1 : max_trades;
+  int rows = cooldown + 1;
+
+  double *hold = malloc(sizeof(double) * (levels + 1));
+  double *ring = calloc((long) rows * (levels + 1), sizeof(double)); // free[] of the last 'rows' prices
+  double *free_now = malloc(sizeof(double) * (levels + 1));
+  for(int j=0; j <= levels; j++){
+    hold[j] = -INFINITY;
+    free_now[j] = 0.0;
+  }
+  unsigned char *bits = NULL;
+  if(trades != NULL){
+    bits = calloc(((long) count * 2 * levels + 7) / 8 + 1, 1);
+  }
+
+  for(int i=0; i < count; i++){
+    double p = prices[i];
+    double *before = ring + (long) (i % rows) * (levels + 1); // free[] as of price i-1-cooldown
+    for(int j=1; j <= levels; j++){
+      if(hold[j] + p - fee > free_now[j]){
+        free_now[j] = hold[j] + p - fee;
+        if(bits != NULL){
+          SET_BIT(bits, BIT_INDEX(i, 2*levels, 2*(j-1)+1));
+        }
+      }
+      double source = before[shared ? j : j-1];
+      if(source - p > hold[j]){
+        hold[j] = source - p;
+        if(bits != NULL){
+          SET_BIT(bits, BIT_INDEX(i, 2*levels, 2*(j-1)));
+        }
+      }
+    }
+    memcpy(before, free_now, sizeof(double) * (levels + 1)); // becomes price i
+  }
+  double profit = levels > 0 ? free_now[levels] : 0.0;
+
+  if(trades != NULL){
+    stock_trade_t *list = malloc(sizeof(stock_trade_t) * (count / 2 + 1));
+    int n = levels > 0 ? read_trades(bits, count, levels, cooldown, shared, list) : 0;
+    for(int a=0, b=n-1; a < b; a++, b--){
+      stock_trade_t t = list[a];
+      list[a] = list[b];
+      list[b] = t;
+    }
+    *trades = list;
+    *ntrades = n;
+    free(bits);
+  }
+  free(hold);
+  free(ring);
+  free(free_now);
+  return profit;
+}
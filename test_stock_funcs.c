@@ -1,6 +1,11 @@
 // Updated: Tue Sep 28 03:12:57 PM CDT 2021 
 
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+
 #include "stock.h"
+#include "stock_store.h"
 
 #define PRINT_TEST sprintf(sysbuf,"awk 'NR==(%d+1){P=1;print \"{\"} P==1 && /ENDTEST/{P=0; print \"}\"} P==1{print}' %s", __LINE__, __FILE__); \
                    system(sysbuf);
@@ -16,6 +21,20 @@ void print_int_array(int *arr, int length){
   printf("]");
 }
 
+// Best total profit of at most 'k' trades on prices[i..n-1] by trying
+// every buy/sell pair, the O(N^2 * k) way, to check stock_best_trades()
+double brute_trades(double *prices, int n, int i, int k, int cooldown, double fee){
+  double best = 0.0;
+  for(int b=i; k > 0 && b < n; b++){
+    for(int s=b+1; s < n; s++){
+      double profit = prices[s] - prices[b] - fee +
+        brute_trades(prices, n, s + 1 + cooldown, k - 1, cooldown, fee);
+      best = profit > best ? profit : best;
+    }
+  }
+  return best;
+}
+
 int main(int argc, char *argv[]){
   if(argc < 2){
     printf("usage: %s <test_name>\n", argv[0]);
@@ -506,6 +525,761 @@ int main(int argc, char *argv[]){
     stock_print(&stock);
   } // ENDTEST
 
+  else if( strcmp( test_name, "stock_set_hilo_best" )==0 ) {
+    PRINT_TEST;
+    // Checks the single pass stock_set_hilo_best() which sets all of
+    // lo/hi and best buy/sell; several pairs give the maximal profit
+    // of 20 and the earliest, 1,2, must be chosen along with the
+    // earliest of the repeated high prices
+    double prices[9] = {
+      20.0, 10.0, 30.0, 10.0, 30.0,
+      5.0, 25.0, 25.0, 6.0,
+    };
+    stock_t stock = {
+      .data_file = "prices.txt",
+      .count = 9,
+      .prices = prices,
+      .lo_index  = -1,
+      .hi_index  = -1,
+      .best_buy  = -1,
+      .best_sell = -1,
+    };
+    int ret = stock_set_hilo_best(&stock);
+    printf("ret: %d\n", ret);
+    stock_print(&stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_push" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_push() grows the prices array and keeps
+    // lo/hi and best buy/sell up to date after each price, matching
+    // stock_set_hilo_best() on the same prices
+    double prices[9] = {
+      20.0, 10.0, 30.0, 10.0, 30.0,
+      5.0, 25.0, 25.0, 6.0,
+    };
+    stock_t *stock = stock_new();
+    for(int i=0; i<9; i++){
+      stock_push(stock, -1, prices[i]);
+      printf("push %5.2f: lo %d hi %d best %2d %2d\n", prices[i],
+             stock->lo_index, stock->hi_index, stock->best_buy, stock->best_sell);
+    }
+    for(int i=0; i<100; i++){
+      stock_push(stock, -1, 1.0 + i);
+    }
+    stock_print(stock);
+    stock_free(stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_time_index" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_load() keeps times of day in the 'times' field
+    // and that stock_time_index() finds the first price at or after a
+    // given time; files with other kinds of times get no 'times'
+    stock_t *stock = stock_new();
+    stock_load(stock, "data/stock-3only.txt");
+    for(int i=0; i<stock->count; i++){
+      printf("times[%d]: %d\n", i, stock->times[i]);
+    }
+    char *queries[6] = {"09:00", "10:00", "10:00:01", "10:05", "10:10", "10:11"};
+    for(int i=0; i<6; i++){
+      int time = stock_parse_time(queries[i]);
+      printf("%-8s = %5d -> index %d\n", queries[i], time, stock_time_index(stock, time));
+    }
+    stock_free(stock);
+
+    stock = stock_new();
+    stock_load(stock, "data/stock-FB-08-02-2021.txt");
+    int start = stock_time_index(stock, stock_parse_time("09:30"));
+    int stop = stock_time_index(stock, stock_parse_time("11:00") + 1);
+    printf("FB 09:30 to 11:00: indices %d to %d, times %d to %d\n",
+           start, stop, stock->times[start], stock->times[stop-1]);
+    stock_free(stock);
+
+    stock = stock_new();
+    stock_load(stock, "data/stock-ascending.txt");
+    printf("ascending times: %s\n", stock->times == NULL ? "NULL" : "present");
+    printf("bad time: %d\n", stock_parse_time("25:00"));
+    stock_free(stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_save_binary" )==0 ) {
+    PRINT_TEST;
+    // Checks that a stock saved with stock_save_binary(), plain or
+    // delta encoded, loads back with the same prices, times and stats,
+    // that pushing onto a mapped stock copies it out of the file and
+    // that a damaged file is rejected
+    stock_t *text = stock_new();
+    stock_load(text, "data/stock-FB-08-02-2021.txt");
+    stock_set_hilo_best(text);
+    for(int delta=0; delta<2; delta++){
+      stock_save_binary(text, "test-results/stock.stk", delta);
+      stock_t *stock = stock_new();
+      int ret = stock_load(stock, "test-results/stock.stk");
+      printf("delta %d: ret %d count %d mapped %s\n", delta, ret, stock->count,
+             stock->map != NULL ? "yes" : "no");
+      printf("  prices same: %s\n",
+             memcmp(stock->prices, text->prices, sizeof(double) * text->count) == 0 ? "yes" : "no");
+      printf("  times same:  %s\n",
+             memcmp(stock->times, text->times, sizeof(int) * text->count) == 0 ? "yes" : "no");
+      printf("  stats: lo %d hi %d best %d %d\n", stock->lo_index, stock->hi_index,
+             stock->best_buy, stock->best_sell);
+      stock_push(stock, stock->times[stock->count-1] + 60, 400.0);
+      printf("  after push: count %d mapped %s last %.2f hi %d\n", stock->count,
+             stock->map != NULL ? "yes" : "no", stock->prices[stock->count-1], stock->hi_index);
+      stock_free(stock);
+    }
+    stock_free(text);
+
+    FILE *file = fopen("test-results/stock.stk", "w");
+    char junk[256] = "STOCKBIN";
+    fwrite(junk, 1, sizeof(junk), file);
+    fclose(file);
+    stock_t *stock = stock_new();
+    int ret = stock_load(stock, "test-results/stock.stk");
+    printf("damaged: ret %d count %d\n", ret, stock->count);
+    stock_free(stock);
+
+    // stats in the header that are not indices of the prices: a lo far
+    // past the end and a buy after the sell, at their header offsets
+    char *bad_names[2] = {"lo past end", "buy after sell"};
+    int bad_off[2] = {52, 60};
+    int32_t bad_val[2] = {50000000, 500};
+    for(int k=0; k<2; k++){
+      text = stock_new();
+      stock_load(text, "data/stock-FB-08-02-2021.txt");
+      stock_save_binary(text, "test-results/stock.stk", 0);
+      stock_free(text);
+      file = fopen("test-results/stock.stk", "r+");
+      fseek(file, bad_off[k], SEEK_SET);
+      fwrite(&bad_val[k], sizeof(int32_t), 1, file);
+      fclose(file);
+      stock = stock_new();
+      ret = stock_load(stock, "test-results/stock.stk");
+      printf("%s: ret %d count %d\n", bad_names[k], ret, stock->count);
+      stock_free(stock);
+    }
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_stream" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_stream() finds the same count and lo/hi/best
+    // as stock_load() and stock_set_hilo_best() on several files and
+    // that the plot columns double in width to fit the limit
+    char *files[5] = {
+      "data/stock-FB-08-02-2021.txt", "data/stock-TSLA-08-12-2021.txt",
+      "data/stock-jagged.txt", "data/stock-descending.txt", "data/stock-1only.txt",
+    };
+    for(int f=0; f<5; f++){
+      stock_t *stock = stock_new();
+      stock_load(stock, files[f]);
+      stock_set_hilo_best(stock);
+      stock_stream_t st;
+      stock_stream(&st, files[f], 0, -1, 50);
+      int same = st.count == stock->count &&
+        st.marks.lo_index == stock->lo_index && st.marks.hi_index == stock->hi_index &&
+        st.marks.best_buy == stock->best_buy && st.marks.best_sell == stock->best_sell;
+      printf("%-32s count %3ld lo %3ld hi %3ld best %3ld %3ld columns %2d x %2d same: %s\n",
+             files[f], st.count, st.marks.lo_index, st.marks.hi_index,
+             st.marks.best_buy, st.marks.best_sell, st.columns.ncols, st.columns.width,
+             same ? "yes" : "no");
+      stock_stream_free(&st);
+      stock_free(stock);
+    }
+    stock_stream_t st;
+    stock_stream(&st, "data/stock-jagged.txt", 3, 12, 4);
+    for(int c=0; c<st.columns.ncols; c++){
+      stock_column_t *col = &st.columns.cols[c];
+      printf("column %d: %ld..%ld lo %.2f hi %.2f\n", c, col->first, col->last, col->lo, col->hi);
+    }
+    stock_stream_free(&st);
+    int ret = stock_stream(&st, "data/not-there.txt", 0, -1, 10);
+    printf("ret: %d count: %ld\n", ret, st.count);
+
+    // lines longer than the 1MB read buffer still give their price
+    mkdir("test-results", 0755);
+    FILE *out = fopen("test-results/long-lines.txt", "w");
+    char *lines[4] = {"09:30 10.00\n", "09:31 5.00 ", "09:32 12.00\n", "09:33 3.00 "};
+    long fill[4] = {0, 3500000, 0, 1048570};
+    for(int i=0; i<4; i++){
+      fputs(lines[i], out);
+      if(fill[i] > 0){
+        for(long k=0; k<fill[i]; k++){
+          fputc('x', out);
+        }
+        fputc('\n', out);
+      }
+    }
+    fputs("09:34 4.00\n", out);
+    fclose(out);
+    stock_t *stock = stock_new();
+    stock_load(stock, "test-results/long-lines.txt");
+    stock_set_hilo_best(stock);
+    stock_stream(&st, "test-results/long-lines.txt", 0, -1, 10);
+    printf("long lines: count %ld lo %ld hi %ld best %ld %ld same: %s\n", st.count,
+           st.marks.lo_index, st.marks.hi_index, st.marks.best_buy, st.marks.best_sell,
+           st.count == stock->count && st.marks.lo_index == stock->lo_index &&
+           st.marks.hi_index == stock->hi_index && st.marks.best_buy == stock->best_buy &&
+           st.marks.best_sell == stock->best_sell ? "yes" : "no");
+    stock_stream_free(&st);
+    stock_free(stock);
+    remove("test-results/long-lines.txt");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_pyramid" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_pyramid_query() gives the same lowest, highest,
+    // first and last prices as scanning slices of all sizes, that plot
+    // columns read from the pyramid match those added price by price
+    // and that a binary stock file brings its pyramid along
+    stock_t *stock = stock_new();
+    stock_load(stock, "data/stock-FB-08-02-2021.txt");
+    int bad = 0, slices = 0;
+    for(int start=0; start < stock->count; start += 7){
+      for(int stop=start+1; stop <= stock->count; stop += 13){
+        stock_pyramid_node_t node = stock_pyramid_query(stock, start, stop);
+        double lo = stock->prices[start], hi = stock->prices[start];
+        for(int i=start; i < stop; i++){
+          lo = stock->prices[i] < lo ? stock->prices[i] : lo;
+          hi = stock->prices[i] > hi ? stock->prices[i] : hi;
+        }
+        bad += node.lo != lo || node.hi != hi ||
+          node.first != stock->prices[start] || node.last != stock->prices[stop-1];
+        slices++;
+      }
+    }
+    printf("count %d slices %d wrong %d\n", stock->count, slices, bad);
+    stock_pyramid_node_t none = stock_pyramid_query(stock, 10, 10);
+    printf("empty slice: lo > hi %s\n", none.lo > none.hi ? "yes" : "no");
+
+    stock_columns_t by_price, by_pyramid;
+    stock_columns_init(&by_price, 17, 30, 500);
+    stock_columns_init(&by_pyramid, 17, 30, 500);
+    for(int i=17; i < 517; i++){
+      stock_columns_add(&by_price, stock->prices[i]);
+    }
+    stock_pyramid_columns(stock, &by_pyramid, 517);
+    int same = by_price.ncols == by_pyramid.ncols && by_price.count == by_pyramid.count &&
+      memcmp(by_price.cols, by_pyramid.cols, sizeof(stock_column_t) * by_price.ncols) == 0;
+    printf("columns %d x %d same: %s\n", by_pyramid.ncols, by_pyramid.width, same ? "yes" : "no");
+    stock_columns_free(&by_price);
+    stock_columns_free(&by_pyramid);
+
+    for(int delta=0; delta<2; delta++){
+      stock_save_binary(stock, "test-results/pyramid.stk", delta);
+      stock_t *bin = stock_new();
+      stock_load(bin, "test-results/pyramid.stk");
+      printf("delta %d: pyramid loaded %s", delta, bin->pyramid != NULL ? "yes" : "no");
+      stock_pyramid_node_t a = stock_pyramid_query(bin, 100, 400);
+      stock_pyramid_node_t b = stock_pyramid_query(stock, 100, 400);
+      printf(" query same %s\n", memcmp(&a, &b, sizeof(a)) == 0 ? "yes" : "no");
+      stock_free(bin);
+    }
+    stock_free(stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_range" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_range() gives the same lo/hi and best buy/sell
+    // as stock_set_hilo_best() run on the slice alone for every slice
+    // of short arrays full of ties, flat and falling, which start and
+    // stop both inside and on the edges of the 16-price blocks of its
+    // index, empty slices included, and for many slices of a real file
+    int n = 100;
+    char *kinds[4] = {"ties", "flat", "falling", "file"};
+    for(int k=0; k<4; k++){
+      stock_t *stock = stock_new();
+      if(k == 3){
+        stock_load(stock, "data/stock-FB-08-02-2021.txt");
+      }
+      srand(36);
+      for(int i=0; k < 3 && i < n; i++){
+        double price = k == 0 ? 100.0 + rand() % 4 : k == 1 ? 50.0 : 200.0 - i;
+        stock_push(stock, -1, price);
+      }
+      int slices = 0, wrong = 0, trades = 0;
+      for(int start=0; start <= stock->count; start += k == 3 ? 3 : 1){
+        for(int stop=start; stop <= stock->count; stop++){
+          stock_t slice = {.prices = stock->prices + start, .count = stop - start};
+          int want = stock_set_hilo_best(&slice);
+          stock_summary_t sum;
+          int ret = stock_range(stock, start, stop, &sum);
+          int lo = slice.count > 0 ? slice.lo_index + start : -1;
+          int hi = slice.count > 0 ? slice.hi_index + start : -1;
+          int buy = slice.best_buy >= 0 ? slice.best_buy + start : -1;
+          int sell = slice.best_sell >= 0 ? slice.best_sell + start : -1;
+          wrong += ret != want || sum.lo != lo || sum.hi != hi || sum.buy != buy || sum.sell != sell;
+          trades += ret == 0;
+          slices++;
+        }
+      }
+      printf("%-8s count %3d slices %6d with a trade %6d wrong %d\n",
+             kinds[k], stock->count, slices, trades, wrong);
+      stock_free(stock);
+    }
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_set_hilo_best_parallel" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_set_hilo_best_parallel() gives exactly the
+    // results of stock_set_hilo_best() for several thread counts on
+    // long arrays full of ties: a random walk in cents, a saw tooth
+    // whose best trade repeats in every tooth, all equal prices and
+    // falling prices
+    int n = 1000000;
+    stock_t *stock = stock_new();
+    stock->prices = malloc(sizeof(double) * n);
+    stock->count = n;
+    stock->capacity = n;
+    char *kinds[4] = {"walk", "saw", "flat", "falling"};
+    for(int k=0; k<4; k++){
+      srand(2021);
+      long cents = 10000;
+      for(int i=0; i<n; i++){
+        cents += rand() % 5 - 2;
+        double walk = cents / 100.0;
+        double saw = 100.0 + (i % 1000) / 10.0;
+        stock->prices[i] = k == 0 ? walk : k == 1 ? saw : k == 2 ? 50.0 : n - i;
+      }
+      int ret = stock_set_hilo_best(stock);
+      stock_t serial = *stock;
+      printf("%-8s ret %2d lo %6d hi %6d best %6d %6d threads", kinds[k], ret,
+             serial.lo_index, serial.hi_index, serial.best_buy, serial.best_sell);
+      int threads[4] = {2, 3, 7, 16};
+      for(int t=0; t<4; t++){
+        int pret = stock_set_hilo_best_parallel(stock, threads[t]);
+        int same = pret == ret &&
+          stock->lo_index == serial.lo_index && stock->hi_index == serial.hi_index &&
+          stock->best_buy == serial.best_buy && stock->best_sell == serial.best_sell;
+        printf(" %d:%s", threads[t], same ? "same" : "DIFFERENT");
+      }
+      printf("\n");
+    }
+    stock_free(stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_best_trades" )==0 ) {
+    PRINT_TEST;
+    // Checks stock_best_trades() against trying every combination of
+    // trades on many short random price lists with lots of ties, for
+    // several limits on trades, cooldowns and fees, and that the trade
+    // list it returns is valid, adds up to the profit and with a single
+    // trade is the stock_set_best() pair. Then shows
+    // the trades on a data file.
+    srand(44);
+    int limits[4] = {1, 2, 3, -1}, cooldowns[3] = {0, 1, 2};
+    double fees[2] = {0.0, 1.5};
+    int checked = 0, wrong = 0, invalid = 0;
+    for(int r=0; r < 100; r++){
+      int n = 1 + rand() % 10;
+      double prices[10];
+      for(int i=0; i<n; i++){
+        prices[i] = rand() % 8;
+      }
+      stock_t stock = {.count = n, .prices = prices};
+      for(int a=0; a<4; a++){
+        for(int c=0; c<3; c++){
+          for(int f=0; f<2; f++){
+            stock_trade_t *trades;
+            int ntrades;
+            double profit = stock_best_trades(&stock, limits[a], cooldowns[c], fees[f],
+                                              &trades, &ntrades);
+            double expect = brute_trades(prices, n, 0, limits[a] < 0 ? n : limits[a],
+                                         cooldowns[c], fees[f]);
+            double sum = 0.0;
+            int ok = limits[a] < 0 || ntrades <= limits[a];
+            for(int t=0; t < ntrades; t++){
+              ok = ok && trades[t].buy < trades[t].sell &&
+                (t == 0 || trades[t].buy > trades[t-1].sell + cooldowns[c]);
+              sum += prices[trades[t].sell] - prices[trades[t].buy] - fees[f];
+            }
+            if(limits[a] == 1 && cooldowns[c] == 0 && fees[f] == 0.0){
+              stock_set_best(&stock);
+              ok = ok && (ntrades == 0 ? stock.best_buy == -1 :
+                          trades[0].buy == stock.best_buy && trades[0].sell == stock.best_sell);
+            }
+            wrong += fabs(profit - expect) > 1e-9;
+            invalid += !ok || fabs(sum - profit) > 1e-9;
+            checked++;
+            free(trades);
+          }
+        }
+      }
+    }
+    printf("checked %d wrong profit %d invalid trades %d\n", checked, wrong, invalid);
+
+    stock_t *stock = stock_new();
+    stock_load(stock, "data/stock-TSLA-08-02-2021.txt");
+    stock_set_best(stock);
+    printf("stock_set_best: %d %d\n", stock->best_buy, stock->best_sell);
+    for(int a=0; a<4; a++){
+      stock_trade_t *trades;
+      int ntrades;
+      double profit = stock_best_trades(stock, limits[a], 5, a == 3 ? 0.5 : 0.0, &trades, &ntrades);
+      printf("max %2d cooldown 5 fee %.2f: %4d trades profit %7.2f first",
+             limits[a], a == 3 ? 0.5 : 0.0, ntrades, profit);
+      for(int t=0; t < ntrades && t < 3; t++){
+        printf(" %d-%d", trades[t].buy, trades[t].sell);
+      }
+      printf("\n");
+      free(trades);
+    }
+    double profit = stock_best_trades(stock, 1, 0, 0.0, NULL, NULL);
+    printf("profit only: %.2f\n", profit);
+    stock_free(stock);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_rolling" )==0 ) {
+    PRINT_TEST;
+    // Checks stock_rolling() against computing the stats of every
+    // window from scratch with stock_set_hilo_best() and plain sums on
+    // a data file and on a long random walk full of ties, for several
+    // window sizes including 1 and windows longer than the stock
+    char *files[2] = {"data/stock-FB-08-02-2021.txt", NULL};
+    int windows[6] = {1, 2, 3, 16, 100, 1000};
+    for(int f=0; f<2; f++){
+      stock_t *stock = stock_new();
+      if(files[f] != NULL){
+        stock_load(stock, files[f]);
+      }
+      else{
+        int n = 20000;
+        stock->prices = malloc(sizeof(double) * n);
+        stock->count = n;
+        srand(45);
+        long cents = 10000;
+        for(int i=0; i<n; i++){
+          cents += rand() % 5 - 2;
+          stock->prices[i] = cents / 100.0;
+        }
+      }
+      for(int w=0; w<6; w++){
+        stock_rolling_t roll;
+        stock_rolling(stock, windows[w], &roll);
+        int wrong_hilo = 0, wrong_best = 0, wrong_mean = 0;
+        for(int i=0; i < stock->count; i++){
+          int first = i - windows[w] + 1 > 0 ? i - windows[w] + 1 : 0;
+          stock_t slice = {.count = i - first + 1, .prices = stock->prices + first};
+          stock_set_hilo_best(&slice);
+          wrong_hilo += roll.lo[i] != slice.lo_index + first || roll.hi[i] != slice.hi_index + first;
+          wrong_best += roll.buy[i] != (slice.best_buy < 0 ? -1 : slice.best_buy + first) ||
+            roll.sell[i] != (slice.best_sell < 0 ? -1 : slice.best_sell + first);
+          double mean = 0.0, var = 0.0;
+          for(int j=first; j <= i; j++){
+            mean += stock->prices[j];
+          }
+          mean /= slice.count;
+          for(int j=first; j <= i; j++){
+            var += (stock->prices[j] - mean) * (stock->prices[j] - mean);
+          }
+          wrong_mean += fabs(roll.mean[i] - mean) > 1e-9 * mean ||
+            fabs(roll.stddev[i] - sqrt(var / slice.count)) > 1e-6;
+        }
+        printf("%-28s window %4d: wrong lo/hi %d best %d mean/stddev %d\n",
+               files[f] != NULL ? files[f] : "random walk", windows[w],
+               wrong_hilo, wrong_best, wrong_mean);
+        stock_rolling_free(&roll);
+      }
+      stock_free(stock);
+    }
+    stock_rolling_t roll;
+    stock_t empty = {.count = 0};
+    int ret = stock_rolling(&empty, 0, &roll);
+    printf("window 0: %d\n", ret);
+    ret = stock_rolling(&empty, 5, &roll);
+    printf("empty stock: %d count %d\n", ret, roll.count);
+    stock_rolling_free(&roll);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_fix" )==0 ) {
+    PRINT_TEST;
+    // Checks that a stock switched to fixed-point ticks by stock_fix()
+    // gives the same prices, lo/hi, best trade and plot columns as the
+    // doubles on several files, that prices which are not whole
+    // ten-thousandths are refused and that stock_unfix() and
+    // stock_push() bring back the same doubles
+    char *files[5] = {
+      "data/stock-FB-08-02-2021.txt", "data/stock-TSLA-08-12-2021.txt",
+      "data/stock-jagged.txt", "data/stock-descending.txt", "data/stock-1only.txt",
+    };
+    for(int f=0; f<5; f++){
+      stock_t *stock = stock_new();
+      stock_t *fixed = stock_new();
+      stock_load(stock, files[f]);
+      stock_load(fixed, files[f]);
+      int ret = stock_fix(fixed);
+      int same_prices = fixed->prices == NULL;
+      for(int i=0; i < stock->count; i++){
+        same_prices = same_prices && stock_price(fixed, i) == stock->prices[i];
+      }
+      stock_set_hilo_best(stock);
+      stock_set_hilo_best(fixed);
+      int same_stats = stock->lo_index == fixed->lo_index && stock->hi_index == fixed->hi_index &&
+        stock->best_buy == fixed->best_buy && stock->best_sell == fixed->best_sell;
+      stock_set_hilo(fixed);
+      same_stats = same_stats && stock->lo_index == fixed->lo_index && stock->hi_index == fixed->hi_index;
+      stock_columns_t cols, fixed_cols;
+      stock_columns_init(&cols, 0, 10, stock->count);
+      stock_columns_init(&fixed_cols, 0, 10, stock->count);
+      for(int i=0; i < stock->count; i++){
+        stock_columns_add(&cols, stock->prices[i]);
+      }
+      stock_fixed_columns(fixed, &fixed_cols, fixed->count);
+      int same_cols = cols.ncols == fixed_cols.ncols;
+      for(int c=0; same_cols && c < cols.ncols; c++){
+        same_cols = cols.cols[c].first == fixed_cols.cols[c].first &&
+          cols.cols[c].last == fixed_cols.cols[c].last &&
+          cols.cols[c].lo == fixed_cols.cols[c].lo && cols.cols[c].hi == fixed_cols.cols[c].hi;
+      }
+      printf("%-32s fix %2d prices %s stats %s columns %s\n", files[f], ret,
+             same_prices ? "same" : "differ", same_stats ? "same" : "differ",
+             same_cols ? "same" : "differ");
+      stock_columns_free(&cols);
+      stock_columns_free(&fixed_cols);
+      stock_free(stock);
+      stock_free(fixed);
+    }
+    stock_t *stock = stock_new();
+    stock_push(stock, 1, 10.25);
+    stock_push(stock, 2, 1.23456);
+    printf("fix 1.23456: %d\n", stock_fix(stock));
+    stock->prices[1] = 1.2345;
+    int ret = stock_fix(stock);
+    printf("fix 1.2345: %d ticks %d %d\n", ret, stock->ticks[0], stock->ticks[1]);
+    stock_push(stock, 3, 7.5);
+    printf("after push: %s %.4f %.4f %.4f\n", stock->ticks == NULL ? "doubles" : "ticks",
+           stock->prices[0], stock->prices[1], stock->prices[2]);
+    stock_fix(stock);
+    stock_unfix(stock);
+    printf("after unfix: %s %.4f %.4f %.4f\n", stock->ticks == NULL ? "doubles" : "ticks",
+           stock->prices[0], stock->prices[1], stock->prices[2]);
+    stock_free(stock);
+
+    // stock_fixed_hilo() at every instruction set level on ticks of a
+    // few values, for every length up to 70 and a few longer ones, as
+    // is and with a new lowest or highest tick last
+    int32_t ticks[1100];
+    srand(46);
+    int best = stock_fixed_level(-1), wrong = 0, checked = 0;
+    int lens[76];
+    for(int len=1; len <= 70; len++){
+      lens[len-1] = len;
+    }
+    int long_lens[6] = {255, 256, 257, 1023, 1029, 1090};
+    memcpy(lens + 70, long_lens, sizeof(long_lens));
+    for(int l=0; l < 76; l++){
+      for(int tail=0; tail < 3; tail++){
+        for(int i=0; i < lens[l]; i++){
+          ticks[i] = rand() % 4;
+        }
+        if(tail > 0){
+          ticks[lens[l]-1] = tail == 1 ? -5 : 9;
+        }
+        stock_t slice = {.ticks = ticks, .count = lens[l]};
+        int lo = 0, hi = 0;
+        for(int i=1; i < lens[l]; i++){
+          lo = ticks[i] < ticks[lo] ? i : lo;
+          hi = ticks[i] > ticks[hi] ? i : hi;
+        }
+        for(int level=STOCK_SIMD_SCALAR; level <= best; level++){
+          stock_fixed_level(level);
+          stock_fixed_hilo(&slice);
+          wrong += slice.lo_index != lo || slice.hi_index != hi;
+          checked++;
+        }
+        stock_fixed_level(-1);
+      }
+    }
+    printf("fixed hilo at every level: %s\n", wrong == 0 && checked > 0 ? "same" : "differ");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_argminmax" )==0 ) {
+    PRINT_TEST;
+    // Checks stock_argminmax() at every instruction set level against a
+    // plain scan on prices of only a few values so ties are everywhere:
+    // slices of every length up to 70 and a few longer ones, starting
+    // at different offsets from the vector width, as is and with a new
+    // lowest or highest price in the last one or two places
+    int n = 1100;
+    double *base = malloc(sizeof(double) * n), *prices = malloc(sizeof(double) * n);
+    srand(32);
+    for(int i=0; i<n; i++){
+      base[i] = rand() % 4;
+    }
+    int lens[76];
+    for(int k=0; k<70; k++){
+      lens[k] = k + 1;
+    }
+    int longer[6] = {255, 256, 257, 1023, 1029, 1090};
+    memcpy(lens + 70, longer, sizeof(longer));
+    char *tails[3] = {"as is", "low tail", "high tail"};
+    int best = stock_simd_level(-1);
+    for(int t=0; t<3; t++){
+      int slices = 0, wrong = 0;
+      for(int k=0; k<76; k++){
+        for(int start=0; start<9; start++){
+          int stop = start + lens[k];
+          memcpy(prices, base, sizeof(double) * n);
+          if(t == 1){
+            prices[stop-1] = -1.0;
+            prices[stop > start+1 ? stop-2 : stop-1] = -1.0;
+          }
+          else if(t == 2){
+            prices[stop-1] = 9.0;
+          }
+          int want_lo = start, want_hi = start;
+          for(int i=start; i<stop; i++){
+            want_lo = prices[i] < prices[want_lo] ? i : want_lo;
+            want_hi = prices[i] > prices[want_hi] ? i : want_hi;
+          }
+          slices++;
+          for(int level=STOCK_SIMD_SCALAR; level <= best; level++){
+            if(stock_simd_level(level) != level){
+              continue;                 // a level this CPU lacks
+            }
+            int lo = -1, hi = -1;
+            stock_argminmax(prices, start, stop, &lo, &hi);
+            wrong += lo != want_lo || hi != want_hi;
+          }
+        }
+      }
+      printf("%-10s slices %4d, wrong results at any level %d\n", tails[t], slices, wrong);
+    }
+    stock_simd_level(-1);
+    int lo = 7, hi = 7;
+    stock_argminmax(base, 5, 5, &lo, &hi);
+    printf("empty slice leaves lo %d hi %d\n", lo, hi);
+    free(base);
+    free(prices);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_line_index" )==0 ) {
+    PRINT_TEST;
+    // Checks stock_count_newlines() and stock_line_index() at every
+    // instruction set level against a byte at a time scan: on a data
+    // file, a buffer of random bytes full of newlines and 0xFF bytes
+    // spanning many index blocks, one whose last line has no newline
+    // and an empty one
+    char *file = "data/stock-TSLA-08-12-2021.txt";
+    FILE *in = fopen(file, "r");
+    char text[16384];
+    long text_len = fread(text, 1, sizeof(text), in);
+    fclose(in);
+    int n = 300000;
+    char *noise = malloc(n);
+    srand(48);
+    for(int i=0; i<n; i++){
+      int r = rand() % 8;
+      noise[i] = r == 0 ? '\n' : r == 1 ? (char) 0xFF : 'a' + r;
+    }
+    char *bufs[4] = {text, noise, "09:30 1.00\n09:31 2.00", ""};
+    long lens[4] = {text_len, n, 21, 0};
+    char *names[4] = {file, "random bytes", "no final newline", "empty"};
+    int best = stock_lines_level(-1);
+    for(int b=0; b<4; b++){
+      long want = 0;
+      for(long i=0; i < lens[b]; i++){
+        want += bufs[b][i] == '\n';
+      }
+      int wrong_count = 0, wrong_index = 0;
+      for(int level=STOCK_SIMD_SCALAR; level <= best; level++){
+        stock_lines_level(level);
+        wrong_count += stock_count_newlines(bufs[b], lens[b]) != want;
+        stock_lines_t lines;
+        stock_line_index(&lines, bufs[b], lens[b]);
+        wrong_index += lines.count != want || stock_line_start(&lines, 0) != 0;
+        for(long i=0, line=1; i < lens[b]; i++){
+          if(bufs[b][i] == '\n'){
+            wrong_index += stock_line_start(&lines, line++) != i + 1;
+          }
+        }
+        stock_lines_free(&lines);
+      }
+      printf("%-30s newlines %6ld, levels with wrong count %d, wrong line starts %d\n",
+             names[b], want, wrong_count, wrong_index);
+    }
+    stock_lines_level(-1);
+    free(noise);
+    printf("count_lines: %d\n", count_lines(file));
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_load_cached" )==0 ) {
+    PRINT_TEST;
+    // Checks that stock_load_cached() parses a text file the first time
+    // and writes its sidecar, maps the sidecar after that, keeps using
+    // it when only the file's time changes and rebuilds it when the
+    // contents change, even to the same size
+    mkdir("test-results", 0755);
+    char *file = "test-results/cached.txt";
+    char *cache = stock_cache_path(file);
+    remove(cache);
+    char *contents[3] = {
+      "09:30 10.00\n09:31 12.50\n09:32 11.00\n",
+      "09:30 10.00\n09:31 12.50\n09:32 11.00\n09:33 15.25\n",
+      "09:30 10.00\n09:31 12.50\n09:32 11.00\n09:33 05.25\n",
+    };
+    char *steps[7] = {"first load", "second load", "appended", "again",
+                      "touched", "same size", "again"};
+    int writes[7] = {0, -1, 1, -1, -2, 2, -1}; // contents written before each step, -2 to touch
+    for(int s=0; s<7; s++){
+      if(writes[s] >= 0){
+        FILE *out = fopen(file, "w");
+        fputs(contents[writes[s]], out);
+        fclose(out);
+        struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000 + s, 0}};
+        utimensat(AT_FDCWD, file, times, 0);
+      }
+      else if(writes[s] == -2){
+        struct timespec times[2] = {{0, UTIME_OMIT}, {2000000000, 0}};
+        utimensat(AT_FDCWD, file, times, 0);
+      }
+      stock_t *stock = stock_new();
+      int ret = stock_load_cached(stock, file, 1);
+      printf("%-12s ret %d count %d lo %d hi %d buy %d sell %d from %s file %s\n",
+             steps[s], ret, stock->count, stock->lo_index, stock->hi_index,
+             stock->best_buy, stock->best_sell, stock->map != NULL ? "sidecar" : "text",
+             stock->data_file);
+      stock_free(stock);
+    }
+    remove(cache);
+    remove(file);
+    free(cache);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "stock_store" )==0 ) {
+    PRINT_TEST;
+    // Checks that a stock store loads a ticker's file on first use only,
+    // drops the least recently used stock when over its budget, which
+    // fits FB and TSLA but not all three, and still answers stats for
+    // dropped stocks without loading them again
+    stock_store_t store;
+    stock_store_init(&store, 16000);
+    stock_store_add(&store, "FB", "data/stock-FB-08-02-2021.txt");
+    stock_store_add(&store, "GOOG", "data/stock-GOOG-08-02-2021.txt");
+    stock_store_add(&store, "TSLA", "data/stock-TSLA-08-02-2021.txt");
+    stock_store_add(&store, "GONE", "data/not-there.txt");
+    char *gets[8] = {"FB", "GOOG", "FB", "TSLA", "GOOG", "GONE", "MSFT", "FB"};
+    for(int i=0; i<8; i++){
+      stock_t *stock = stock_store_get(&store, gets[i]);
+      printf("get   %-5s %-6s count %4d loads %ld hits %ld evictions %ld bytes %ld\n",
+             gets[i], stock != NULL ? "found" : "NULL", stock != NULL ? stock->count : -1,
+             store.loads, store.hits, store.evictions, store.bytes);
+    }
+    char *queries[4] = {"GOOG", "TSLA", "FB", "MSFT"};
+    for(int i=0; i<4; i++){
+      stock_store_stats_t stats;
+      int ret = stock_store_stats(&store, queries[i], &stats);
+      printf("stats %-5s ret %2d", queries[i], ret);
+      if(ret == 0){
+        printf(" lo %.2f @%d hi %.2f @%d buy %.2f @%d sell %.2f @%d",
+               stats.lo_price, stats.lo_index, stats.hi_price, stats.hi_index,
+               stats.buy_price, stats.best_buy, stats.sell_price, stats.best_sell);
+      }
+      printf(" loads %ld\n", store.loads);
+    }
+    stock_store_free(&store);
+  } // ENDTEST
+
   else if( strcmp( test_name, "count_lines" )==0 ) {
   {
     PRINT_TEST;